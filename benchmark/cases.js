@@ -0,0 +1,236 @@
+// Benchmark cases for benchmark/run.js.
+//
+// Every case gets a fresh in-memory database. `setup` fills it, `fn` performs
+// exactly one timed operation and `teardown` releases prepared statements.
+// `iterations` is the number of timed operations and `concurrency` the number
+// of operations kept in flight at the same time (defaults to 1).
+
+var fs = require('fs');
+var path = require('path');
+
+function fill(db, rows, columns, value, done) {
+    var names = [];
+    var placeholders = [];
+    for (var i = 0; i < columns; i++) {
+        names.push('c' + i);
+        placeholders.push('?');
+    }
+
+    db.serialize(function() {
+        db.run("CREATE TABLE data (id INTEGER PRIMARY KEY, " + names.join(', ') + ")");
+        db.run("BEGIN");
+        var stmt = db.prepare("INSERT INTO data VALUES (?, " + placeholders.join(', ') + ")");
+        for (var i = 0; i < rows; i++) {
+            var params = [ i ];
+            for (var j = 0; j < columns; j++) params.push(value(i, j));
+            stmt.run(params);
+        }
+        stmt.finalize();
+        db.run("COMMIT", done);
+    });
+}
+
+function text(size) {
+    return new Array(size + 1).join('x');
+}
+
+function blob(size) {
+    var buffer = new Buffer(size);
+    buffer.fill(0x2a);
+    return buffer;
+}
+
+function integerRows(rows) {
+    return function(db, done) {
+        fill(db, rows, 2, function(i, j) {
+            return j ? 'Row ' + i : i * 7;
+        }, done);
+    };
+}
+
+function payloadRows(rows, payload) {
+    return function(db, done) {
+        fill(db, rows, 1, function() { return payload; }, done);
+    };
+}
+
+function selectAll(sql) {
+    var stmt;
+    return {
+        fn: function(db, done) {
+            if (!stmt) stmt = db.prepare(sql);
+            stmt.all(done);
+        },
+        teardown: function(db, done) {
+            if (stmt) stmt.finalize(done);
+            else done();
+            stmt = null;
+        }
+    };
+}
+
+function merge(target, source) {
+    for (var k in source) target[k] = source[k];
+    return target;
+}
+
+var cases = module.exports = {};
+
+cases['get: point lookup, prepared'] = (function() {
+    var stmt, i = 0;
+    return {
+        iterations: 20000,
+        setup: integerRows(10000),
+        fn: function(db, done) {
+            if (!stmt) stmt = db.prepare("SELECT * FROM data WHERE id = ?");
+            stmt.get(i++ % 10000, done);
+        },
+        teardown: function(db, done) { stmt.finalize(done); stmt = null; }
+    };
+})();
+
+cases['get: point lookup, db.get'] = (function() {
+    var i = 0;
+    return {
+        iterations: 10000,
+        setup: integerRows(10000),
+        fn: function(db, done) {
+            db.get("SELECT * FROM data WHERE id = ?", i++ % 10000, done);
+        }
+    };
+})();
+
+cases['all: 1k rows'] = merge({
+    iterations: 500,
+    setup: integerRows(1000)
+}, selectAll("SELECT * FROM data"));
+
+cases['all: 100k rows'] = merge({
+    iterations: 10,
+    setup: integerRows(100000)
+}, selectAll("SELECT * FROM data"));
+
+cases['each: 100k rows'] = {
+    iterations: 10,
+    setup: integerRows(100000),
+    fn: function(db, done) {
+        db.each("SELECT * FROM data", function(err) {
+            if (err) throw err;
+        }, done);
+    }
+};
+
+cases['all: wide rows, 50 columns x 1k'] = merge({
+    iterations: 50,
+    setup: function(db, done) {
+        fill(db, 1000, 50, function(i, j) {
+            return j % 2 ? i * j : 'value ' + j;
+        }, done);
+    }
+}, selectAll("SELECT * FROM data"));
+
+[ 16, 1024, 65536 ].forEach(function(size) {
+    cases['all: TEXT ' + size + 'B x 1k'] = merge({
+        iterations: size > 1024 ? 20 : 200,
+        setup: payloadRows(1000, text(size))
+    }, selectAll("SELECT * FROM data"));
+
+    cases['all: BLOB ' + size + 'B x 1k'] = merge({
+        iterations: size > 1024 ? 20 : 200,
+        setup: payloadRows(1000, blob(size))
+    }, selectAll("SELECT * FROM data"));
+});
+
+cases['bind: positional parameters'] = (function() {
+    var stmt, i = 0;
+    return {
+        iterations: 20000,
+        setup: function(db, done) {
+            db.run("CREATE TABLE data (a INT, b TEXT, c REAL, d TEXT)", done);
+        },
+        fn: function(db, done) {
+            if (!stmt) stmt = db.prepare("INSERT INTO data VALUES (?, ?, ?, ?)");
+            stmt.run(i++, 'text', 1.5, 'more text', done);
+        },
+        teardown: function(db, done) { stmt.finalize(done); stmt = null; }
+    };
+})();
+
+cases['bind: named parameters'] = (function() {
+    var stmt, i = 0;
+    return {
+        iterations: 20000,
+        setup: function(db, done) {
+            db.run("CREATE TABLE data (a INT, b TEXT, c REAL, d TEXT)", done);
+        },
+        fn: function(db, done) {
+            if (!stmt) stmt = db.prepare("INSERT INTO data VALUES ($a, $b, $c, $d)");
+            stmt.run({ $a: i++, $b: 'text', $c: 1.5, $d: 'more text' }, done);
+        },
+        teardown: function(db, done) { stmt.finalize(done); stmt = null; }
+    };
+})();
+
+cases['prepare: prepare and finalize'] = {
+    iterations: 10000,
+    setup: integerRows(10),
+    fn: function(db, done) {
+        db.prepare("SELECT id, c0, c1 FROM data WHERE id > ? ORDER BY c0 LIMIT 5").finalize(done);
+    }
+};
+
+cases['exec: 10k row insert script'] = (function() {
+    var script = fs.readFileSync(path.join(__dirname, 'insert-transaction.sql'), 'utf8');
+    return {
+        iterations: 10,
+        fn: function(db, done) {
+            db.exec("DROP TABLE IF EXISTS foo; " + script, done);
+        }
+    };
+})();
+
+[ 'serialize', 'parallelize' ].forEach(function(mode) {
+    cases['mode: ' + mode + ', 1k inserts'] = {
+        iterations: 20,
+        setup: function(db, done) {
+            db.run("CREATE TABLE data (id INT, txt TEXT)", done);
+        },
+        fn: function(db, done) {
+            var remaining = 1000;
+            function inserted(err) {
+                if (err) throw err;
+                if (--remaining === 0) done();
+            }
+            db[mode](function() {
+                for (var i = 0; i < 1000; i++) {
+                    db.run("INSERT INTO data VALUES (?, ?)", i, 'Row ' + i, inserted);
+                }
+            });
+        }
+    };
+});
+
+cases['concurrent: 8 statements in flight'] = (function() {
+    var statements = [], i = 0;
+    return {
+        iterations: 20000,
+        concurrency: 8,
+        setup: integerRows(10000),
+        fn: function(db, done) {
+            if (!statements.length) {
+                for (var s = 0; s < 8; s++) {
+                    statements.push(db.prepare("SELECT * FROM data WHERE id = ?"));
+                }
+            }
+            var n = i++;
+            statements[n % 8].get(n % 10000, done);
+        },
+        teardown: function(db, done) {
+            var remaining = statements.length;
+            statements.forEach(function(stmt) {
+                stmt.finalize(function() { if (--remaining === 0) done(); });
+            });
+            statements = [];
+        }
+    };
+})();
@@ -0,0 +1,254 @@
+#!/usr/bin/env node
+
+// Mixed read/write load against a file-backed WAL database from several
+// processes, each holding several Database instances. Sweeps the threadpool
+// size, busy timeout and read ratio and reports latency percentiles and the
+// rate of SQLITE_BUSY errors for every combination.
+//
+//   node benchmark/contention.js [options]
+//
+//   --processes <n>       Worker processes per run (default 4).
+//   --connections <n>     Database instances per process (default 2).
+//   --inflight <n>        Queries in flight per instance (default 4).
+//   --duration <sec>      Length of each run (default 5).
+//   --threads <list>      UV_THREADPOOL_SIZE values, comma separated (default 4,16).
+//   --busy <list>         Busy timeouts in ms (default 0,100,1000).
+//   --reads <list>        Fraction of reads, 0-1 (default 0.5,0.9,0.99).
+//   --rows <n>            Rows in the table (default 10000).
+//   --file <path>         Database file (default benchmark/contention.db).
+//   --json <file>         Write machine-readable results to <file>.
+
+var fs = require('fs');
+var path = require('path');
+var child_process = require('child_process');
+
+function list(value, parse) {
+    return String(value).split(',').map(parse);
+}
+
+function parseArgs(argv) {
+    var options = {
+        processes: 4,
+        connections: 2,
+        inflight: 4,
+        duration: 5,
+        threads: '4,16',
+        busy: '0,100,1000',
+        reads: '0.5,0.9,0.99',
+        rows: 10000,
+        file: path.join(__dirname, 'contention.db'),
+        json: null
+    };
+    for (var i = 0; i < argv.length; i++) {
+        var name = argv[i].replace(/^--/, '');
+        if (!(name in options)) {
+            console.error('Unknown option: ' + argv[i]);
+            process.exit(2);
+        }
+        options[name] = argv[++i];
+    }
+    options.processes = parseInt(options.processes, 10);
+    options.connections = parseInt(options.connections, 10);
+    options.inflight = parseInt(options.inflight, 10);
+    options.duration = parseFloat(options.duration);
+    options.rows = parseInt(options.rows, 10);
+    options.threads = list(options.threads, function(n) { return parseInt(n, 10); });
+    options.busy = list(options.busy, function(n) { return parseInt(n, 10); });
+    options.reads = list(options.reads, parseFloat);
+    return options;
+}
+
+function now() {
+    var t = process.hrtime();
+    return t[0] * 1e3 + t[1] / 1e6;
+}
+
+function percentile(sorted, p) {
+    if (!sorted.length) return null;
+    var index = Math.min(sorted.length - 1, Math.ceil(p / 100 * sorted.length) - 1);
+    return Math.round(sorted[Math.max(0, index)] * 1000) / 1000;
+}
+
+function summarize(latencies) {
+    latencies.sort(function(a, b) { return a - b; });
+    return {
+        count: latencies.length,
+        p50: percentile(latencies, 50),
+        p99: percentile(latencies, 99),
+        p999: percentile(latencies, 99.9)
+    };
+}
+
+// Runs inside a forked process: drives the load and reports raw samples.
+function worker(config) {
+    var sqlite3 = require('../lib/sqlite3');
+    var samples = { read: [], write: [] };
+    var counts = { read: 0, write: 0, busy: 0, errors: 0 };
+    var deadline = now() + config.duration * 1000;
+    var open = config.connections;
+
+    function loop(db) {
+        if (now() >= deadline) {
+            if (--db.inflight === 0) finish(db);
+            return;
+        }
+        var read = Math.random() < config.reads;
+        var key = Math.floor(Math.random() * config.rows);
+        var start = now();
+        function done(err) {
+            if (err) {
+                if (err.code === 'SQLITE_BUSY') counts.busy++;
+                else counts.errors++;
+            }
+            else {
+                samples[read ? 'read' : 'write'].push(now() - start);
+            }
+            counts[read ? 'read' : 'write']++;
+            loop(db);
+        }
+        if (read) db.get("SELECT v FROM kv WHERE k = ?", key, done);
+        else db.run("UPDATE kv SET v = ?, n = n + 1 WHERE k = ?", Math.random(), key, done);
+    }
+
+    function finish(db) {
+        db.close(function() {
+            // The parent disconnects once it received the results, which
+            // lets this process exit.
+            if (--open === 0) process.send({ samples: samples, counts: counts });
+        });
+    }
+
+    for (var c = 0; c < config.connections; c++) {
+        (function() {
+            var db = new sqlite3.Database(config.file, function(err) {
+                if (err) throw err;
+                db.configure('busyTimeout', config.busy);
+                db.inflight = config.inflight;
+                for (var i = 0; i < config.inflight; i++) loop(db);
+            });
+        })();
+    }
+}
+
+function prepare(options, callback) {
+    var sqlite3 = require('../lib/sqlite3');
+    [ '', '-wal', '-shm' ].forEach(function(suffix) {
+        try { fs.unlinkSync(options.file + suffix); } catch (err) {}
+    });
+    var db = new sqlite3.Database(options.file);
+    db.serialize(function() {
+        db.run("PRAGMA journal_mode = WAL");
+        db.run("CREATE TABLE kv (k INTEGER PRIMARY KEY, v REAL, n INTEGER)");
+        db.run("BEGIN");
+        var stmt = db.prepare("INSERT INTO kv VALUES (?, ?, 0)");
+        for (var i = 0; i < options.rows; i++) stmt.run(i, Math.random());
+        stmt.finalize();
+        db.run("COMMIT");
+    });
+    db.close(callback);
+}
+
+function run(options, threads, busy, reads, callback) {
+    var config = {
+        file: options.file,
+        connections: options.connections,
+        inflight: options.inflight,
+        duration: options.duration,
+        rows: options.rows,
+        busy: busy,
+        reads: reads
+    };
+    var env = {};
+    for (var k in process.env) env[k] = process.env[k];
+    env.UV_THREADPOOL_SIZE = String(threads);
+
+    var samples = { read: [], write: [] };
+    var counts = { read: 0, write: 0, busy: 0, errors: 0 };
+    var remaining = options.processes;
+
+    for (var p = 0; p < options.processes; p++) {
+        var child = child_process.fork(__filename, [ '--worker', JSON.stringify(config) ], { env: env });
+        child.on('message', function(message) {
+            this.disconnect();
+            samples.read = samples.read.concat(message.samples.read);
+            samples.write = samples.write.concat(message.samples.write);
+            for (var k in counts) counts[k] += message.counts[k];
+        });
+        child.on('exit', function(code) {
+            if (code !== 0) throw new Error('Worker exited with code ' + code);
+            if (--remaining > 0) return;
+            var attempts = counts.read + counts.write;
+            callback({
+                threadpool: threads,
+                busy_timeout: busy,
+                read_ratio: reads,
+                ops_per_sec: Math.round(attempts / options.duration),
+                busy_rate: attempts ? counts.busy / attempts : 0,
+                errors: counts.errors,
+                read_ms: summarize(samples.read),
+                write_ms: summarize(samples.write)
+            });
+        });
+    }
+}
+
+function pad(str, length) {
+    str = String(str);
+    while (str.length < length) str += ' ';
+    return str;
+}
+
+function print(result) {
+    console.log(pad(result.threadpool, 9) + pad(result.busy_timeout, 8) + pad(result.read_ratio, 8) +
+        pad(result.ops_per_sec, 10) + pad((result.busy_rate * 100).toFixed(2) + '%', 9) +
+        pad([ result.read_ms.p50, result.read_ms.p99, result.read_ms.p999 ].join('/'), 26) +
+        [ result.write_ms.p50, result.write_ms.p99, result.write_ms.p999 ].join('/'));
+}
+
+if (process.argv[2] === '--worker') {
+    worker(JSON.parse(process.argv[3]));
+}
+else {
+    var options = parseArgs(process.argv.slice(2));
+    var combinations = [];
+    options.threads.forEach(function(threads) {
+        options.busy.forEach(function(busy) {
+            options.reads.forEach(function(reads) {
+                combinations.push([ threads, busy, reads ]);
+            });
+        });
+    });
+
+    console.log(pad('threads', 9) + pad('busy', 8) + pad('reads', 8) + pad('ops/sec', 10) +
+        pad('busy', 9) + pad('read p50/p99/p999 ms', 26) + 'write p50/p99/p999 ms');
+
+    var results = [];
+    (function next() {
+        if (!combinations.length) {
+            if (options.json) {
+                fs.writeFileSync(options.json, JSON.stringify({
+                    node: process.version,
+                    platform: process.platform + '-' + process.arch,
+                    processes: options.processes,
+                    connections: options.connections,
+                    inflight: options.inflight,
+                    duration: options.duration,
+                    results: results
+                }, null, 2));
+            }
+            [ '', '-wal', '-shm' ].forEach(function(suffix) {
+                try { fs.unlinkSync(options.file + suffix); } catch (err) {}
+            });
+            return;
+        }
+        var c = combinations.shift();
+        prepare(options, function(err) {
+            if (err) throw err;
+            run(options, c[0], c[1], c[2], function(result) {
+                print(result);
+                results.push(result);
+                next();
+            });
+        });
+    })();
+}
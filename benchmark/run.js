@@ -0,0 +1,194 @@
+#!/usr/bin/env node
+
+// Runs the benchmark cases from benchmark/cases.js.
+//
+//   node benchmark/run.js [options]
+//
+//   --filter <regexp>     Only run cases whose name matches.
+//   --scale <factor>      Multiply the iteration count of every case.
+//   --json <file>         Write machine-readable results to <file>.
+//   --baseline <file>     Compare against results previously written with
+//                         --json and print the relative change.
+//   --threshold <pct>     With --baseline, exit with status 1 when a case's
+//                         ops/sec regressed by more than <pct> percent.
+
+var fs = require('fs');
+var sqlite3 = require('../lib/sqlite3');
+var cases = require('./cases');
+
+function parseArgs(argv) {
+    var options = { filter: null, scale: 1, json: null, baseline: null, threshold: null };
+    for (var i = 0; i < argv.length; i++) {
+        var name = argv[i].replace(/^--/, '');
+        if (!(name in options)) {
+            console.error('Unknown option: ' + argv[i]);
+            process.exit(2);
+        }
+        options[name] = argv[++i];
+    }
+    if (options.filter) options.filter = new RegExp(options.filter);
+    options.scale = parseFloat(options.scale);
+    if (options.threshold !== null) options.threshold = parseFloat(options.threshold);
+    return options;
+}
+
+// Tracks time spent in garbage collection where the runtime exposes it.
+var gc = (function() {
+    var total = 0;
+    try {
+        var perf = require('perf_hooks');
+        var observer = new perf.PerformanceObserver(function(list) {
+            list.getEntries().forEach(function(entry) { total += entry.duration; });
+        });
+        observer.observe({ entryTypes: [ 'gc' ] });
+    } catch (err) {
+        return { time: function() { return null; } };
+    }
+    return { time: function() { return total; } };
+})();
+
+function now() {
+    var t = process.hrtime();
+    return t[0] * 1e3 + t[1] / 1e6;
+}
+
+function percentile(sorted, p) {
+    if (!sorted.length) return 0;
+    var index = Math.min(sorted.length - 1, Math.ceil(p / 100 * sorted.length) - 1);
+    return sorted[Math.max(0, index)];
+}
+
+function round(value) {
+    return value === null ? null : Math.round(value * 1000) / 1000;
+}
+
+function measure(name, spec, scale, callback) {
+    var db = new sqlite3.Database(':memory:');
+    var iterations = Math.max(1, Math.round((spec.iterations || 1000) * scale));
+    var concurrency = spec.concurrency || 1;
+    var latencies = [];
+    var started = 0, finished = 0;
+    var start, gcStart;
+
+    function setup(done) {
+        if (spec.setup) spec.setup(db, function(err) { if (err) throw err; done(); });
+        else done();
+    }
+
+    function teardown(done) {
+        if (spec.teardown) spec.teardown(db, done);
+        else done();
+    }
+
+    function next() {
+        if (started >= iterations) return;
+        started++;
+        var t = now();
+        spec.fn(db, function(err) {
+            if (err) throw err;
+            latencies.push(now() - t);
+            if (++finished === iterations) complete();
+            else next();
+        });
+    }
+
+    function complete() {
+        var elapsed = now() - start;
+        var gcTime = gc.time();
+        var rss = process.memoryUsage().rss;
+        teardown(function() {
+            db.close(function(err) {
+                if (err) throw err;
+                latencies.sort(function(a, b) { return a - b; });
+                callback({
+                    name: name,
+                    iterations: iterations,
+                    concurrency: concurrency,
+                    ops_per_sec: round(iterations / elapsed * 1000),
+                    latency_ms: {
+                        mean: round(elapsed / iterations),
+                        p50: round(percentile(latencies, 50)),
+                        p90: round(percentile(latencies, 90)),
+                        p99: round(percentile(latencies, 99)),
+                        max: round(latencies[latencies.length - 1])
+                    },
+                    rss_bytes: rss,
+                    gc_ms: gcTime === null ? null : round(gcTime - gcStart)
+                });
+            });
+        });
+    }
+
+    setup(function() {
+        if (global.gc) global.gc();
+        gcStart = gc.time();
+        start = now();
+        for (var i = 0; i < concurrency; i++) next();
+    });
+}
+
+function pad(str, length) {
+    str = String(str);
+    while (str.length < length) str += ' ';
+    return str;
+}
+
+function change(current, previous) {
+    if (!previous) return '';
+    var delta = (current - previous) / previous * 100;
+    return (delta >= 0 ? '+' : '') + delta.toFixed(1) + '%';
+}
+
+function report(results, baseline, threshold) {
+    var previous = {};
+    if (baseline) {
+        baseline.results.forEach(function(result) { previous[result.name] = result; });
+    }
+
+    var regressions = [];
+    console.log(pad('case', 40) + pad('ops/sec', 14) + pad('p50 ms', 10) + pad('p99 ms', 10) +
+        pad('rss MB', 10) + (baseline ? 'vs baseline' : ''));
+    results.forEach(function(result) {
+        var base = previous[result.name];
+        var delta = base ? change(result.ops_per_sec, base.ops_per_sec) : '';
+        console.log(pad(result.name, 40) + pad(result.ops_per_sec, 14) +
+            pad(result.latency_ms.p50, 10) + pad(result.latency_ms.p99, 10) +
+            pad((result.rss_bytes / 1048576).toFixed(1), 10) + delta);
+        if (base && threshold !== null &&
+                result.ops_per_sec < base.ops_per_sec * (1 - threshold / 100)) {
+            regressions.push(result.name);
+        }
+    });
+    return regressions;
+}
+
+var options = parseArgs(process.argv.slice(2));
+var names = Object.keys(cases).filter(function(name) {
+    return !options.filter || options.filter.test(name);
+});
+var results = [];
+
+(function run() {
+    if (!names.length) {
+        var baseline = options.baseline ? JSON.parse(fs.readFileSync(options.baseline, 'utf8')) : null;
+        var output = {
+            sqlite: sqlite3.VERSION,
+            node: process.version,
+            platform: process.platform + '-' + process.arch,
+            date: new Date().toISOString(),
+            results: results
+        };
+        if (options.json) fs.writeFileSync(options.json, JSON.stringify(output, null, 2));
+        var regressions = report(results, baseline, options.threshold);
+        if (regressions.length) {
+            console.error('Regressed by more than ' + options.threshold + '%: ' + regressions.join(', '));
+            process.exit(1);
+        }
+        return;
+    }
+    var name = names.shift();
+    measure(name, cases[name], options.scale, function(result) {
+        results.push(result);
+        run();
+    });
+})();
@@ -2,7 +2,8 @@
   "includes": [ "deps/common-sqlite.gypi" ],
   "variables": {
       "sqlite%":"internal",
-      "sqlite_libname%":"sqlite3"
+      "sqlite_libname%":"sqlite3",
+      "sqlite_io_uring%":"false"
   },
   "targets": [
     {
@@ -29,12 +30,26 @@
               "deps/sqlite3.gyp:sqlite3"
             ]
         }
-        ]
+        ],
+        ["sqlite_io_uring == 'true' and OS == 'linux'", {
+            "defines": [ "NODE_SQLITE3_IO_URING" ],
+            "sources": [ "src/vfs_io_uring.cc" ]
+        }]
       ],
       "sources": [
+        "src/allocator.cc",
+        "src/arena.cc",
+        "src/blob.cc",
+        "src/checkpointer.cc",
         "src/database.cc",
+        "src/function.cc",
         "src/node_sqlite3.cc",
-        "src/statement.cc"
+        "src/sketch.cc",
+        "src/spill.cc",
+        "src/statement.cc",
+        "src/timeline.cc",
+        "src/vector.cc",
+        "src/vfs_memory.cc"
       ]
     },
     {
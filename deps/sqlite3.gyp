@@ -79,7 +79,8 @@
         'defines': [
           'SQLITE_THREADSAFE=1',
           'SQLITE_ENABLE_FTS3',
-          'SQLITE_ENABLE_RTREE'
+          'SQLITE_ENABLE_RTREE',
+          'SQLITE_ENABLE_UNLOCK_NOTIFY'
         ],
       },
       'cflags_cc': [
@@ -90,7 +91,25 @@
         '_REENTRANT=1',
         'SQLITE_THREADSAFE=1',
         'SQLITE_ENABLE_FTS3',
-        'SQLITE_ENABLE_RTREE'
+        'SQLITE_ENABLE_RTREE',
+        'SQLITE_ENABLE_UNLOCK_NOTIFY'
+      ],
+      'conditions': [
+        ['sqlite_tuned == "true"', {
+          # Shared cache, the progress handler, extension loading and memory
+          # statistics stay enabled because the bindings expose them.
+          'defines': [
+            'SQLITE_OMIT_DEPRECATED',
+            'SQLITE_MAX_EXPR_DEPTH=0',
+            'SQLITE_USE_ALLOCA',
+            'SQLITE_OMIT_GET_TABLE'
+          ],
+          'direct_dependent_settings': {
+            'defines': [
+              'SQLITE_OMIT_DEPRECATED'
+            ]
+          }
+        }]
       ],
       'export_dependent_settings': [
         'action_before_build',
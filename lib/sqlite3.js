@@ -4,6 +4,8 @@ var binding_path = binary.find(path.resolve(path.join(__dirname,'../package.json
 var binding = require(binding_path);
 var sqlite3 = module.exports = exports = binding;
 var EventEmitter = require('events').EventEmitter;
+var Readable = require('stream').Readable;
+var Writable = require('stream').Writable;
 
 function normalizeMethod (fn) {
     return function (sql) {
@@ -28,21 +30,23 @@ function inherits(target, source) {
 }
 
 sqlite3.cached = {
-    Database: function(file, a, b) {
-        if (file === '' || file === ':memory:') {
+    Database: function(file, a, b, c) {
+        if (file === '' || file === ':memory:' || Buffer.isBuffer(file)) {
             // Don't cache special databases.
-            return new Database(file, a, b);
+            return new Database(file, a, b, c);
         }
 
         file = path.resolve(file);
 
         if (!sqlite3.cached.objects[file]) {
-            var db =sqlite3.cached.objects[file] = new Database(file, a, b);
+            var db =sqlite3.cached.objects[file] = new Database(file, a, b, c);
         }
         else {
             // Make sure the callback is called.
             var db = sqlite3.cached.objects[file];
-            var callback = (typeof a === 'number') ? b : a;
+            var callback = [a, b, c].filter(function(arg) {
+                return typeof arg === 'function';
+            })[0];
             if (typeof callback === 'function') {
                 function cb() { callback.call(db, null); }
                 if (db.open) process.nextTick(cb);
@@ -58,9 +62,11 @@ sqlite3.cached = {
 
 var Database = sqlite3.Database;
 var Statement = sqlite3.Statement;
+var Blob = sqlite3.Blob;
 
 inherits(Database, EventEmitter);
 inherits(Statement, EventEmitter);
+inherits(Blob, EventEmitter);
 
 // Database#prepare(sql, [bind1, bind2, ...], [callback])
 Database.prototype.prepare = normalizeMethod(function(statement, params) {
@@ -124,9 +130,57 @@ Statement.prototype.map = function() {
     return this.all.apply(this, params);
 };
 
+// Database#openBlob(table, column, rowid, [options], [callback])
+Database.prototype.openBlob = function(table, column, rowid, options, callback) {
+    if (typeof options === 'function') {
+        callback = options;
+        options = undefined;
+    }
+    options = options || {};
+    return new Blob(this, options.database || 'main', table, column, rowid,
+        !!options.writable, callback);
+};
+
+// Blob#createReadStream([options])
+// Reads the BLOB from options.start up to options.end (exclusive) in
+// chunks of options.highWaterMark bytes.
+Blob.prototype.createReadStream = function(options) {
+    options = options || {};
+    var blob = this;
+    var position = options.start || 0;
+    var end = options.end;
+    var stream = new Readable({ highWaterMark: options.highWaterMark || 65536 });
+    stream._read = function(size) {
+        if (end !== undefined) size = Math.max(Math.min(size, end - position), 0);
+        blob.read(position, size, function(err, chunk) {
+            if (err) return stream.emit('error', err);
+            position += chunk.length;
+            stream.push(chunk.length ? chunk : null);
+        });
+    };
+    return stream;
+};
+
+// Blob#createWriteStream([options])
+// Overwrites the BLOB starting at options.start. Writes can't change the
+// size of the BLOB.
+Blob.prototype.createWriteStream = function(options) {
+    options = options || {};
+    var blob = this;
+    var position = options.start || 0;
+    var stream = new Writable({ highWaterMark: options.highWaterMark || 65536 });
+    stream._write = function(chunk, encoding, callback) {
+        blob.write(position, chunk, function(err) {
+            if (!err) position += chunk.length;
+            callback(err);
+        });
+    };
+    return stream;
+};
+
 var isVerbose = false;
 
-var supportedEvents = [ 'trace', 'profile', 'insert', 'update', 'delete' ];
+var supportedEvents = [ 'trace', 'profile', 'insert', 'update', 'delete', 'changes' ];
 
 Database.prototype.addListener = Database.prototype.on = function(type) {
     var val = EventEmitter.prototype.addListener.apply(this, arguments);
@@ -152,6 +206,45 @@ Database.prototype.removeAllListeners = function(type) {
     return val;
 };
 
+// Records when every asynchronous database operation was scheduled,
+// dequeued, run on the thread pool and completed, and writes the result as
+// Chrome trace event JSON (load it in chrome://tracing).
+sqlite3.timeline = {
+    start: function() {
+        sqlite3.startTimeline();
+    },
+
+    stop: function(file, callback) {
+        var events = sqlite3.stopTimeline();
+        var trace = [];
+        var pid = process.pid;
+        events.forEach(function(event, id) {
+            var args = {
+                sql: event.sql,
+                queued_us: event.dequeued - event.scheduled,
+                threadpool_wait_us: event.started - event.dequeued
+            };
+            // Waiting in the Database/Statement queue and for a free
+            // thread pool thread, shown as asynchronous slices.
+            trace.push({ name: event.name, cat: 'queue', ph: 'b', id: id, pid: pid, tid: 0, ts: event.scheduled });
+            trace.push({ name: event.name, cat: 'queue', ph: 'e', id: id, pid: pid, tid: 0, ts: event.dequeued });
+            trace.push({ name: event.name, cat: 'threadpool', ph: 'b', id: id, pid: pid, tid: 0, ts: event.dequeued });
+            trace.push({ name: event.name, cat: 'threadpool', ph: 'e', id: id, pid: pid, tid: 0, ts: event.started });
+            // Time spent on the worker thread and in the callback.
+            trace.push({ name: event.name, cat: 'work', ph: 'X', pid: pid, tid: event.thread,
+                ts: event.started, dur: event.finished - event.started, args: args });
+            trace.push({ name: event.name + ' callback', cat: 'callback', ph: 'X', pid: pid, tid: 0,
+                ts: event.completed, dur: event.done - event.completed, args: { sql: event.sql } });
+        });
+        trace.push({ name: 'thread_name', ph: 'M', pid: pid, tid: 0, args: { name: 'main' } });
+
+        require('fs').writeFile(file, JSON.stringify({ traceEvents: trace }), function(err) {
+            if (typeof callback === 'function') callback(err || null, events.length);
+            else if (err) throw err;
+        });
+    }
+};
+
 // Save the stack trace over EIO callbacks.
 sqlite3.verbose = function() {
     if (!isVerbose) {
@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+
+# Builds the module with link-time and profile-guided optimization: first an
+# instrumented build, then a training run over the benchmark suite, then the
+# final build using the recorded profile. Extra arguments are passed to
+# node-pre-gyp (e.g. --sqlite_tuned=true).
+
+set -u -e
+
+cd "$(dirname "$0")/.."
+
+NODE_PRE_GYP=./node_modules/.bin/node-pre-gyp
+PROFILE_DIR="$(pwd)/build/pgo"
+SCALE=${PGO_SCALE:-0.2}
+
+rm -rf "$PROFILE_DIR"
+mkdir -p "$PROFILE_DIR"
+
+echo "Building instrumented module"
+$NODE_PRE_GYP rebuild --sqlite_lto=true --sqlite_pgo=generate --sqlite_pgo_dir="$PROFILE_DIR" "$@"
+
+echo "Training on benchmark/run.js (scale $SCALE)"
+node benchmark/run.js --scale "$SCALE"
+
+# clang writes raw profiles that have to be merged first; gcc reads its
+# .gcda files directly.
+if ls "$PROFILE_DIR"/*.profraw > /dev/null 2>&1; then
+    xcrun llvm-profdata merge -output="$PROFILE_DIR/default.profdata" "$PROFILE_DIR"/*.profraw 2> /dev/null ||
+        llvm-profdata merge -output="$PROFILE_DIR/default.profdata" "$PROFILE_DIR"/*.profraw
+fi
+
+echo "Building optimized module"
+# Keep the profile: rebuild would remove build/ and the profile with it.
+mv "$PROFILE_DIR" "$PROFILE_DIR.keep"
+$NODE_PRE_GYP clean
+mkdir -p build
+mv "$PROFILE_DIR.keep" "$PROFILE_DIR"
+$NODE_PRE_GYP build --sqlite_lto=true --sqlite_pgo=use --sqlite_pgo_dir="$PROFILE_DIR" "$@"
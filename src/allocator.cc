@@ -0,0 +1,316 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "threading.h"
+#include "allocator.h"
+
+using namespace node_sqlite3;
+
+#if defined(_MSC_VER)
+    #include <windows.h>
+    #define THREAD_LOCAL __declspec(thread)
+    #define ATOMIC_ADD(ptr, value) InterlockedExchangeAdd64((ptr), (value))
+#else
+    #define THREAD_LOCAL __thread
+    #define ATOMIC_ADD(ptr, value) __sync_fetch_and_add((ptr), (value))
+#endif
+
+// Every block starts with a header holding its usable size, which keeps the
+// user pointer 8-byte aligned as SQLite requires.
+#define HEADER_SIZE 8
+
+// Size classes: 16-byte steps up to 256 bytes, then four steps per power of
+// two up to Allocator::MaxPooled.
+#define SMALL_CLASSES 16
+#define CLASSES 44
+
+// Size of the chunks reserved from the system for the pools.
+#define SLAB_SIZE 65536
+
+// Blocks kept in a thread cache per class before half of them are returned
+// to the global pool.
+#define CACHE_BYTES 65536
+#define CACHE_MIN 4
+
+namespace {
+
+struct Block {
+    Block* next;
+};
+
+struct ThreadCache {
+    Block* head[CLASSES];
+    unsigned int count[CLASSES];
+    // Not added to the global stats yet, see Publish().
+    int64_t allocated;
+    int64_t allocations;
+    int64_t cache_hits;
+};
+
+struct Pool {
+    NODE_SQLITE3_MUTEX_t
+    Block* head;
+    unsigned int count;
+
+    void Init() {
+        NODE_SQLITE3_MUTEX_INIT
+        head = NULL;
+        count = 0;
+    }
+};
+
+THREAD_LOCAL ThreadCache cache;
+Pool pools[CLASSES];
+Allocator::Stats stats;
+
+inline int HighestBit(unsigned int n) {
+#if defined(__GNUC__)
+    return 31 - __builtin_clz(n);
+#else
+    int bit = 0;
+    while (n >>= 1) bit++;
+    return bit;
+#endif
+}
+
+inline int ClassIndex(int size) {
+    if (size <= 16 * SMALL_CLASSES) {
+        return size <= 16 ? 0 : (size - 1) / 16;
+    }
+    int bit = HighestBit(size - 1);
+    return SMALL_CLASSES + (bit - 8) * 4 + ((size - 1) >> (bit - 2)) - 4;
+}
+
+inline int ClassSize(int index) {
+    if (index < SMALL_CLASSES) {
+        return (index + 1) * 16;
+    }
+    int bit = 8 + (index - SMALL_CLASSES) / 4;
+    int step = (index - SMALL_CLASSES) % 4;
+    return (1 << bit) + (step + 1) * (1 << (bit - 2));
+}
+
+inline unsigned int CacheLimit(int index) {
+    unsigned int limit = CACHE_BYTES / ClassSize(index);
+    return limit < CACHE_MIN ? CACHE_MIN : limit;
+}
+
+inline void* ToUser(char* block, int64_t size) {
+    *(int64_t*)block = size;
+    return block + HEADER_SIZE;
+}
+
+inline char* ToBlock(void* user) {
+    return (char*)user - HEADER_SIZE;
+}
+
+// Adds the counters of the calling thread to the global stats. Only called
+// on slow paths, so that the thread caches don't contend on the stats.
+void Publish() {
+    ThreadCache& local = cache;
+    if (local.allocated != 0) {
+        ATOMIC_ADD(&stats.allocated, local.allocated);
+        local.allocated = 0;
+    }
+    if (local.allocations != 0) {
+        ATOMIC_ADD(&stats.allocations, local.allocations);
+        local.allocations = 0;
+    }
+    if (local.cache_hits != 0) {
+        ATOMIC_ADD(&stats.cache_hits, local.cache_hits);
+        local.cache_hits = 0;
+    }
+}
+
+// Moves up to `wanted` blocks from the global pool into the thread cache,
+// reserving a new slab when the pool is empty. Returns false when out of
+// memory.
+bool Refill(int index, unsigned int wanted) {
+    Pool& pool = pools[index];
+    int block_size = ClassSize(index) + HEADER_SIZE;
+
+    NODE_SQLITE3_MUTEX_LOCK(&pool.mutex)
+    if (pool.head == NULL) {
+        int blocks = SLAB_SIZE / block_size;
+        if (blocks < 1) blocks = 1;
+        char* slab = (char*)malloc((size_t)blocks * block_size);
+        if (slab == NULL) {
+            NODE_SQLITE3_MUTEX_UNLOCK(&pool.mutex)
+            return false;
+        }
+        ATOMIC_ADD(&stats.reserved, (int64_t)blocks * block_size);
+        for (int i = blocks - 1; i >= 0; i--) {
+            Block* block = (Block*)(slab + (size_t)i * block_size);
+            block->next = pool.head;
+            pool.head = block;
+        }
+        pool.count += blocks;
+    }
+
+    ThreadCache& local = cache;
+    while (wanted-- > 0 && pool.head != NULL) {
+        Block* block = pool.head;
+        pool.head = block->next;
+        pool.count--;
+        block->next = local.head[index];
+        local.head[index] = block;
+        local.count[index]++;
+    }
+    NODE_SQLITE3_MUTEX_UNLOCK(&pool.mutex)
+
+    ATOMIC_ADD(&stats.refills, (int64_t)1);
+    Publish();
+    return true;
+}
+
+// Returns half of the thread cache of a class to the global pool.
+void Drain(int index) {
+    ThreadCache& local = cache;
+    Pool& pool = pools[index];
+    unsigned int keep = local.count[index] / 2;
+
+    Block* first = local.head[index];
+    Block* last = first;
+    unsigned int moved = 1;
+    for (unsigned int i = 1; i < local.count[index] - keep; i++, moved++) {
+        last = last->next;
+    }
+    local.head[index] = last->next;
+    local.count[index] = keep;
+
+    NODE_SQLITE3_MUTEX_LOCK(&pool.mutex)
+    last->next = pool.head;
+    pool.head = first;
+    pool.count += moved;
+    NODE_SQLITE3_MUTEX_UNLOCK(&pool.mutex)
+
+    Publish();
+}
+
+void* PoolMalloc(int size) {
+    // Note: This function is called from whichever thread runs SQLite.
+    if (size <= 0) size = 1;
+    ThreadCache& local = cache;
+    local.allocations++;
+
+    if (size > Allocator::MaxPooled) {
+        char* block = (char*)malloc((size_t)size + HEADER_SIZE);
+        if (block == NULL) return NULL;
+        local.allocated += size;
+        ATOMIC_ADD(&stats.large, (int64_t)size);
+        Publish();
+        return ToUser(block, size);
+    }
+
+    int index = ClassIndex(size);
+    int64_t usable = ClassSize(index);
+    local.allocated += usable;
+    if (local.head[index] == NULL) {
+        if (!Refill(index, CacheLimit(index) / 2 + 1)) {
+            local.allocated -= usable;
+            return NULL;
+        }
+    }
+    else {
+        local.cache_hits++;
+    }
+
+    Block* block = local.head[index];
+    local.head[index] = block->next;
+    local.count[index]--;
+
+    return ToUser((char*)block, usable);
+}
+
+void PoolFree(void* user) {
+    if (user == NULL) return;
+    char* block = ToBlock(user);
+    int64_t size = *(int64_t*)block;
+    ThreadCache& local = cache;
+    local.allocated -= size;
+
+    if (size > Allocator::MaxPooled) {
+        ATOMIC_ADD(&stats.large, -size);
+        Publish();
+        free(block);
+        return;
+    }
+
+    // The block goes to the cache of the freeing thread, which avoids
+    // contention when memory is released on another thread.
+    int index = ClassIndex((int)size);
+    ((Block*)block)->next = local.head[index];
+    local.head[index] = (Block*)block;
+    if (++local.count[index] > CacheLimit(index)) {
+        Drain(index);
+    }
+}
+
+int PoolSize(void* user) {
+    if (user == NULL) return 0;
+    return (int)*(int64_t*)ToBlock(user);
+}
+
+void* PoolRealloc(void* user, int size) {
+    int current = PoolSize(user);
+    if (size <= current && (current > Allocator::MaxPooled ||
+            ClassIndex(size) == ClassIndex(current))) {
+        // Still fits in the same block.
+        return user;
+    }
+
+    void* resized = PoolMalloc(size);
+    if (resized == NULL) return NULL;
+    memcpy(resized, user, current < size ? current : size);
+    PoolFree(user);
+    return resized;
+}
+
+int PoolRoundup(int size) {
+    if (size <= 0) size = 1;
+    if (size > Allocator::MaxPooled) return (size + 7) & ~7;
+    return ClassSize(ClassIndex(size));
+}
+
+int PoolInit(void* data) {
+    for (int i = 0; i < CLASSES; i++) {
+        pools[i].Init();
+    }
+    return SQLITE_OK;
+}
+
+void PoolShutdown(void* data) {
+    // Slabs stay reserved for the lifetime of the process.
+}
+
+}
+
+bool Allocator::installed = false;
+
+int Allocator::Install() {
+    static sqlite3_mem_methods methods = {
+        PoolMalloc,
+        PoolFree,
+        PoolRealloc,
+        PoolSize,
+        PoolRoundup,
+        PoolInit,
+        PoolShutdown,
+        NULL
+    };
+
+    int status = sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+    installed = (status == SQLITE_OK);
+    return status;
+}
+
+void Allocator::GetStats(Stats* result) {
+    // Other threads publish their counters on their own.
+    Publish();
+    *result = stats;
+}
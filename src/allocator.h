@@ -0,0 +1,44 @@
+#ifndef NODE_SQLITE3_SRC_ALLOCATOR_H
+#define NODE_SQLITE3_SRC_ALLOCATOR_H
+
+#include <stdint.h>
+
+namespace node_sqlite3 {
+
+// Memory allocator for SQLite with size-class pools and per-thread caches.
+//
+// Allocations up to MaxPooled bytes are rounded up to one of the size
+// classes and served from a cache owned by the calling thread, which is
+// refilled from (and drained into) a mutex-protected global pool. Memory is
+// reserved from the system in slabs and kept in the pools, so long-running
+// processes reuse the same blocks instead of fragmenting the heap from
+// several thread pool threads. Larger allocations go to the system malloc.
+class Allocator {
+public:
+    // Threads count their pooled allocations locally and only add them up
+    // when they go to the global pool or the system, so the numbers lag
+    // behind by up to a thread cache per thread.
+    struct Stats {
+        int64_t allocated;      // Bytes handed out to SQLite (pooled and large).
+        int64_t reserved;       // Bytes reserved from the system for the pools.
+        int64_t large;          // Bytes handed out directly from malloc.
+        int64_t allocations;    // Total number of allocations.
+        int64_t cache_hits;     // Allocations served from a thread cache.
+        int64_t refills;        // Thread cache refills from the global pool.
+    };
+
+    // Installs the allocator with sqlite3_config(). Must be called before
+    // SQLite is initialized; returns the SQLite result code.
+    static int Install();
+    static bool IsInstalled() { return installed; }
+    static void GetStats(Stats* stats);
+
+    static const int MaxPooled = 32768;
+
+protected:
+    static bool installed;
+};
+
+}
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <sqlite3.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+#include "threading.h"
+#include "arena.h"
+
+using namespace node_sqlite3;
+
+// Alignment of the arena, which is the size of a huge page on x86-64 and
+// most ARM64 kernels.
+#define ARENA_ALIGNMENT (2 * 1024 * 1024)
+
+namespace {
+
+// Lookaside buffers not currently handed to a connection. Buffers are taken
+// and returned on the thread pool while opening and closing databases.
+struct LookasideList {
+    NODE_SQLITE3_MUTEX_t
+    std::vector<void*> buffers;
+
+    void Init() {
+        NODE_SQLITE3_MUTEX_INIT
+    }
+};
+
+LookasideList lookaside;
+
+inline size_t RoundUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+inline bool IsPowerOfTwo(int n) {
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+}
+
+char* Arena::base = NULL;
+size_t Arena::size = 0;
+bool Arena::huge_pages = false;
+Arena::Options Arena::options;
+
+char* Arena::Reserve(size_t size, bool huge_pages, bool* used_huge_pages) {
+    *used_huge_pages = false;
+
+#if defined(__linux__)
+    // Map an extra huge page worth of memory so that the arena can start at
+    // an aligned address, then give back the unaligned head and tail.
+    size_t mapped = size + ARENA_ALIGNMENT;
+    char* region = (char*)mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) return NULL;
+
+    char* aligned = (char*)RoundUp((uintptr_t)region, ARENA_ALIGNMENT);
+    size_t head = aligned - region;
+    if (head > 0) munmap(region, head);
+    size_t tail = mapped - head - size;
+    if (tail > 0) munmap(aligned + size, tail);
+
+#ifdef MADV_HUGEPAGE
+    // Transparent huge pages are advisory: the kernel may be configured to
+    // ignore them, in which case the arena just uses regular pages.
+    if (huge_pages && madvise(aligned, size, MADV_HUGEPAGE) == 0) {
+        *used_huge_pages = true;
+    }
+#endif
+    return aligned;
+#else
+    // The arena is never freed, so there's no need to remember the
+    // unaligned pointer.
+    char* region = (char*)malloc(size + ARENA_ALIGNMENT);
+    if (region == NULL) return NULL;
+    return (char*)RoundUp((uintptr_t)region, ARENA_ALIGNMENT);
+#endif
+}
+
+int Arena::Configure(const Options& opts, std::string& message) {
+    if (base != NULL) {
+        message = "Page cache is already configured";
+        return SQLITE_MISUSE;
+    }
+
+    if (opts.page_size < 512 || opts.page_size > 65536 || !IsPowerOfTwo(opts.page_size)) {
+        message = "pageSize must be a power of two between 512 and 65536";
+        return SQLITE_RANGE;
+    }
+    if (opts.header_size < 0 || opts.pages < 0 || opts.connections < 0 ||
+            opts.lookaside_size < 0 || opts.lookaside_slots < 0) {
+        message = "Page cache options must be non-negative integers";
+        return SQLITE_RANGE;
+    }
+    if (opts.lookaside_size % 8 != 0) {
+        message = "lookasideSize must be a multiple of 8";
+        return SQLITE_RANGE;
+    }
+
+    size_t slot = RoundUp(opts.page_size + opts.header_size, 8);
+    size_t page_cache = slot * opts.pages;
+    size_t buffer = (size_t)opts.lookaside_size * opts.lookaside_slots;
+    size_t total = RoundUp(page_cache + buffer * opts.connections, ARENA_ALIGNMENT);
+    if (total == 0) {
+        message = "Page cache options don't reserve any memory";
+        return SQLITE_RANGE;
+    }
+
+    bool used_huge_pages;
+    char* region = Reserve(total, opts.huge_pages, &used_huge_pages);
+    if (region == NULL) {
+        message = "Unable to reserve the page cache arena";
+        return SQLITE_NOMEM;
+    }
+
+    if (opts.pages > 0) {
+        int status = sqlite3_config(SQLITE_CONFIG_PAGECACHE,
+            region, (int)slot, opts.pages);
+        if (status != SQLITE_OK) {
+            // SQLite refuses to be reconfigured once initialized, i.e.
+            // after the first database was opened.
+#if defined(__linux__)
+            munmap(region, total);
+#endif
+            message = "Page cache must be configured before opening a database";
+            return status;
+        }
+    }
+
+    lookaside.Init();
+    if (buffer > 0) {
+        char* start = region + page_cache;
+        for (int i = opts.connections - 1; i >= 0; i--) {
+            lookaside.buffers.push_back(start + buffer * i);
+        }
+    }
+
+    base = region;
+    size = total;
+    huge_pages = used_huge_pages;
+    options = opts;
+    return SQLITE_OK;
+}
+
+void* Arena::AcquireLookaside() {
+    if (base == NULL) return NULL;
+
+    void* buffer = NULL;
+    NODE_SQLITE3_MUTEX_LOCK(&lookaside.mutex)
+    if (!lookaside.buffers.empty()) {
+        buffer = lookaside.buffers.back();
+        lookaside.buffers.pop_back();
+    }
+    NODE_SQLITE3_MUTEX_UNLOCK(&lookaside.mutex)
+    return buffer;
+}
+
+void Arena::ReleaseLookaside(void* buffer) {
+    if (buffer == NULL) return;
+
+    NODE_SQLITE3_MUTEX_LOCK(&lookaside.mutex)
+    lookaside.buffers.push_back(buffer);
+    NODE_SQLITE3_MUTEX_UNLOCK(&lookaside.mutex)
+}
+
+void Arena::GetStats(Stats* stats) {
+    stats->size = size;
+    stats->huge_pages = huge_pages;
+    stats->connections = options.connections;
+
+    if (base == NULL) {
+        stats->lookaside_free = 0;
+        return;
+    }
+    NODE_SQLITE3_MUTEX_LOCK(&lookaside.mutex)
+    stats->lookaside_free = (int)lookaside.buffers.size();
+    NODE_SQLITE3_MUTEX_UNLOCK(&lookaside.mutex)
+}
@@ -0,0 +1,67 @@
+#ifndef NODE_SQLITE3_SRC_ARENA_H
+#define NODE_SQLITE3_SRC_ARENA_H
+
+#include <stddef.h>
+#include <string>
+
+namespace node_sqlite3 {
+
+// A single preallocated memory region that SQLite's page cache
+// (SQLITE_CONFIG_PAGECACHE) and the lookaside buffers of individual
+// connections are carved from. On Linux the region is mapped at a 2 MB
+// boundary and can be backed by transparent huge pages, which keeps page
+// fetches of large read-mostly databases from thrashing the TLB. The arena
+// is configured once, before SQLite is initialized, and never released.
+class Arena {
+public:
+    struct Options {
+        Options() : page_size(4096), header_size(256), pages(0),
+            lookaside_size(0), lookaside_slots(0), connections(0),
+            huge_pages(false) {}
+
+        // Page cache slots are page_size + header_size bytes; the header
+        // holds SQLite's per-page bookkeeping. Pages that don't fit in a
+        // slot, or that exceed the number of slots, come from the heap.
+        int page_size;
+        int header_size;
+        int pages;
+        // Each connection gets lookaside_slots slots of lookaside_size
+        // bytes, for up to `connections` open databases at a time.
+        int lookaside_size;
+        int lookaside_slots;
+        int connections;
+        bool huge_pages;
+    };
+
+    struct Stats {
+        size_t size;
+        bool huge_pages;
+        int connections;
+        int lookaside_free;
+    };
+
+    // Reserves the arena and configures SQLite to use it. Returns the
+    // SQLite result code and sets message on failure.
+    static int Configure(const Options& options, std::string& message);
+    static bool IsConfigured() { return base != NULL; }
+    static void GetStats(Stats* stats);
+
+    // Lookaside buffers for individual connections. Acquire returns NULL
+    // when the arena has none left, in which case SQLite allocates its own.
+    static void* AcquireLookaside();
+    static void ReleaseLookaside(void* buffer);
+    static int LookasideSize() { return options.lookaside_size; }
+    static int LookasideSlots() { return options.lookaside_slots; }
+
+protected:
+    static char* Reserve(size_t size, bool huge_pages, bool* used_huge_pages);
+
+    static char* base;
+    static size_t size;
+    static bool huge_pages;
+    static Options options;
+};
+
+}
+
+#endif
@@ -0,0 +1,507 @@
+#include <string.h>
+#include <algorithm>
+#include <node.h>
+#include <node_buffer.h>
+
+#include "macros.h"
+#include "database.h"
+#include "blob.h"
+
+using namespace node_sqlite3;
+
+Persistent<FunctionTemplate> Blob::constructor_template;
+
+void Blob::Init(Handle<Object> target) {
+    NanScope();
+
+    Local<FunctionTemplate> t = NanNew<FunctionTemplate>(New);
+
+    t->InstanceTemplate()->SetInternalFieldCount(1);
+    t->SetClassName(NanNew("Blob"));
+
+    NODE_SET_PROTOTYPE_METHOD(t, "read", Read);
+    NODE_SET_PROTOTYPE_METHOD(t, "write", Write);
+    NODE_SET_PROTOTYPE_METHOD(t, "reopen", Reopen);
+    NODE_SET_PROTOTYPE_METHOD(t, "close", Close);
+
+    NODE_SET_GETTER(t, "size", SizeGetter);
+
+    NanAssignPersistent(constructor_template, t);
+    target->Set(NanNew("Blob"),
+        t->GetFunction());
+}
+
+void Blob::Process() {
+    if (closed && !queue.empty()) {
+        return CleanQueue();
+    }
+
+    while (opened && !locked && !queue.empty()) {
+        Call* call = queue.front();
+        queue.pop();
+
+        Timeline::Dequeued(call->baton->span);
+        call->callback(call->baton);
+        delete call;
+    }
+}
+
+void Blob::Schedule(Work_Callback callback, Baton* baton) {
+    Timeline::Scheduled(baton->span);
+
+    if (closed) {
+        queue.push(new Call(callback, baton));
+        CleanQueue();
+    }
+    else if (!opened || locked) {
+        queue.push(new Call(callback, baton));
+    }
+    else {
+        Timeline::Dequeued(baton->span);
+        callback(baton);
+    }
+}
+
+template <class T> void Blob::Error(T* baton) {
+    NanScope();
+
+    Blob* blob = baton->blob;
+    // Fail hard on logic errors.
+    assert(blob->status != 0);
+    EXCEPTION(NanNew<String>(blob->message.c_str()), blob->status, exception);
+
+    Local<Function> cb = NanNew(baton->callback);
+
+    if (!cb.IsEmpty() && cb->IsFunction()) {
+        Local<Value> argv[] = { exception };
+        TRY_CATCH_CALL(NanObjectWrapHandle(blob), cb, 1, argv);
+    }
+    else {
+        Local<Value> argv[] = { NanNew("error"), exception };
+        EMIT_EVENT(NanObjectWrapHandle(blob), 2, argv);
+    }
+}
+
+// { Database db, String database, String table, String column, Number rowid,
+//   Boolean writable, Function callback }
+NAN_METHOD(Blob::New) {
+    NanScope();
+
+    if (!args.IsConstructCall()) {
+        return NanThrowTypeError("Use the new operator to create new Blob objects");
+    }
+
+    int length = args.Length();
+
+    if (length <= 0 || !Database::HasInstance(args[0])) {
+        return NanThrowTypeError("Database object expected");
+    }
+    else if (length <= 3 || !args[1]->IsString() || !args[2]->IsString() || !args[3]->IsString()) {
+        return NanThrowTypeError("Database, table and column names expected");
+    }
+    else if (length <= 4 || !args[4]->IsNumber()) {
+        return NanThrowTypeError("Rowid expected");
+    }
+    else if (length > 6 && !args[6]->IsUndefined() && !args[6]->IsFunction()) {
+        return NanThrowTypeError("Callback expected");
+    }
+
+    Database* db = ObjectWrap::Unwrap<Database>(args[0]->ToObject());
+
+    Blob* blob = new Blob(db);
+    blob->Wrap(args.This());
+
+    OpenBaton* baton = new OpenBaton(db, Local<Function>::Cast(args[6]), blob);
+    baton->database = std::string(*String::Utf8Value(args[1]));
+    baton->table = std::string(*String::Utf8Value(args[2]));
+    baton->column = std::string(*String::Utf8Value(args[3]));
+    baton->rowid = args[4]->IntegerValue();
+    baton->writable = length > 5 && args[5]->BooleanValue();
+    db->Schedule(Work_BeginOpen, baton);
+
+    NanReturnValue(args.This());
+}
+
+void Blob::Work_BeginOpen(Database::Baton* baton) {
+    assert(baton->db->open);
+    baton->db->pending++;
+    OpenBaton* open_baton = static_cast<OpenBaton*>(baton);
+    int status = Timeline::Queue(baton, "Blob.Open",
+        open_baton->table.c_str(), Work_Open, Work_AfterOpen);
+    assert(status == 0);
+}
+
+void Blob::Work_Open(uv_work_t* req) {
+    BLOB_INIT(OpenBaton);
+
+    // In case opening fails, we use a mutex to make sure we get the associated
+    // error message.
+    sqlite3_mutex* mtx = sqlite3_db_mutex(baton->db->_handle);
+    sqlite3_mutex_enter(mtx);
+
+    blob->status = sqlite3_blob_open(
+        baton->db->_handle,
+        baton->database.c_str(),
+        baton->table.c_str(),
+        baton->column.c_str(),
+        baton->rowid,
+        baton->writable ? 1 : 0,
+        &blob->_handle
+    );
+
+    if (blob->status != SQLITE_OK) {
+        blob->message = std::string(sqlite3_errmsg(baton->db->_handle));
+        blob->_handle = NULL;
+    }
+    else {
+        blob->size = sqlite3_blob_bytes(blob->_handle);
+    }
+
+    sqlite3_mutex_leave(mtx);
+}
+
+void Blob::Work_AfterOpen(uv_work_t* req) {
+    NanScope();
+    BLOB_INIT(OpenBaton);
+
+    if (blob->status != SQLITE_OK) {
+        Error(baton);
+        blob->Close();
+    }
+    else {
+        blob->opened = true;
+        Local<Function> cb = NanNew(baton->callback);
+        if (!cb.IsEmpty() && cb->IsFunction()) {
+            Local<Value> argv[] = { NanNew(NanNull()) };
+            TRY_CATCH_CALL(NanObjectWrapHandle(blob), cb, 1, argv);
+        }
+    }
+
+    BLOB_END();
+}
+
+NAN_METHOD(Blob::Read) {
+    NanScope();
+    Blob* blob = ObjectWrap::Unwrap<Blob>(args.This());
+
+    if (args.Length() <= 1 || !args[0]->IsInt32() || args[0]->Int32Value() < 0) {
+        return NanThrowTypeError("Offset must be a non-negative integer");
+    }
+    if (!args[1]->IsInt32() || args[1]->Int32Value() < 0) {
+        return NanThrowTypeError("Length must be a non-negative integer");
+    }
+    REQUIRE_ARGUMENT_FUNCTION(2, callback);
+
+    Baton* baton = new ReadBaton(blob, callback,
+        args[0]->Int32Value(), args[1]->Int32Value());
+    blob->Schedule(Work_BeginRead, baton);
+
+    NanReturnValue(args.This());
+}
+
+void Blob::Work_BeginRead(Baton* baton) {
+    BLOB_BEGIN(Read);
+}
+
+void Blob::Work_Read(uv_work_t* req) {
+    BLOB_INIT(ReadBaton);
+
+    sqlite3_mutex* mtx = sqlite3_db_mutex(blob->db->_handle);
+    sqlite3_mutex_enter(mtx);
+
+    // Reading past the end returns the bytes up to the end, so that the
+    // end of the BLOB shows up as a short or empty read.
+    int available = std::max(blob->size - baton->offset, 0);
+    baton->length = std::min(baton->length, available);
+    baton->data = (char*)malloc(baton->length > 0 ? baton->length : 1);
+
+    blob->status = baton->length > 0 ? sqlite3_blob_read(blob->_handle,
+        baton->data, baton->length, baton->offset) : SQLITE_OK;
+    if (blob->status != SQLITE_OK) {
+        blob->message = std::string(sqlite3_errmsg(blob->db->_handle));
+    }
+
+    sqlite3_mutex_leave(mtx);
+}
+
+void Blob::Work_AfterRead(uv_work_t* req) {
+    NanScope();
+    BLOB_INIT(ReadBaton);
+
+    if (blob->status != SQLITE_OK) {
+        Error(baton);
+    }
+    else {
+        // The Buffer takes over the memory the chunk was read into.
+        Local<Function> cb = NanNew(baton->callback);
+        Local<Value> argv[] = { NanNew(NanNull()),
+            NanNew(NanNewBufferHandle(baton->data, baton->length, FreeBuffer, NULL)) };
+        baton->data = NULL;
+        TRY_CATCH_CALL(NanObjectWrapHandle(blob), cb, 2, argv);
+    }
+
+    BLOB_END();
+}
+
+void Blob::FreeBuffer(char* data, void* hint) {
+    free(data);
+}
+
+NAN_METHOD(Blob::Write) {
+    NanScope();
+    Blob* blob = ObjectWrap::Unwrap<Blob>(args.This());
+
+    if (args.Length() <= 1 || !args[0]->IsInt32() || args[0]->Int32Value() < 0) {
+        return NanThrowTypeError("Offset must be a non-negative integer");
+    }
+    if (!Buffer::HasInstance(args[1])) {
+        return NanThrowTypeError("Argument 1 must be a Buffer");
+    }
+    OPTIONAL_ARGUMENT_FUNCTION(2, callback);
+
+    Baton* baton = new WriteBaton(blob, callback,
+        args[0]->Int32Value(), args[1].As<Object>());
+    blob->Schedule(Work_BeginWrite, baton);
+
+    NanReturnValue(args.This());
+}
+
+void Blob::Work_BeginWrite(Baton* baton) {
+    BLOB_BEGIN(Write);
+}
+
+void Blob::Work_Write(uv_work_t* req) {
+    BLOB_INIT(WriteBaton);
+
+    sqlite3_mutex* mtx = sqlite3_db_mutex(blob->db->_handle);
+    sqlite3_mutex_enter(mtx);
+
+    blob->status = sqlite3_blob_write(blob->_handle,
+        baton->data, baton->length, baton->offset);
+    if (blob->status != SQLITE_OK) {
+        blob->message = std::string(sqlite3_errmsg(blob->db->_handle));
+    }
+
+    sqlite3_mutex_leave(mtx);
+}
+
+void Blob::Work_AfterWrite(uv_work_t* req) {
+    NanScope();
+    BLOB_INIT(WriteBaton);
+
+    if (blob->status != SQLITE_OK) {
+        Error(baton);
+    }
+    else {
+        Local<Function> cb = NanNew(baton->callback);
+        if (!cb.IsEmpty() && cb->IsFunction()) {
+            Local<Value> argv[] = { NanNew(NanNull()) };
+            TRY_CATCH_CALL(NanObjectWrapHandle(blob), cb, 1, argv);
+        }
+    }
+
+    BLOB_END();
+}
+
+NAN_METHOD(Blob::Reopen) {
+    NanScope();
+    Blob* blob = ObjectWrap::Unwrap<Blob>(args.This());
+
+    if (args.Length() <= 0 || !args[0]->IsNumber()) {
+        return NanThrowTypeError("Rowid expected");
+    }
+    OPTIONAL_ARGUMENT_FUNCTION(1, callback);
+
+    Baton* baton = new ReopenBaton(blob, callback, args[0]->IntegerValue());
+    blob->Schedule(Work_BeginReopen, baton);
+
+    NanReturnValue(args.This());
+}
+
+void Blob::Work_BeginReopen(Baton* baton) {
+    BLOB_BEGIN(Reopen);
+}
+
+void Blob::Work_Reopen(uv_work_t* req) {
+    BLOB_INIT(ReopenBaton);
+
+    sqlite3_mutex* mtx = sqlite3_db_mutex(blob->db->_handle);
+    sqlite3_mutex_enter(mtx);
+
+    blob->status = sqlite3_blob_reopen(blob->_handle, baton->rowid);
+    if (blob->status != SQLITE_OK) {
+        blob->message = std::string(sqlite3_errmsg(blob->db->_handle));
+        blob->size = 0;
+    }
+    else {
+        blob->size = sqlite3_blob_bytes(blob->_handle);
+    }
+
+    sqlite3_mutex_leave(mtx);
+}
+
+void Blob::Work_AfterReopen(uv_work_t* req) {
+    NanScope();
+    BLOB_INIT(ReopenBaton);
+
+    if (blob->status != SQLITE_OK) {
+        Error(baton);
+    }
+    else {
+        Local<Function> cb = NanNew(baton->callback);
+        if (!cb.IsEmpty() && cb->IsFunction()) {
+            Local<Value> argv[] = { NanNew(NanNull()) };
+            TRY_CATCH_CALL(NanObjectWrapHandle(blob), cb, 1, argv);
+        }
+    }
+
+    BLOB_END();
+}
+
+NAN_METHOD(Blob::Close) {
+    NanScope();
+    Blob* blob = ObjectWrap::Unwrap<Blob>(args.This());
+    OPTIONAL_ARGUMENT_FUNCTION(0, callback);
+
+    Baton* baton = new Baton(blob, callback);
+    blob->Schedule(Work_BeginClose, baton);
+
+    NanReturnValue(args.This());
+}
+
+void Blob::Work_BeginClose(Baton* baton) {
+    BLOB_BEGIN(Close);
+}
+
+void Blob::Work_Close(uv_work_t* req) {
+    BLOB_INIT(Baton);
+
+    // Closing commits the implicit transaction of a writable BLOB, so it
+    // may have to write to disk. The handle is closed even if this fails.
+    blob->status = sqlite3_blob_close(blob->_handle);
+    if (blob->status != SQLITE_OK) {
+        blob->message = std::string(sqlite3_errmsg(blob->db->_handle));
+    }
+    blob->_handle = NULL;
+}
+
+void Blob::Work_AfterClose(uv_work_t* req) {
+    NanScope();
+    BLOB_INIT(Baton);
+
+    blob->Close();
+
+    if (blob->status != SQLITE_OK) {
+        Error(baton);
+    }
+    else {
+        Local<Function> cb = NanNew(baton->callback);
+        if (!cb.IsEmpty() && cb->IsFunction()) {
+            Local<Value> argv[] = { NanNew(NanNull()) };
+            TRY_CATCH_CALL(NanObjectWrapHandle(blob), cb, 1, argv);
+        }
+    }
+
+    BLOB_END();
+}
+
+NAN_GETTER(Blob::SizeGetter) {
+    NanScope();
+    Blob* blob = ObjectWrap::Unwrap<Blob>(args.This());
+    NanReturnValue(NanNew<Integer>(blob->size));
+}
+
+void Blob::Close() {
+    assert(!closed);
+    closed = true;
+    CleanQueue();
+
+    // A query on the thread pool may hold the connection mutex while it
+    // waits for a JavaScript function to run on this thread, so don't wait
+    // for the mutex here and close on the thread pool instead.
+    if (_handle != NULL && !db->functions.empty()) {
+        sqlite3_mutex* mtx = sqlite3_db_mutex(db->_handle);
+        if (sqlite3_mutex_try(mtx) != SQLITE_OK) {
+            CloseHandleBaton* baton = new CloseHandleBaton(db, _handle);
+            db->pending++;
+            int status = Timeline::Queue(baton, "Blob.Close", NULL,
+                Work_CloseHandle, Work_AfterCloseHandle);
+            assert(status == 0);
+            _handle = NULL;
+            db->Unref();
+            return;
+        }
+        sqlite3_blob_close(_handle);
+        sqlite3_mutex_leave(mtx);
+        _handle = NULL;
+        db->Unref();
+        return;
+    }
+
+    sqlite3_blob_close(_handle);
+    _handle = NULL;
+    db->Unref();
+}
+
+void Blob::Work_CloseHandle(uv_work_t* req) {
+    CloseHandleBaton* baton = static_cast<CloseHandleBaton*>(req->data);
+    sqlite3_blob_close(baton->handle);
+}
+
+void Blob::Work_AfterCloseHandle(uv_work_t* req) {
+    NanScope();
+    CloseHandleBaton* baton = static_cast<CloseHandleBaton*>(req->data);
+    Database* db = baton->db;
+
+    db->pending--;
+    db->Process();
+
+    delete baton;
+}
+
+void Blob::CleanQueue() {
+    NanScope();
+    if (opened && !queue.empty()) {
+        // This blob has already been opened and is now closed. Fire error
+        // for all remaining items in the queue.
+        EXCEPTION(NanNew<String>("Blob is already closed"), SQLITE_MISUSE, exception);
+        Local<Value> argv[] = { exception };
+        bool called = false;
+
+        // Clear out the queue so that this object can get GC'ed.
+        while (!queue.empty()) {
+            Call* call = queue.front();
+            queue.pop();
+
+            Local<Function> cb = NanNew(call->baton->callback);
+
+            if (!cb.IsEmpty() && cb->IsFunction()) {
+                TRY_CATCH_CALL(NanObjectWrapHandle(this), cb, 1, argv);
+                called = true;
+            }
+
+            // We don't call the actual callback, so we have to make sure that
+            // the baton gets destroyed.
+            delete call->baton;
+            delete call;
+        }
+
+        // When we couldn't call a callback function, emit an error on the
+        // Blob object.
+        if (!called) {
+            Local<Value> args[] = { NanNew("error"), exception };
+            EMIT_EVENT(NanObjectWrapHandle(this), 2, args);
+        }
+    }
+    else while (!queue.empty()) {
+        // Just delete all items in the queue; we already fired an event when
+        // opening the blob failed.
+        Call* call = queue.front();
+        queue.pop();
+
+        // We don't call the actual callback, so we have to make sure that
+        // the baton gets destroyed.
+        delete call->baton;
+        delete call;
+    }
+}
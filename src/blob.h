@@ -0,0 +1,172 @@
+#ifndef NODE_SQLITE3_SRC_BLOB_H
+#define NODE_SQLITE3_SRC_BLOB_H
+
+#include <node.h>
+
+#include "database.h"
+
+#include <cstdlib>
+#include <string>
+#include <queue>
+
+#include <sqlite3.h>
+#include "nan.h"
+
+using namespace v8;
+using namespace node;
+
+namespace node_sqlite3 {
+
+// Handle for incremental I/O on a single BLOB value. Reads and writes of
+// chunks run on the thread pool one at a time, in the order they were
+// requested; lib/sqlite3.js builds streams on top of them.
+class Blob : public ObjectWrap {
+public:
+    static Persistent<FunctionTemplate> constructor_template;
+
+    static void Init(Handle<Object> target);
+    static NAN_METHOD(New);
+
+    struct Baton {
+        uv_work_t request;
+        Blob* blob;
+        Persistent<Function> callback;
+        Timeline::Span span;
+
+        Baton(Blob* blob_, Handle<Function> cb_) : blob(blob_) {
+            blob->Ref();
+            request.data = this;
+            NanAssignPersistent(callback, cb_);
+        }
+        virtual ~Baton() {
+            blob->Unref();
+            NanDisposePersistent(callback);
+        }
+    };
+
+    struct ReadBaton : Baton {
+        int offset;
+        int length;
+        char* data;
+        ReadBaton(Blob* blob_, Handle<Function> cb_, int offset_, int length_) :
+            Baton(blob_, cb_), offset(offset_), length(length_), data(NULL) {}
+        virtual ~ReadBaton() {
+            free(data);
+        }
+    };
+
+    // Writes straight from the Buffer, which is kept alive until the write
+    // is done.
+    struct WriteBaton : Baton {
+        int offset;
+        Persistent<Object> buffer;
+        const char* data;
+        int length;
+        WriteBaton(Blob* blob_, Handle<Function> cb_, int offset_, Handle<Object> buffer_) :
+                Baton(blob_, cb_), offset(offset_) {
+            NanAssignPersistent(buffer, buffer_);
+            data = Buffer::Data(buffer_);
+            length = Buffer::Length(buffer_);
+        }
+        virtual ~WriteBaton() {
+            NanDisposePersistent(buffer);
+        }
+    };
+
+    struct ReopenBaton : Baton {
+        sqlite3_int64 rowid;
+        ReopenBaton(Blob* blob_, Handle<Function> cb_, sqlite3_int64 rowid_) :
+            Baton(blob_, cb_), rowid(rowid_) {}
+    };
+
+    // Closes a handle on the thread pool.
+    struct CloseHandleBaton : Database::Baton {
+        sqlite3_blob* handle;
+        CloseHandleBaton(Database* db_, sqlite3_blob* handle_) :
+            Baton(db_, Local<Function>()), handle(handle_) {}
+    };
+
+    struct OpenBaton : Database::Baton {
+        Blob* blob;
+        std::string database;
+        std::string table;
+        std::string column;
+        sqlite3_int64 rowid;
+        bool writable;
+        OpenBaton(Database* db_, Handle<Function> cb_, Blob* blob_) :
+                Baton(db_, cb_), blob(blob_) {
+            blob->Ref();
+        }
+        virtual ~OpenBaton() {
+            blob->Unref();
+            if (!blob->closed && !db->IsOpen() && db->IsLocked()) {
+                // The database handle was closed before the blob could be
+                // opened.
+                blob->Close();
+            }
+        }
+    };
+
+    typedef void (*Work_Callback)(Baton* baton);
+
+    struct Call {
+        Call(Work_Callback cb_, Baton* baton_) : callback(cb_), baton(baton_) {};
+        Work_Callback callback;
+        Baton* baton;
+    };
+
+    Blob(Database* db_) : ObjectWrap(),
+            db(db_),
+            _handle(NULL),
+            status(SQLITE_OK),
+            size(0),
+            opened(false),
+            locked(true),
+            closed(false) {
+        db->Ref();
+    }
+
+    ~Blob() {
+        if (!closed) Close();
+    }
+
+    WORK_DEFINITION(Read);
+    WORK_DEFINITION(Write);
+    WORK_DEFINITION(Reopen);
+    WORK_DEFINITION(Close);
+
+    static NAN_GETTER(SizeGetter);
+
+protected:
+    static void Work_BeginOpen(Database::Baton* baton);
+    static void Work_Open(uv_work_t* req);
+    static void Work_AfterOpen(uv_work_t* req);
+
+    static void FreeBuffer(char* data, void* hint);
+    static void Work_CloseHandle(uv_work_t* req);
+    static void Work_AfterCloseHandle(uv_work_t* req);
+
+    void Close();
+    template <class T> static void Error(T* baton);
+    void Schedule(Work_Callback callback, Baton* baton);
+    void Process();
+    void CleanQueue();
+
+protected:
+    Database* db;
+
+    sqlite3_blob* _handle;
+    int status;
+    std::string message;
+    // Size of the BLOB in bytes, updated when it is opened or reopened.
+    int size;
+
+    bool opened;
+    bool locked;
+    bool closed;
+    std::queue<Call*> queue;
+};
+
+}
+
+#endif
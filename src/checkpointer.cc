@@ -0,0 +1,127 @@
+#include <string.h>
+
+#include "checkpointer.h"
+
+using namespace node_sqlite3;
+
+// How long checkpoints past the limit wait for other connections, in
+// milliseconds, before they give up until the next commit.
+#define CHECKPOINT_BUSY_TIMEOUT 1000
+
+#ifdef SQLITE_CHECKPOINT_TRUNCATE
+#define CHECKPOINT_ESCALATED SQLITE_CHECKPOINT_TRUNCATE
+#else
+#define CHECKPOINT_ESCALATED SQLITE_CHECKPOINT_RESTART
+#endif
+
+Checkpointer::Checkpointer(const char* filename_, const char* vfs_, int pages_, int limit_) :
+        filename(filename_), vfs(vfs_ ? vfs_ : ""), pages(pages_), limit(limit_),
+        connection(NULL), wal(false), started(false), stopping(false), requested(false),
+        frames(0), checkpoints(0) {
+    uv_mutex_init(&mutex);
+    uv_cond_init(&condition);
+}
+
+Checkpointer::~Checkpointer() {
+    if (started) {
+        uv_mutex_lock(&mutex);
+        stopping = true;
+        uv_cond_signal(&condition);
+        uv_mutex_unlock(&mutex);
+        uv_thread_join(&thread);
+    }
+    uv_cond_destroy(&condition);
+    uv_mutex_destroy(&mutex);
+}
+
+bool Checkpointer::Start() {
+    started = uv_thread_create(&thread, Run, this) == 0;
+    return started;
+}
+
+int Checkpointer::WalHook(void* data, sqlite3* db, const char* name, int frames) {
+    // Note: This function is called in the thread pool while holding the
+    // sqlite3_db_mutex.
+    Checkpointer* checkpointer = static_cast<Checkpointer*>(data);
+    if (strcmp(name, "main") != 0) return SQLITE_OK;
+
+    uv_mutex_lock(&checkpointer->mutex);
+    checkpointer->frames = frames;
+    if (frames >= checkpointer->pages) {
+        checkpointer->requested = true;
+        uv_cond_signal(&checkpointer->condition);
+    }
+    uv_mutex_unlock(&checkpointer->mutex);
+    return SQLITE_OK;
+}
+
+unsigned int Checkpointer::Checkpoints() {
+    uv_mutex_lock(&mutex);
+    unsigned int value = checkpoints;
+    uv_mutex_unlock(&mutex);
+    return value;
+}
+
+int Checkpointer::Frames() {
+    uv_mutex_lock(&mutex);
+    int value = frames;
+    uv_mutex_unlock(&mutex);
+    return value;
+}
+
+void Checkpointer::Run(void* data) {
+    Checkpointer* checkpointer = static_cast<Checkpointer*>(data);
+
+    uv_mutex_lock(&checkpointer->mutex);
+    while (true) {
+        while (!checkpointer->stopping && !checkpointer->requested) {
+            uv_cond_wait(&checkpointer->condition, &checkpointer->mutex);
+        }
+        if (checkpointer->stopping) break;
+
+        // Commits that happen during the checkpoint request the next one.
+        checkpointer->requested = false;
+        int mode = checkpointer->frames >= checkpointer->limit ?
+            CHECKPOINT_ESCALATED : SQLITE_CHECKPOINT_PASSIVE;
+        uv_mutex_unlock(&checkpointer->mutex);
+
+        bool done = checkpointer->Checkpoint(mode);
+
+        uv_mutex_lock(&checkpointer->mutex);
+        if (done) checkpointer->checkpoints++;
+    }
+    uv_mutex_unlock(&checkpointer->mutex);
+
+    sqlite3_close(checkpointer->connection);
+    checkpointer->connection = NULL;
+}
+
+bool Checkpointer::Checkpoint(int mode) {
+    if (connection == NULL) {
+        // A private cache, so that the connection doesn't share the table
+        // locks of the database's own connection.
+        int status = sqlite3_open_v2(filename.c_str(), &connection,
+            SQLITE_OPEN_READWRITE | SQLITE_OPEN_PRIVATECACHE,
+            vfs.empty() ? NULL : vfs.c_str());
+        if (status != SQLITE_OK) {
+            sqlite3_close(connection);
+            connection = NULL;
+            return false;
+        }
+        // Only used by the checkpoints that wait for other connections.
+        sqlite3_busy_timeout(connection, CHECKPOINT_BUSY_TIMEOUT);
+    }
+
+    if (!wal) {
+        // The connection only finds out that the database is in WAL mode
+        // when it reads from it; until then, checkpoints do nothing.
+        if (sqlite3_exec(connection, "PRAGMA schema_version", NULL, NULL, NULL) != SQLITE_OK) {
+            return false;
+        }
+        wal = true;
+    }
+
+    int log = 0;
+    int checkpointed = 0;
+    return sqlite3_wal_checkpoint_v2(connection, NULL, mode, &log, &checkpointed) == SQLITE_OK;
+}
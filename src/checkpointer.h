@@ -0,0 +1,60 @@
+#ifndef NODE_SQLITE3_SRC_CHECKPOINTER_H
+#define NODE_SQLITE3_SRC_CHECKPOINTER_H
+
+#include <string>
+
+#include <sqlite3.h>
+#include <uv.h>
+
+namespace node_sqlite3 {
+
+// Checkpoints the WAL of a database on a thread of its own, with a second
+// connection, instead of in whichever commit crosses the auto-checkpoint
+// threshold. Checkpoints are passive, so they never wait for the readers
+// and writers of the database, until the WAL grows past a limit. Past the
+// limit, they wait for them so that the WAL starts over from the beginning
+// (and is truncated, where SQLite supports that).
+class Checkpointer {
+public:
+    // Checkpoints once commits leave at least pages frames in the WAL, and
+    // waits for other connections from limit frames on.
+    Checkpointer(const char* filename, const char* vfs, int pages, int limit);
+    // Stops the thread once the checkpoint in progress, if any, is done.
+    ~Checkpointer();
+
+    // Starts the thread; returns false if that isn't possible.
+    bool Start();
+
+    // WAL hook of the connection that writes to the database. Only the
+    // main database is checkpointed.
+    static int WalHook(void* checkpointer, sqlite3* db, const char* name, int frames);
+
+    unsigned int Checkpoints();
+    int Frames();
+
+protected:
+    static void Run(void* checkpointer);
+    bool Checkpoint(int mode);
+
+    std::string filename;
+    std::string vfs;
+    int pages;
+    int limit;
+    // Only used on the thread.
+    sqlite3* connection;
+    bool wal;
+
+    uv_thread_t thread;
+    uv_mutex_t mutex;
+    uv_cond_t condition;
+    // Protected by mutex.
+    bool started;
+    bool stopping;
+    bool requested;
+    int frames;
+    unsigned int checkpoints;
+};
+
+}
+
+#endif
@@ -1,13 +1,113 @@
 #include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <ctype.h>
+#include <math.h>
+#include <sstream>
+#include <algorithm>
 #include <node.h>
 
 #include "macros.h"
 #include "database.h"
 #include "statement.h"
+#include "arena.h"
+#include "vfs_memory.h"
+#include "function.h"
+#include "vector.h"
+#include "sketch.h"
+#include "checkpointer.h"
+#ifdef NODE_SQLITE3_IO_URING
+#include "vfs_io_uring.h"
+#endif
 
 using namespace node_sqlite3;
 
+// Maximum number of entries kept in the slow query log before the oldest
+// ones are dropped.
+#define SLOW_QUERY_LOG_SIZE 100
+
+// Bounds of the delay in milliseconds before work that failed with
+// SQLITE_BUSY runs again under the "retry" busy policy.
+#define BUSY_RETRY_MIN_DELAY 2
+#define BUSY_RETRY_MAX_DELAY 100
+
+// WAL size in frames that triggers a checkpoint, like SQLite's automatic
+// checkpoints.
+#define CHECKPOINT_PAGES 1000
+
+namespace {
+
+enum SettingType { SETTING_KEYWORD, SETTING_INTEGER, SETTING_SIZE, SETTING_BOOLEAN };
+
+// Connection settings accepted in the options object of the constructor, in
+// the order they are applied.
+struct Setting {
+    const char* option;
+    const char* pragma;
+    SettingType type;
+    const char* keywords[7];
+};
+
+const Setting settings[] = {
+    { "journalMode", "journal_mode", SETTING_KEYWORD,
+        { "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF", NULL } },
+    { "synchronous", "synchronous", SETTING_KEYWORD, { "OFF", "NORMAL", "FULL", NULL } },
+    { "cacheSize", "cache_size", SETTING_INTEGER, { NULL } },
+    { "mmapSize", "mmap_size", SETTING_SIZE, { NULL } },
+    { "tempStore", "temp_store", SETTING_KEYWORD, { "DEFAULT", "FILE", "MEMORY", NULL } },
+    { "queryOnly", "query_only", SETTING_BOOLEAN, { NULL } }
+};
+
+#define SETTINGS (sizeof(settings) / sizeof(settings[0]))
+
+// Named sets of defaults for the settings above; NULL leaves the SQLite
+// default in place.
+struct Preset {
+    const char* name;
+    const char* values[SETTINGS];
+};
+
+const Preset presets[] = {
+    { "throughput", { "WAL", "NORMAL", "-65536", "268435456", "MEMORY", NULL } },
+    { "durable", { "WAL", "FULL", NULL, NULL, NULL, NULL } },
+    { "read-only-analytics", { NULL, NULL, "-262144", "1073741824", "MEMORY", "1" } }
+};
+
+#define PRESETS (sizeof(presets) / sizeof(presets[0]))
+
+// Counts unlock notifications, which arrive on whichever thread ends the
+// blocking transaction. Work compares the count from before it registered
+// for a notification to find out whether it was already notified.
+struct UnlockCounter {
+    NODE_SQLITE3_MUTEX_t
+    unsigned int count;
+
+    void Init() {
+        NODE_SQLITE3_MUTEX_INIT
+        count = 0;
+    }
+
+    unsigned int Get() {
+        NODE_SQLITE3_MUTEX_LOCK(&mutex)
+        unsigned int value = count;
+        NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
+        return value;
+    }
+
+    void Increment() {
+        NODE_SQLITE3_MUTEX_LOCK(&mutex)
+        count++;
+        NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
+    }
+};
+
+UnlockCounter unlocks;
+
+}
+
 Persistent<FunctionTemplate> Database::constructor_template;
+std::vector<Database::LockedCall> Database::locked_calls;
+uv_async_t Database::unlock_watcher;
 
 void Database::Init(Handle<Object> target) {
     NanScope();
@@ -21,9 +121,14 @@ void Database::Init(Handle<Object> target) {
     NODE_SET_PROTOTYPE_METHOD(t, "exec", Exec);
     NODE_SET_PROTOTYPE_METHOD(t, "wait", Wait);
     NODE_SET_PROTOTYPE_METHOD(t, "loadExtension", LoadExtension);
+    NODE_SET_PROTOTYPE_METHOD(t, "backup", Backup);
+    NODE_SET_PROTOTYPE_METHOD(t, "toBuffer", ToBuffer);
+    NODE_SET_PROTOTYPE_METHOD(t, "function", CreateFunction);
     NODE_SET_PROTOTYPE_METHOD(t, "serialize", Serialize);
     NODE_SET_PROTOTYPE_METHOD(t, "parallelize", Parallelize);
     NODE_SET_PROTOTYPE_METHOD(t, "configure", Configure);
+    NODE_SET_PROTOTYPE_METHOD(t, "slowQueries", SlowQueries);
+    NODE_SET_PROTOTYPE_METHOD(t, "metrics", Metrics);
 
     NODE_SET_GETTER(t, "open", OpenGetter);
 
@@ -31,6 +136,12 @@ void Database::Init(Handle<Object> target) {
 
     target->Set(NanNew("Database"),
         t->GetFunction());
+
+    // The watcher only keeps the loop alive while work waits for a lock.
+    unlocks.Init();
+    uv_async_init(uv_default_loop(), &unlock_watcher,
+        reinterpret_cast<uv_async_cb>(AsyncUnlock));
+    uv_unref((uv_handle_t*)&unlock_watcher);
 }
 
 void Database::Process() {
@@ -74,6 +185,7 @@ void Database::Process() {
 
         queue.pop();
         locked = call->exclusive;
+        Timeline::Dequeued(call->baton->span);
         call->callback(call->baton);
         delete call;
 
@@ -97,11 +209,14 @@ void Database::Schedule(Work_Callback callback, Baton* baton, bool exclusive) {
         return;
     }
 
+    Timeline::Scheduled(baton->span);
+
     if (!open || ((locked || exclusive || serialize) && pending > 0)) {
         queue.push(new Call(callback, baton, exclusive || serialize));
     }
     else {
         locked = exclusive;
+        Timeline::Dequeued(baton->span);
         callback(baton);
     }
 }
@@ -113,7 +228,16 @@ NAN_METHOD(Database::New) {
         return NanThrowTypeError("Use the new operator to create new Database objects");
     }
 
-    REQUIRE_ARGUMENT_STRING(0, filename);
+    // A Buffer holds a database image that is opened with the memory VFS.
+    std::string filename;
+    Local<Object> buffer;
+    if (args.Length() > 0 && Buffer::HasInstance(args[0])) {
+        buffer = args[0].As<Object>();
+    }
+    else {
+        REQUIRE_ARGUMENT_STRING(0, name);
+        filename = *name;
+    }
     int pos = 1;
 
     int mode;
@@ -123,27 +247,151 @@ NAN_METHOD(Database::New) {
         mode = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX;
     }
 
+    OpenOptions options;
+    if (args.Length() >= pos && args[pos]->IsObject() && !args[pos]->IsFunction()) {
+        std::string error;
+        if (!ParseOpenOptions(args[pos++].As<Object>(), options, error)) {
+            return NanThrowTypeError(error.c_str());
+        }
+    }
+
     Local<Function> callback;
     if (args.Length() >= pos && args[pos]->IsFunction()) {
         callback = Local<Function>::Cast(args[pos++]);
     }
 
+    if (!buffer.IsEmpty() && MemoryVfs::Register() != SQLITE_OK) {
+        return NanThrowError("Could not register the memory VFS");
+    }
+
     Database* db = new Database();
     db->Wrap(args.This());
 
-    args.This()->ForceSet(NanNew("filename"), args[0]->ToString(), ReadOnly);
+    if (!buffer.IsEmpty()) {
+        // SQLite can't write to the Buffer, so it is only used in place when
+        // the database is opened read-only.
+        bool copy = !(mode & SQLITE_OPEN_READONLY);
+        filename = db->image = MemoryVfs::Add(Buffer::Data(buffer),
+            Buffer::Length(buffer), copy);
+        if (!copy) NanAssignPersistent(db->image_buffer, buffer);
+        options.vfs = MemoryVfs::Name;
+    }
+
+    db->vfs = options.vfs;
+
+    args.This()->ForceSet(NanNew("filename"), NanNew<String>(filename.c_str()), ReadOnly);
     args.This()->ForceSet(NanNew("mode"), NanNew<Integer>(mode), ReadOnly);
 
     // Start opening the database.
-    OpenBaton* baton = new OpenBaton(db, callback, *filename, mode);
+    OpenBaton* baton = new OpenBaton(db, callback, filename.c_str(), mode);
+    baton->options = options;
+    if (!buffer.IsEmpty() && filename.empty()) {
+        // The Buffer couldn't be copied; fail the open.
+        baton->status = SQLITE_NOMEM;
+    }
+    db->busy_timeout = options.busy_timeout;
     Work_BeginOpen(baton);
 
     NanReturnValue(args.This());
 }
 
+bool Database::ParseOpenOptions(Local<Object> object, OpenOptions& options, std::string& error) {
+    std::string values[SETTINGS];
+
+    Local<Value> preset = object->Get(NanNew("preset"));
+    if (!preset->IsUndefined()) {
+        String::Utf8Value name(preset->ToString());
+        unsigned int i = 0;
+        while (i < PRESETS && strcmp(*name, presets[i].name) != 0) i++;
+        if (i == PRESETS) {
+            error = std::string("Unknown preset: ") + *name;
+            return false;
+        }
+        for (unsigned int j = 0; j < SETTINGS; j++) {
+            if (presets[i].values[j] != NULL) values[j] = presets[i].values[j];
+        }
+    }
+
+    for (unsigned int i = 0; i < SETTINGS; i++) {
+        const Setting& setting = settings[i];
+        Local<Value> value = object->Get(NanNew(setting.option));
+        if (value->IsUndefined()) continue;
+
+        if (setting.type == SETTING_KEYWORD) {
+            std::string keyword;
+            if (value->IsString()) {
+                String::Utf8Value text(value);
+                keyword = *text;
+                std::transform(keyword.begin(), keyword.end(), keyword.begin(), ::toupper);
+            }
+            unsigned int k = 0;
+            while (setting.keywords[k] != NULL && keyword != setting.keywords[k]) k++;
+            if (setting.keywords[k] == NULL) {
+                error = std::string(setting.option) + " must be one of";
+                for (k = 0; setting.keywords[k] != NULL; k++) {
+                    error += std::string(k ? ", " : " ") + setting.keywords[k];
+                }
+                return false;
+            }
+            values[i] = keyword;
+        }
+        else if (setting.type == SETTING_BOOLEAN) {
+            values[i] = value->BooleanValue() ? "1" : "0";
+        }
+        else {
+            double number = value->NumberValue();
+            // Integers beyond 2^53 can't be represented exactly anyway.
+            if (!value->IsNumber() || number != floor(number) ||
+                    fabs(number) > 9007199254740992.0 ||
+                    (setting.type == SETTING_SIZE && number < 0)) {
+                error = std::string(setting.option) + (setting.type == SETTING_SIZE ?
+                    " must be a non-negative integer" : " must be an integer");
+                return false;
+            }
+            std::ostringstream integer;
+            integer << (long long)number;
+            values[i] = integer.str();
+        }
+    }
+
+    Local<Value> timeout = object->Get(NanNew("busyTimeout"));
+    if (!timeout->IsUndefined()) {
+        if (!timeout->IsInt32() || timeout->Int32Value() < 0) {
+            error = "busyTimeout must be a non-negative integer";
+            return false;
+        }
+        options.busy_timeout = timeout->Int32Value();
+    }
+
+    Local<Value> vfs = object->Get(NanNew("vfs"));
+    if (!vfs->IsUndefined()) {
+        if (!vfs->IsString()) {
+            error = "vfs must be a string";
+            return false;
+        }
+        String::Utf8Value name(vfs);
+        options.vfs = *name;
+#ifdef NODE_SQLITE3_IO_URING
+        // Registering a VFS initializes SQLite, so it's done on first use
+        // rather than at module load.
+        if (options.vfs == IoUringVfs::Name) {
+            IoUringVfs::Register();
+        }
+#endif
+    }
+
+    for (unsigned int i = 0; i < SETTINGS; i++) {
+        if (values[i].empty()) continue;
+        options.pragmas.push_back(std::string("PRAGMA ") +
+            settings[i].pragma + " = " + values[i]);
+    }
+    return true;
+}
+
 void Database::Work_BeginOpen(Baton* baton) {
-    int status = uv_queue_work(uv_default_loop(),
-        &baton->request, Work_Open, (uv_after_work_cb)Work_AfterOpen);
+    OpenBaton* open_baton = static_cast<OpenBaton*>(baton);
+    int status = Timeline::Queue(baton, "Database.Open",
+        open_baton->filename.c_str(), Work_Open, Work_AfterOpen);
     assert(status == 0);
 }
 
@@ -151,11 +399,16 @@ void Database::Work_Open(uv_work_t* req) {
     OpenBaton* baton = static_cast<OpenBaton*>(req->data);
     Database* db = baton->db;
 
+    if (baton->status != SQLITE_OK) {
+        baton->message = "out of memory";
+        return;
+    }
+
     baton->status = sqlite3_open_v2(
         baton->filename.c_str(),
         &db->_handle,
         baton->mode,
-        NULL
+        baton->options.vfs.empty() ? NULL : baton->options.vfs.c_str()
     );
 
     if (baton->status != SQLITE_OK) {
@@ -165,7 +418,33 @@ void Database::Work_Open(uv_work_t* req) {
     }
     else {
         // Set default database handle values.
-        sqlite3_busy_timeout(db->_handle, 1000);
+        sqlite3_busy_timeout(db->_handle, baton->options.busy_timeout);
+
+        // Give the connection its lookaside memory from the page cache
+        // arena. Without one, SQLite allocates it from the heap.
+        db->lookaside = Arena::AcquireLookaside();
+        if (db->lookaside != NULL && sqlite3_db_config(db->_handle,
+                SQLITE_DBCONFIG_LOOKASIDE, db->lookaside,
+                Arena::LookasideSize(), Arena::LookasideSlots()) != SQLITE_OK) {
+            db->ReleaseLookaside();
+        }
+
+        baton->status = VectorFunctions::Register(db->_handle);
+        if (baton->status == SQLITE_OK) {
+            baton->status = SketchFunctions::Register(db->_handle);
+        }
+
+        // Apply the open options here so that no query can run before them.
+        std::vector<std::string>& pragmas = baton->options.pragmas;
+        for (unsigned int i = 0; baton->status == SQLITE_OK && i < pragmas.size(); i++) {
+            baton->status = sqlite3_exec(db->_handle, pragmas[i].c_str(), NULL, NULL, NULL);
+        }
+        if (baton->status != SQLITE_OK) {
+            baton->message = std::string(sqlite3_errmsg(db->_handle));
+            sqlite3_close(db->_handle);
+            db->_handle = NULL;
+            db->ReleaseLookaside();
+        }
     }
 }
 
@@ -214,7 +493,7 @@ NAN_METHOD(Database::Close) {
     Database* db = ObjectWrap::Unwrap<Database>(args.This());
     OPTIONAL_ARGUMENT_FUNCTION(0, callback);
 
-    Baton* baton = new Baton(db, callback);
+    Baton* baton = new CloseBaton(db, callback);
     db->Schedule(Work_BeginClose, baton, true);
 
     NanReturnValue(args.This());
@@ -226,16 +505,51 @@ void Database::Work_BeginClose(Baton* baton) {
     assert(baton->db->_handle);
     assert(baton->db->pending == 0);
 
+    Database* db = baton->db;
+    if (db->backups > 0) {
+        // Closing fails while a backup reads from the database; close
+        // once the last one is done, see Work_AfterBackup().
+        db->closing = static_cast<CloseBaton*>(baton);
+        db->pending++;
+
+        // Steps of running backups that were queued behind close() go
+        // ahead of it.
+        std::queue<Call*> rest;
+        std::vector<Baton*> steps;
+        while (!db->queue.empty()) {
+            Call* call = db->queue.front();
+            db->queue.pop();
+            if (call->callback == Work_BeginBackup &&
+                    static_cast<BackupBaton*>(call->baton)->dest != NULL) {
+                Timeline::Dequeued(call->baton->span);
+                steps.push_back(call->baton);
+                delete call;
+            }
+            else {
+                rest.push(call);
+            }
+        }
+        db->queue.swap(rest);
+        for (unsigned int i = 0; i < steps.size(); i++) {
+            Work_BeginBackup(steps[i]);
+        }
+        return;
+    }
+
     baton->db->RemoveCallbacks();
-    int status = uv_queue_work(uv_default_loop(),
-        &baton->request, Work_Close, (uv_after_work_cb)Work_AfterClose);
+    static_cast<CloseBaton*>(baton)->checkpointer = baton->db->DetachCheckpointer();
+    int status = Timeline::Queue(baton, "Database.Close", NULL,
+        Work_Close, Work_AfterClose);
     assert(status == 0);
 }
 
 void Database::Work_Close(uv_work_t* req) {
-    Baton* baton = static_cast<Baton*>(req->data);
+    CloseBaton* baton = static_cast<CloseBaton*>(req->data);
     Database* db = baton->db;
 
+    delete baton->checkpointer;
+    baton->checkpointer = NULL;
+
     baton->status = sqlite3_close(db->_handle);
 
     if (baton->status != SQLITE_OK) {
@@ -243,7 +557,29 @@ void Database::Work_Close(uv_work_t* req) {
     }
     else {
         db->_handle = NULL;
+        db->ReleaseLookaside();
+    }
+}
+
+void Database::ReleaseLookaside() {
+    Arena::ReleaseLookaside(lookaside);
+    lookaside = NULL;
+}
+
+void Database::ReleaseImage() {
+    // Note: The image may only be removed once SQLite closed the file.
+    if (!image.empty()) {
+        MemoryVfs::Remove(image);
+        image.clear();
+    }
+    NanDisposePersistent(image_buffer);
+}
+
+void Database::ReleaseFunctions() {
+    for (unsigned int i = 0; i < functions.size(); i++) {
+        delete functions[i];
     }
+    functions.clear();
 }
 
 void Database::Work_AfterClose(uv_work_t* req) {
@@ -258,6 +594,8 @@ void Database::Work_AfterClose(uv_work_t* req) {
     }
     else {
         db->open = false;
+        db->ReleaseImage();
+        db->ReleaseFunctions();
         // Leave db->locked to indicate that this db object has reached
         // the end of its life.
         argv[0] = NanNew(NanNull());
@@ -283,6 +621,99 @@ void Database::Work_AfterClose(uv_work_t* req) {
     delete baton;
 }
 
+Database::FunctionBaton::~FunctionBaton() {
+    // Only set when the function wasn't registered.
+    delete function;
+}
+
+// db.function(name, implementation, [options], [callback])
+NAN_METHOD(Database::CreateFunction) {
+    NanScope();
+    Database* db = ObjectWrap::Unwrap<Database>(args.This());
+
+    REQUIRE_ARGUMENT_STRING(0, name);
+    REQUIRE_ARGUMENTS(2);
+    int pos = 2;
+
+    bool deterministic = false;
+    bool batch = false;
+    if (args.Length() > pos && args[pos]->IsObject() && !args[pos]->IsFunction()) {
+        Local<Object> options = args[pos++].As<Object>();
+        deterministic = options->Get(NanNew("deterministic"))->BooleanValue();
+        batch = options->Get(NanNew("batch"))->BooleanValue();
+    }
+
+    OPTIONAL_ARGUMENT_FUNCTION(pos, callback);
+
+    UserFunction* function = new UserFunction(*name, batch);
+    std::string error;
+    if (!function->Assign(args[1], error)) {
+        delete function;
+        return NanThrowTypeError(error.c_str());
+    }
+
+    Baton* baton = new FunctionBaton(db, callback, function,
+        deterministic ? SQLITE_DETERMINISTIC : 0);
+    // Exclusive so that no query is running while the function is replaced.
+    db->Schedule(RegisterFunction, baton, true);
+
+    NanReturnValue(args.This());
+}
+
+void Database::RegisterFunction(Baton* baton) {
+    NanScope();
+
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    assert(baton->db->pending == 0);
+    Database* db = baton->db;
+    FunctionBaton* function_baton = static_cast<FunctionBaton*>(baton);
+    UserFunction* function = function_baton->function;
+
+    bool aggregate = function->IsAggregate();
+    baton->status = sqlite3_create_function_v2(db->_handle,
+        function->name.c_str(), -1, SQLITE_UTF8 | function_baton->flags, function,
+        aggregate ? NULL : UserFunction::Scalar,
+        aggregate ? UserFunction::Step : NULL,
+        aggregate ? UserFunction::Final : NULL,
+        NULL);
+
+    Local<Function> cb = NanNew(baton->callback);
+
+    if (baton->status != SQLITE_OK) {
+        EXCEPTION(NanNew<String>(sqlite3_errmsg(db->_handle)), baton->status, exception);
+        if (!cb.IsEmpty() && cb->IsFunction()) {
+            Local<Value> argv[] = { exception };
+            TRY_CATCH_CALL(NanObjectWrapHandle(db), cb, 1, argv);
+        }
+        else {
+            Local<Value> args[] = { NanNew("error"), exception };
+            EMIT_EVENT(NanObjectWrapHandle(db), 2, args);
+        }
+    }
+    else {
+        // SQLite dropped the function this one replaces.
+        for (unsigned int i = 0; i < db->functions.size(); i++) {
+            if (sqlite3_stricmp(db->functions[i]->name.c_str(), function->name.c_str()) == 0) {
+                delete db->functions[i];
+                db->functions.erase(db->functions.begin() + i);
+                break;
+            }
+        }
+        db->functions.push_back(function);
+        function_baton->function = NULL;
+
+        if (!cb.IsEmpty() && cb->IsFunction()) {
+            Local<Value> argv[] = { NanNew(NanNull()) };
+            TRY_CATCH_CALL(NanObjectWrapHandle(db), cb, 1, argv);
+        }
+    }
+
+    db->Process();
+
+    delete baton;
+}
+
 NAN_METHOD(Database::Serialize) {
     NanScope();
     Database* db = ObjectWrap::Unwrap<Database>(args.This());
@@ -325,15 +756,20 @@ NAN_METHOD(Database::Configure) {
 
     REQUIRE_ARGUMENTS(2);
 
+    // These run on the main thread. A query may hold the connection mutex
+    // while it waits for a JavaScript function to run on the main thread, so
+    // once there are functions, they wait until no query is running.
+    bool exclusive = !db->functions.empty();
+
     if (args[0]->Equals(NanNew("trace"))) {
         Local<Function> handle;
         Baton* baton = new Baton(db, handle);
-        db->Schedule(RegisterTraceCallback, baton);
+        db->Schedule(RegisterTraceCallback, baton, exclusive);
     }
     else if (args[0]->Equals(NanNew("profile"))) {
         Local<Function> handle;
         Baton* baton = new Baton(db, handle);
-        db->Schedule(RegisterProfileCallback, baton);
+        db->Schedule(RegisterProfileCallback, baton, exclusive);
     }
     else if (args[0]->Equals(NanNew("busyTimeout"))) {
         if (!args[1]->IsInt32()) {
@@ -342,7 +778,74 @@ NAN_METHOD(Database::Configure) {
         Local<Function> handle;
         Baton* baton = new Baton(db, handle);
         baton->status = args[1]->Int32Value();
-        db->Schedule(SetBusyTimeout, baton);
+        db->Schedule(SetBusyTimeout, baton, exclusive);
+    }
+    else if (args[0]->Equals(NanNew("busyPolicy"))) {
+        bool retry = args[1]->Equals(NanNew("retry"));
+        if (!retry && !args[1]->Equals(NanNew("wait"))) {
+            return NanThrowTypeError("Value must be \"wait\" or \"retry\"");
+        }
+        Local<Function> handle;
+        Baton* baton = new Baton(db, handle);
+        baton->status = retry;
+        // Exclusive so that no work checks the policy while it changes.
+        db->Schedule(SetBusyPolicy, baton, true);
+    }
+    else if (args[0]->Equals(NanNew("changes"))) {
+        Local<Function> handle;
+        Baton* baton = new Baton(db, handle);
+        baton->status = args[1]->BooleanValue();
+        // Exclusive so that no statement modifies the pending changes while
+        // the hooks are swapped.
+        db->Schedule(RegisterChangesCallback, baton, true);
+    }
+    else if (args[0]->Equals(NanNew("slowQuery"))) {
+        if (!args[1]->IsInt32() || args[1]->Int32Value() < 0) {
+            return NanThrowTypeError("Value must be a non-negative integer");
+        }
+        Local<Function> handle;
+        Baton* baton = new Baton(db, handle);
+        baton->status = args[1]->Int32Value();
+        db->Schedule(SetSlowQuery, baton, exclusive);
+    }
+    else if (args[0]->Equals(NanNew("execYield"))) {
+        db->exec_yield = args[1]->BooleanValue();
+    }
+    else if (args[0]->Equals(NanNew("checkpointer"))) {
+        int pages = 0;
+        int limit = 0;
+        if (args[1]->IsObject()) {
+            Local<Object> options = args[1].As<Object>();
+            Local<Value> value = options->Get(NanNew("pages"));
+            pages = CHECKPOINT_PAGES;
+            if (!value->IsUndefined()) {
+                if (!value->IsInt32() || value->Int32Value() <= 0) {
+                    return NanThrowTypeError("pages must be a positive integer");
+                }
+                pages = value->Int32Value();
+            }
+            value = options->Get(NanNew("limit"));
+            limit = pages > INT_MAX / 10 ? INT_MAX : pages * 10;
+            if (!value->IsUndefined()) {
+                if (!value->IsInt32() || value->Int32Value() < pages) {
+                    return NanThrowTypeError("limit must be an integer of at least pages");
+                }
+                limit = value->Int32Value();
+            }
+        }
+        else if (args[1]->BooleanValue()) {
+            pages = CHECKPOINT_PAGES;
+            limit = CHECKPOINT_PAGES * 10;
+        }
+        Local<Function> handle;
+        Baton* baton = new CheckpointerBaton(db, handle, pages, limit);
+        db->Schedule(Work_BeginCheckpointer, baton, true);
+    }
+    else if (IsResultOption(args[0])) {
+        std::string error;
+        if (!ConfigureResults(db->result_options, args[0], args[1], error)) {
+            return NanThrowTypeError(error.c_str());
+        }
     }
     else {
         return NanThrowError(Exception::Error(String::Concat(
@@ -356,12 +859,107 @@ NAN_METHOD(Database::Configure) {
     NanReturnValue(args.This());
 }
 
+bool Database::IsResultOption(Handle<Value> option) {
+    return option->Equals(NanNew("resultLimit")) || option->Equals(NanNew("resultPolicy")) ||
+        option->Equals(NanNew("resultSliceRows")) || option->Equals(NanNew("resultSliceTime")) ||
+        option->Equals(NanNew("yieldSteps"));
+}
+
+bool Database::ConfigureResults(ResultOptions& options, Handle<Value> option,
+        Handle<Value> value, std::string& error) {
+    if (option->Equals(NanNew("resultLimit"))) {
+        double bytes = value->NumberValue();
+        if (!value->IsNumber() || !(bytes >= 0) || bytes > 9007199254740992.0) {
+            error = "Value must be a non-negative number of bytes";
+            return false;
+        }
+        options.bytes = (size_t)bytes;
+    }
+    else if (option->Equals(NanNew("resultPolicy"))) {
+        if (value->Equals(NanNew("error"))) {
+            options.policy = ResultOptions::POLICY_ERROR;
+        }
+        else if (value->Equals(NanNew("spill"))) {
+            options.policy = ResultOptions::POLICY_SPILL;
+        }
+        else {
+            error = "Value must be \"error\" or \"spill\"";
+            return false;
+        }
+    }
+    else {
+        if (!value->IsInt32() || value->Int32Value() < 0) {
+            error = "Value must be a non-negative integer";
+            return false;
+        }
+        if (option->Equals(NanNew("resultSliceRows"))) {
+            options.slice_rows = value->Int32Value();
+        }
+        else if (option->Equals(NanNew("resultSliceTime"))) {
+            options.slice_time = value->Int32Value();
+        }
+        else {
+            options.yield_steps = value->Int32Value();
+        }
+    }
+    return true;
+}
+
+void Database::AdjustExternalMemory(int64_t change) {
+    external_memory += change;
+    // V8 takes an int.
+    while (change > INT_MAX || change < -INT_MAX) {
+        int part = change > 0 ? INT_MAX : -INT_MAX;
+        NanAdjustExternalMemory(part);
+        change -= part;
+    }
+    if (change != 0) NanAdjustExternalMemory((int)change);
+}
+
+NAN_METHOD(Database::Metrics) {
+    NanScope();
+    Database* db = ObjectWrap::Unwrap<Database>(args.This());
+
+    Local<Object> result(NanNew<Object>());
+    result->Set(NanNew("externalMemory"), NanNew<Number>((double)db->external_memory));
+
+    NODE_SQLITE3_MUTEX_LOCK(&db->mutex)
+    unsigned int retries = db->busy_retries;
+    unsigned int timeouts = db->busy_timeouts;
+    NODE_SQLITE3_MUTEX_UNLOCK(&db->mutex)
+    result->Set(NanNew("busyRetries"), NanNew<Number>(retries));
+    result->Set(NanNew("busyTimeouts"), NanNew<Number>(timeouts));
+
+    Checkpointer* checkpointer = db->checkpointer;
+    result->Set(NanNew("checkpoints"),
+        NanNew<Number>(checkpointer ? checkpointer->Checkpoints() : 0));
+    result->Set(NanNew("walFrames"),
+        NanNew<Number>(checkpointer ? checkpointer->Frames() : 0));
+
+    NanReturnValue(result);
+}
+
 void Database::SetBusyTimeout(Baton* baton) {
     assert(baton->db->open);
     assert(baton->db->_handle);
 
     // Abuse the status field for passing the timeout.
-    sqlite3_busy_timeout(baton->db->_handle, baton->status);
+    baton->db->busy_timeout = baton->status;
+    if (!baton->db->busy_retry) {
+        sqlite3_busy_timeout(baton->db->_handle, baton->status);
+    }
+
+    delete baton;
+}
+
+void Database::SetBusyPolicy(Baton* baton) {
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+
+    Database* db = baton->db;
+    db->busy_retry = baton->status != 0;
+    // Without a busy handler, SQLite returns SQLITE_BUSY right away.
+    sqlite3_busy_timeout(db->_handle, db->busy_retry ? 0 : db->busy_timeout);
 
     delete baton;
 }
@@ -414,8 +1012,10 @@ void Database::RegisterProfileCallback(Baton* baton) {
         sqlite3_profile(db->_handle, ProfileCallback, db);
     }
     else {
-        // Remove it.
-        sqlite3_profile(db->_handle, NULL, NULL);
+        // Remove it, unless the slow query log still needs the profiler.
+        if (db->slow_threshold == 0) {
+            sqlite3_profile(db->_handle, NULL, NULL);
+        }
         db->debug_profile->finish();
         db->debug_profile = NULL;
     }
@@ -423,13 +1023,29 @@ void Database::RegisterProfileCallback(Baton* baton) {
     delete baton;
 }
 
-void Database::ProfileCallback(void* db, const char* sql, sqlite3_uint64 nsecs) {
-    // Note: This function is called in the thread pool.
+void Database::ProfileCallback(void* db_, const char* sql, sqlite3_uint64 nsecs) {
+    // Note: This function is called in the thread pool while holding the
+    // database mutex.
     // Note: Some queries, such as "EXPLAIN" queries, are not sent through this.
-    ProfileInfo* info = new ProfileInfo();
-    info->sql = std::string(sql);
-    info->nsecs = nsecs;
-    static_cast<Database*>(db)->debug_profile->send(info);
+    Database* db = static_cast<Database*>(db_);
+
+    if (db->debug_profile != NULL) {
+        ProfileInfo* info = new ProfileInfo();
+        info->sql = std::string(sql);
+        info->nsecs = nsecs;
+        db->debug_profile->send(info);
+    }
+
+    if (db->slow_threshold > 0 && !db->slow_capturing &&
+            nsecs >= (sqlite3_uint64)db->slow_threshold * 1000000) {
+        // The query plan and parameters are attached by the worker that ran
+        // the statement, see CaptureSlowQueries().
+        SlowQueryInfo* info = new SlowQueryInfo();
+        info->source = sql;
+        info->sql = std::string(sql);
+        info->nsecs = nsecs;
+        db->slow_pending.push_back(info);
+    }
 }
 
 void Database::ProfileCallback(Database *db, ProfileInfo* info) {
@@ -443,97 +1059,423 @@ void Database::ProfileCallback(Database *db, ProfileInfo* info) {
     delete info;
 }
 
-void Database::RegisterUpdateCallback(Baton* baton) {
+void Database::SetSlowQuery(Baton* baton) {
     assert(baton->db->open);
     assert(baton->db->_handle);
     Database* db = baton->db;
 
-    if (db->update_event == NULL) {
-        // Add it.
-        db->update_event = new AsyncUpdate(db, UpdateCallback);
-        sqlite3_update_hook(db->_handle, UpdateCallback, db);
+    // Abuse the status field for passing the threshold.
+    db->slow_threshold = baton->status;
+
+    if (db->slow_threshold > 0) {
+        sqlite3_profile(db->_handle, ProfileCallback, db);
     }
-    else {
-        // Remove it.
-        sqlite3_update_hook(db->_handle, NULL, NULL);
-        db->update_event->finish();
-        db->update_event = NULL;
+    else if (db->debug_profile == NULL) {
+        sqlite3_profile(db->_handle, NULL, NULL);
     }
 
     delete baton;
 }
 
-void Database::UpdateCallback(void* db, int type, const char* database,
-        const char* table, sqlite3_int64 rowid) {
-    // Note: This function is called in the thread pool.
-    // Note: Some queries, such as "EXPLAIN" queries, are not sent through this.
-    UpdateInfo* info = new UpdateInfo();
-    info->type = type;
-    info->database = std::string(database);
-    info->table = std::string(table);
-    info->rowid = rowid;
-    static_cast<Database*>(db)->update_event->send(info);
+Database::SlowQueryInfo::~SlowQueryInfo() {
+    for (unsigned int i = 0; i < parameters.size(); i++) {
+        Values::Field* field = parameters[i];
+        DELETE_FIELD(field);
+    }
 }
 
-void Database::UpdateCallback(Database *db, UpdateInfo* info) {
-    NanScope();
+static Values::Field* CloneParameter(Values::Field* field) {
+    // Positional parameters are keyed by their index in the log.
+    std::string name = field->name;
+    if (name.empty()) {
+        std::ostringstream index;
+        index << field->index;
+        name = index.str();
+    }
 
-    Local<Value> argv[] = {
-        NanNew(sqlite_authorizer_string(info->type)),
-        NanNew<String>(info->database.c_str()),
-        NanNew<String>(info->table.c_str()),
-        NanNew<Number>(info->rowid),
-    };
-    EMIT_EVENT(NanObjectWrapHandle(db), 4, argv);
-    delete info;
+    switch (field->type) {
+        case SQLITE_INTEGER:
+            return new Values::Integer(name.c_str(), ((Values::Integer*)field)->value);
+        case SQLITE_FLOAT:
+            return new Values::Float(name.c_str(), ((Values::Float*)field)->value);
+        case SQLITE_TEXT:
+            return new Values::Text(name.c_str(), ((Values::Text*)field)->value.size(),
+                ((Values::Text*)field)->value.c_str());
+        case SQLITE_BLOB:
+            return new Values::Blob(name.c_str(), ((Values::Blob*)field)->length,
+                ((Values::Blob*)field)->value);
+        default:
+            return new Values::Null(name.c_str());
+    }
 }
 
-NAN_METHOD(Database::Exec) {
-    NanScope();
-    Database* db = ObjectWrap::Unwrap<Database>(args.This());
+void Database::CaptureSlowQueries(sqlite3_stmt* stmt,
+        const std::vector<Values::Field*>* parameters) {
+    // Note: This function is called while holding the database mutex, right
+    // after the profiled statement finished or was reset.
+    if (slow_pending.empty()) return;
 
-    REQUIRE_ARGUMENT_STRING(0, sql);
-    OPTIONAL_ARGUMENT_FUNCTION(1, callback);
+    std::vector<SlowQueryInfo*> pending;
+    pending.swap(slow_pending);
 
-    Baton* baton = new ExecBaton(db, callback, *sql);
-    db->Schedule(Work_BeginExec, baton, true);
+    // Don't record the EXPLAIN statements we're running below.
+    slow_capturing = true;
 
-    NanReturnValue(args.This());
-}
+    for (unsigned int i = 0; i < pending.size(); i++) {
+        SlowQueryInfo* info = pending[i];
 
-void Database::Work_BeginExec(Baton* baton) {
-    assert(baton->db->locked);
-    assert(baton->db->open);
-    assert(baton->db->_handle);
-    assert(baton->db->pending == 0);
-    int status = uv_queue_work(uv_default_loop(),
-        &baton->request, Work_Exec, (uv_after_work_cb)Work_AfterExec);
-    assert(status == 0);
-}
+        if (stmt != NULL && parameters != NULL && info->source == sqlite3_sql(stmt)) {
+            for (unsigned int j = 0; j < parameters->size(); j++) {
+                if ((*parameters)[j] != NULL) {
+                    info->parameters.push_back(CloneParameter((*parameters)[j]));
+                }
+            }
+        }
 
-void Database::Work_Exec(uv_work_t* req) {
-    ExecBaton* baton = static_cast<ExecBaton*>(req->data);
+        std::string sql = "EXPLAIN QUERY PLAN " + info->sql;
+        sqlite3_stmt* explain = NULL;
+        if (sqlite3_prepare_v2(_handle, sql.c_str(), sql.size(), &explain, NULL) == SQLITE_OK) {
+            while (sqlite3_step(explain) == SQLITE_ROW) {
+                const char* detail = (const char*)sqlite3_column_text(explain, 3);
+                if (detail != NULL) {
+                    info->plan.push_back(std::string(detail));
+                }
+            }
+        }
+        sqlite3_finalize(explain);
 
-    char* message = NULL;
-    baton->status = sqlite3_exec(
-        baton->db->_handle,
-        baton->sql.c_str(),
-        NULL,
-        NULL,
-        &message
-    );
+        NODE_SQLITE3_MUTEX_LOCK(&mutex)
+        slow_queries.push_back(info);
+        if (slow_queries.size() > SLOW_QUERY_LOG_SIZE) {
+            delete slow_queries.front();
+            slow_queries.pop_front();
+        }
+        NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
+    }
 
-    if (baton->status != SQLITE_OK && message != NULL) {
-        baton->message = std::string(message);
-        sqlite3_free(message);
+    slow_capturing = false;
+}
+
+void Database::ClearSlowQueries() {
+    for (unsigned int i = 0; i < slow_pending.size(); i++) {
+        delete slow_pending[i];
+    }
+    slow_pending.clear();
+
+    NODE_SQLITE3_MUTEX_LOCK(&mutex)
+    while (!slow_queries.empty()) {
+        delete slow_queries.front();
+        slow_queries.pop_front();
     }
+    NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
 }
 
-void Database::Work_AfterExec(uv_work_t* req) {
+NAN_METHOD(Database::SlowQueries) {
+    NanScope();
+    Database* db = ObjectWrap::Unwrap<Database>(args.This());
+
+    // Drain the log; entries are returned at most once.
+    std::deque<SlowQueryInfo*> entries;
+    NODE_SQLITE3_MUTEX_LOCK(&db->mutex)
+    entries.swap(db->slow_queries);
+    NODE_SQLITE3_MUTEX_UNLOCK(&db->mutex)
+
+    Local<Array> result(NanNew<Array>(entries.size()));
+    for (unsigned int i = 0; i < entries.size(); i++) {
+        SlowQueryInfo* info = entries[i];
+
+        Local<Array> plan(NanNew<Array>(info->plan.size()));
+        for (unsigned int j = 0; j < info->plan.size(); j++) {
+            plan->Set(j, NanNew<String>(info->plan[j].c_str()));
+        }
+
+        Local<Object> entry(NanNew<Object>());
+        entry->Set(NanNew("sql"), NanNew<String>(info->sql.c_str()));
+        entry->Set(NanNew("time"), NanNew<Number>((double)info->nsecs / 1000000.0));
+        // RowToJS takes ownership of the fields.
+        entry->Set(NanNew("params"), Statement::RowToJS(&info->parameters));
+        info->parameters.clear();
+        entry->Set(NanNew("plan"), plan);
+        result->Set(i, entry);
+
+        delete info;
+    }
+
+    NanReturnValue(result);
+}
+
+void Database::RegisterUpdateCallback(Baton* baton) {
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    Database* db = baton->db;
+
+    if (db->update_event == NULL) {
+        // Add it.
+        db->update_event = new AsyncUpdate(db, UpdateCallback);
+        sqlite3_update_hook(db->_handle, UpdateCallback, db);
+    }
+    else {
+        // Remove it, unless the change feed still needs the hook.
+        if (db->change_feed == NULL) {
+            sqlite3_update_hook(db->_handle, NULL, NULL);
+        }
+        db->update_event->finish();
+        db->update_event = NULL;
+    }
+
+    delete baton;
+}
+
+void Database::UpdateCallback(void* db_, int type, const char* database,
+        const char* table, sqlite3_int64 rowid) {
+    // Note: This function is called in the thread pool while holding the
+    // database mutex.
+    // Note: Some queries, such as "EXPLAIN" queries, are not sent through this.
+    Database* db = static_cast<Database*>(db_);
+
+    if (db->update_event != NULL) {
+        UpdateInfo* info = new UpdateInfo();
+        info->type = type;
+        info->database = std::string(database);
+        info->table = std::string(table);
+        info->rowid = rowid;
+        db->update_event->send(info);
+    }
+
+    if (db->change_feed != NULL) {
+        if (db->change_table == NULL || db->change_table_name != table ||
+                db->change_database != database) {
+            db->change_database = database;
+            db->change_table_name = table;
+            std::string name = db->change_database == "main" ?
+                db->change_table_name : db->change_database + "." + db->change_table_name;
+            db->change_table = &db->pending_changes[name];
+        }
+
+        switch (type) {
+            case SQLITE_INSERT: db->change_table->inserted.push_back(rowid); break;
+            case SQLITE_UPDATE: db->change_table->updated.push_back(rowid); break;
+            case SQLITE_DELETE: db->change_table->deleted.push_back(rowid); break;
+        }
+    }
+}
+
+void Database::RegisterChangesCallback(Baton* baton) {
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    Database* db = baton->db;
+
+    // Abuse the status field for passing whether to enable the feed.
+    if (baton->status && db->change_feed == NULL) {
+        // Add it.
+        db->change_feed = new AsyncChanges(db, ChangesCallback);
+        sqlite3_update_hook(db->_handle, UpdateCallback, db);
+        sqlite3_commit_hook(db->_handle, CommitCallback, db);
+        sqlite3_rollback_hook(db->_handle, RollbackCallback, db);
+    }
+    else if (!baton->status && db->change_feed != NULL) {
+        // Remove it.
+        if (db->update_event == NULL) {
+            sqlite3_update_hook(db->_handle, NULL, NULL);
+        }
+        sqlite3_commit_hook(db->_handle, NULL, NULL);
+        sqlite3_rollback_hook(db->_handle, NULL, NULL);
+        db->change_feed->finish();
+        db->change_feed = NULL;
+        db->ClearPendingChanges();
+    }
+
+    delete baton;
+}
+
+static void Compact(std::vector<sqlite3_int64>& rowids) {
+    std::sort(rowids.begin(), rowids.end());
+    rowids.erase(std::unique(rowids.begin(), rowids.end()), rowids.end());
+    // Release the excess capacity before the vector crosses threads.
+    std::vector<sqlite3_int64>(rowids).swap(rowids);
+}
+
+int Database::CommitCallback(void* db) {
+    // Note: This function is called in the thread pool while holding the
+    // database mutex.
+    // Note: The commit may still fail, e.g. with SQLITE_BUSY, so the changes
+    // are only delivered once it is done.
+    static_cast<Database*>(db)->committing = true;
+
+    // Returning non-zero would turn the commit into a rollback.
+    return 0;
+}
+
+void Database::DeliverChanges() {
+    // Note: This function is called in the thread pool while holding the
+    // database mutex, after each statement. A commit that failed leaves
+    // the transaction open, and a later COMMIT or ROLLBACK decides about
+    // the changes.
+    if (!committing || !sqlite3_get_autocommit(_handle)) return;
+
+    if (change_feed != NULL && !pending_changes.empty()) {
+        ChangeSet* changes = new ChangeSet();
+        changes->swap(pending_changes);
+        for (ChangeSet::iterator it = changes->begin(); it != changes->end(); ++it) {
+            Compact(it->second.inserted);
+            Compact(it->second.updated);
+            Compact(it->second.deleted);
+        }
+        change_feed->send(changes);
+    }
+    ClearPendingChanges();
+}
+
+void Database::RollbackCallback(void* db) {
+    // Note: This function is called in the thread pool while holding the
+    // database mutex.
+    static_cast<Database*>(db)->ClearPendingChanges();
+}
+
+void Database::ClearPendingChanges() {
+    pending_changes.clear();
+    change_table = NULL;
+    committing = false;
+}
+
+static Local<Array> RowidsToJS(const std::vector<sqlite3_int64>& rowids) {
+    Local<Array> result(NanNew<Array>(rowids.size()));
+    for (unsigned int i = 0; i < rowids.size(); i++) {
+        result->Set(i, NanNew<Number>(rowids[i]));
+    }
+    return result;
+}
+
+void Database::ChangesCallback(Database *db, ChangeSet* changes) {
+    // Note: This function is called in the main V8 thread.
+    NanScope();
+
+    Local<Object> tables(NanNew<Object>());
+    for (ChangeSet::const_iterator it = changes->begin(); it != changes->end(); ++it) {
+        const ChangeTable& table = it->second;
+        Local<Object> operations(NanNew<Object>());
+        if (!table.inserted.empty()) {
+            operations->Set(NanNew("insert"), RowidsToJS(table.inserted));
+        }
+        if (!table.updated.empty()) {
+            operations->Set(NanNew("update"), RowidsToJS(table.updated));
+        }
+        if (!table.deleted.empty()) {
+            operations->Set(NanNew("delete"), RowidsToJS(table.deleted));
+        }
+        tables->Set(NanNew<String>(it->first.c_str()), operations);
+    }
+
+    Local<Value> argv[] = { NanNew("changes"), tables };
+    EMIT_EVENT(NanObjectWrapHandle(db), 2, argv);
+    delete changes;
+}
+
+void Database::UpdateCallback(Database *db, UpdateInfo* info) {
+    NanScope();
+
+    Local<Value> argv[] = {
+        NanNew(sqlite_authorizer_string(info->type)),
+        NanNew<String>(info->database.c_str()),
+        NanNew<String>(info->table.c_str()),
+        NanNew<Number>(info->rowid),
+    };
+    EMIT_EVENT(NanObjectWrapHandle(db), 4, argv);
+    delete info;
+}
+
+NAN_METHOD(Database::Exec) {
+    NanScope();
+    Database* db = ObjectWrap::Unwrap<Database>(args.This());
+
+    REQUIRE_ARGUMENT_STRING(0, sql);
+    OPTIONAL_ARGUMENT_FUNCTION(1, callback);
+
+    Baton* baton = new ExecBaton(db, callback, *sql, db->exec_yield);
+    db->Schedule(Work_BeginExec, baton, true);
+
+    NanReturnValue(args.This());
+}
+
+void Database::Work_BeginExec(Baton* baton) {
+    assert(baton->db->locked);
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    assert(baton->db->pending == 0);
+    ExecBaton* exec_baton = static_cast<ExecBaton*>(baton);
+    int status = Timeline::Queue(baton, "Database.Exec",
+        exec_baton->sql.c_str(), Work_Exec, Work_AfterExec);
+    assert(status == 0);
+}
+
+void Database::Work_Exec(uv_work_t* req) {
+    ExecBaton* baton = static_cast<ExecBaton*>(req->data);
+    Database* db = baton->db;
+
+    sqlite3_mutex* mtx = sqlite3_db_mutex(db->_handle);
+    sqlite3_mutex_enter(mtx);
+
+    // Like sqlite3_exec(), but keeps track of the statements that already
+    // ran, so that the script can continue where it stopped when it yields
+    // or waits for a lock. Whitespace and comments don't compile to a
+    // statement.
+    const char* sql = baton->sql.c_str() + baton->offset;
+    while (baton->status == SQLITE_OK && *sql) {
+        sqlite3_stmt* stmt = NULL;
+        const char* tail = sql;
+        baton->status = sqlite3_prepare_v2(db->_handle, sql, -1, &stmt, &tail);
+        if (stmt != NULL) {
+            while ((baton->status = sqlite3_step(stmt)) == SQLITE_ROW);
+            if (baton->status == SQLITE_DONE) baton->status = SQLITE_OK;
+        }
+
+        if (baton->status == SQLITE_OK) {
+            sql = tail;
+        }
+        else if (!db->WaitForUnlock(baton->status, baton->unlock)) {
+            baton->message = std::string(sqlite3_errmsg(db->_handle));
+        }
+        sqlite3_finalize(stmt);
+
+        if (stmt != NULL && baton->yield) break;
+    }
+    baton->offset = sql - baton->sql.c_str();
+
+    db->CaptureSlowQueries(NULL, NULL);
+    db->DeliverChanges();
+    sqlite3_mutex_leave(mtx);
+}
+
+void Database::Work_AfterExec(uv_work_t* req) {
     NanScope();
     ExecBaton* baton = static_cast<ExecBaton*>(req->data);
     Database* db = baton->db;
 
+    if (baton->unlock.waiting) {
+        baton->status = SQLITE_OK;
+        RetryWhenUnlocked(baton->unlock, RetryExec, baton);
+        return;
+    }
+
+    if (baton->status == SQLITE_OK && baton->offset < baton->sql.size()) {
+        // Continue behind the non-exclusive calls at the front of the queue,
+        // but ahead of exclusive ones: close(), another exec() and the
+        // like only run once the whole script is done.
+        std::queue<Call*> rest;
+        rest.swap(db->queue);
+        while (!rest.empty() && !rest.front()->exclusive) {
+            db->queue.push(rest.front());
+            rest.pop();
+        }
+        db->queue.push(new Call(Work_BeginExec, baton, true));
+        while (!rest.empty()) {
+            db->queue.push(rest.front());
+            rest.pop();
+        }
+        db->Process();
+        return;
+    }
+
     Local<Function> cb = NanNew(baton->callback);
 
     if (baton->status != SQLITE_OK) {
@@ -558,6 +1500,91 @@ void Database::Work_AfterExec(uv_work_t* req) {
     delete baton;
 }
 
+// Runs the rest of the script after it waited for a lock. The database
+// stays locked in the meantime.
+void Database::RetryExec(void* data) {
+    ExecBaton* baton = static_cast<ExecBaton*>(data);
+    int status = Timeline::Queue(baton, "Database.Exec",
+        baton->sql.c_str() + baton->offset, Work_Exec, Work_AfterExec);
+    assert(status == 0);
+}
+
+void Database::Work_BeginCheckpointer(Baton* baton) {
+    assert(baton->db->locked);
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    assert(baton->db->pending == 0);
+    CheckpointerBaton* checkpointer_baton = static_cast<CheckpointerBaton*>(baton);
+    Database* db = baton->db;
+
+    checkpointer_baton->previous = db->DetachCheckpointer();
+
+    if (checkpointer_baton->pages > 0) {
+        const char* filename = sqlite3_db_filename(db->_handle, "main");
+        if (!db->image.empty() || filename == NULL || *filename == '\0') {
+            baton->status = SQLITE_MISUSE;
+            baton->message = "Checkpointing needs a database file";
+        }
+        else {
+            Checkpointer* checkpointer = new Checkpointer(filename,
+                db->vfs.empty() ? NULL : db->vfs.c_str(),
+                checkpointer_baton->pages, checkpointer_baton->limit);
+            if (checkpointer->Start()) {
+                // Replaces the hook of the automatic checkpoints.
+                sqlite3_wal_hook(db->_handle, Checkpointer::WalHook, checkpointer);
+                db->checkpointer = checkpointer;
+            }
+            else {
+                delete checkpointer;
+                baton->status = SQLITE_ERROR;
+                baton->message = "Could not start the checkpointer thread";
+            }
+        }
+    }
+
+    // The previous checkpointer may still be checkpointing, so it is
+    // stopped on the thread pool.
+    int status = Timeline::Queue(baton, "Database.Checkpointer", NULL,
+        Work_Checkpointer, Work_AfterCheckpointer);
+    assert(status == 0);
+}
+
+void Database::Work_Checkpointer(uv_work_t* req) {
+    CheckpointerBaton* baton = static_cast<CheckpointerBaton*>(req->data);
+    delete baton->previous;
+    baton->previous = NULL;
+}
+
+void Database::Work_AfterCheckpointer(uv_work_t* req) {
+    NanScope();
+    CheckpointerBaton* baton = static_cast<CheckpointerBaton*>(req->data);
+    Database* db = baton->db;
+
+    if (baton->status != SQLITE_OK) {
+        EXCEPTION(NanNew<String>(baton->message.c_str()), baton->status, exception);
+        Local<Value> args[] = { NanNew("error"), exception };
+        EMIT_EVENT(NanObjectWrapHandle(db), 2, args);
+    }
+
+    db->Process();
+
+    delete baton;
+}
+
+Checkpointer* Database::DetachCheckpointer() {
+    Checkpointer* previous = checkpointer;
+    if (previous != NULL) {
+        // Also replaces the WAL hook.
+        sqlite3_wal_autocheckpoint(_handle, CHECKPOINT_PAGES);
+        checkpointer = NULL;
+    }
+    return previous;
+}
+
+void Database::StopCheckpointer() {
+    delete DetachCheckpointer();
+}
+
 NAN_METHOD(Database::Wait) {
     NanScope();
     Database* db = ObjectWrap::Unwrap<Database>(args.This());
@@ -607,8 +1634,9 @@ void Database::Work_BeginLoadExtension(Baton* baton) {
     assert(baton->db->open);
     assert(baton->db->_handle);
     assert(baton->db->pending == 0);
-    int status = uv_queue_work(uv_default_loop(),
-        &baton->request, Work_LoadExtension, (uv_after_work_cb)Work_AfterLoadExtension);
+    LoadExtensionBaton* load_baton = static_cast<LoadExtensionBaton*>(baton);
+    int status = Timeline::Queue(baton, "Database.LoadExtension",
+        load_baton->filename.c_str(), Work_LoadExtension, Work_AfterLoadExtension);
     assert(status == 0);
 }
 
@@ -661,6 +1689,401 @@ void Database::Work_AfterLoadExtension(uv_work_t* req) {
     delete baton;
 }
 
+NAN_METHOD(Database::Backup) {
+    NanScope();
+    Database* db = ObjectWrap::Unwrap<Database>(args.This());
+
+    REQUIRE_ARGUMENT_STRING(0, filename);
+    int pos = 1;
+
+    int pages_per_step = 100;
+    int pause = 0;
+    if (args.Length() > pos && args[pos]->IsObject() && !args[pos]->IsFunction()) {
+        Local<Object> options = args[pos++].As<Object>();
+        Local<Value> pages = options->Get(NanNew("pagesPerStep"));
+        if (!pages->IsUndefined()) {
+            if (!pages->IsInt32() || pages->Int32Value() == 0) {
+                return NanThrowTypeError("pagesPerStep must be a non-zero integer");
+            }
+            // A negative number copies all remaining pages in one step.
+            pages_per_step = pages->Int32Value();
+        }
+        Local<Value> ms = options->Get(NanNew("pauseMs"));
+        if (!ms->IsUndefined()) {
+            if (!ms->IsInt32() || ms->Int32Value() < 0) {
+                return NanThrowTypeError("pauseMs must be a non-negative integer");
+            }
+            pause = ms->Int32Value();
+        }
+    }
+
+    OPTIONAL_ARGUMENT_FUNCTION(pos, callback);
+
+    BackupBaton* baton = new BackupBaton(db, callback, *filename, pages_per_step, pause);
+    uv_timer_init(uv_default_loop(), &baton->timer);
+    baton->timer.data = baton;
+    db->Schedule(Work_BeginBackup, baton);
+
+    NanReturnValue(args.This());
+}
+
+void Database::Work_BeginBackup(Baton* baton) {
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    BackupBaton* backup_baton = static_cast<BackupBaton*>(baton);
+    // The destination is open from the first step until the last one.
+    if (backup_baton->dest == NULL) {
+        baton->db->backups++;
+    }
+    baton->db->pending++;
+    int status = Timeline::Queue(baton, "Database.Backup",
+        backup_baton->filename.c_str(), Work_Backup, Work_AfterBackup);
+    assert(status == 0);
+}
+
+void Database::ScheduleBackupStep(BackupBaton* baton) {
+    if (baton->db->closing != NULL) {
+        // Everything else waits behind close(), which waits for the backup.
+        Work_BeginBackup(baton);
+    }
+    else {
+        baton->db->Schedule(Work_BeginBackup, baton);
+    }
+}
+
+void Database::Work_Backup(uv_work_t* req) {
+    BackupBaton* baton = static_cast<BackupBaton*>(req->data);
+    Database* db = baton->db;
+
+    if (baton->backup == NULL) {
+        baton->status = sqlite3_open_v2(baton->filename.c_str(), &baton->dest,
+            SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+        if (baton->status == SQLITE_OK) {
+            baton->backup = sqlite3_backup_init(baton->dest, "main", db->_handle, "main");
+            if (baton->backup == NULL) {
+                baton->status = sqlite3_errcode(baton->dest);
+            }
+        }
+        if (baton->status != SQLITE_OK) {
+            baton->message = std::string(sqlite3_errmsg(baton->dest));
+            sqlite3_close(baton->dest);
+            baton->dest = NULL;
+            baton->finished = true;
+            return;
+        }
+    }
+
+    baton->status = sqlite3_backup_step(baton->backup, baton->pages_per_step);
+    baton->remaining = sqlite3_backup_remaining(baton->backup);
+    baton->page_count = sqlite3_backup_pagecount(baton->backup);
+
+    if (baton->status == SQLITE_OK || baton->status == SQLITE_BUSY ||
+            baton->status == SQLITE_LOCKED) {
+        // More pages to copy, or the source is locked; try again in the
+        // next step.
+        baton->busy = baton->status != SQLITE_OK;
+        baton->status = SQLITE_OK;
+        return;
+    }
+
+    int status = sqlite3_backup_finish(baton->backup);
+    baton->backup = NULL;
+    baton->finished = true;
+    if (baton->status == SQLITE_DONE) {
+        baton->status = status;
+    }
+    if (baton->status != SQLITE_OK) {
+        baton->message = std::string(sqlite3_errmsg(baton->dest));
+    }
+    sqlite3_close(baton->dest);
+    baton->dest = NULL;
+}
+
+void Database::Work_AfterBackup(uv_work_t* req) {
+    NanScope();
+    BackupBaton* baton = static_cast<BackupBaton*>(req->data);
+    Database* db = baton->db;
+
+    db->pending--;
+    if (baton->finished) {
+        db->backups--;
+    }
+
+    if (baton->status == SQLITE_OK) {
+        Local<Object> progress(NanNew<Object>());
+        progress->Set(NanNew("filename"), NanNew<String>(baton->filename.c_str()));
+        progress->Set(NanNew("remaining"), NanNew<Integer>(baton->remaining));
+        progress->Set(NanNew("pageCount"), NanNew<Integer>(baton->page_count));
+        Local<Value> args[] = { NanNew("backup"), progress };
+        EMIT_EVENT(NanObjectWrapHandle(db), 2, args);
+    }
+
+    if (!baton->finished) {
+        // Let queued work run before the next step.
+        db->Process();
+
+        unsigned int delay = baton->pause;
+        if (baton->busy) {
+            // Back off while the source is locked rather than retrying
+            // right away on the thread pool.
+            unsigned int backoff = BUSY_RETRY_MAX_DELAY;
+            if (baton->busy_attempts < 16) {
+                backoff = std::min(BUSY_RETRY_MIN_DELAY << baton->busy_attempts,
+                    BUSY_RETRY_MAX_DELAY);
+            }
+            backoff = backoff / 2 + rand() % (backoff / 2 + 1);
+            delay = std::max(delay, backoff);
+            baton->busy_attempts++;
+        }
+        else {
+            baton->busy_attempts = 0;
+        }
+
+        if (delay > 0) {
+            uv_timer_start(&baton->timer,
+                reinterpret_cast<uv_timer_cb>(BackupTimer), delay, 0);
+        }
+        else {
+            ScheduleBackupStep(baton);
+        }
+        return;
+    }
+
+    Local<Function> cb = NanNew(baton->callback);
+
+    if (baton->status != SQLITE_OK) {
+        EXCEPTION(NanNew<String>(baton->message.c_str()), baton->status, exception);
+
+        if (!cb.IsEmpty() && cb->IsFunction()) {
+            Local<Value> argv[] = { exception };
+            TRY_CATCH_CALL(NanObjectWrapHandle(db), cb, 1, argv);
+        }
+        else {
+            Local<Value> args[] = { NanNew("error"), exception };
+            EMIT_EVENT(NanObjectWrapHandle(db), 2, args);
+        }
+    }
+    else if (!cb.IsEmpty() && cb->IsFunction()) {
+        Local<Value> argv[] = { NanNew(NanNull()) };
+        TRY_CATCH_CALL(NanObjectWrapHandle(db), cb, 1, argv);
+    }
+
+    if (db->backups == 0 && db->closing != NULL) {
+        Baton* close = db->closing;
+        db->closing = NULL;
+        db->pending--;
+        Work_BeginClose(close);
+    }
+    else {
+        db->Process();
+    }
+
+    uv_close((uv_handle_t*)&baton->timer, BackupClosed);
+}
+
+void Database::BackupTimer(uv_timer_t* handle, int status) {
+    ScheduleBackupStep(static_cast<BackupBaton*>(handle->data));
+}
+
+void Database::BackupClosed(uv_handle_t* handle) {
+    delete static_cast<BackupBaton*>(handle->data);
+}
+
+NAN_METHOD(Database::ToBuffer) {
+    NanScope();
+    Database* db = ObjectWrap::Unwrap<Database>(args.This());
+    REQUIRE_ARGUMENT_FUNCTION(0, callback);
+
+    if (MemoryVfs::Register() != SQLITE_OK) {
+        return NanThrowError("Could not register the memory VFS");
+    }
+
+    Baton* baton = new ToBufferBaton(db, callback);
+    db->Schedule(Work_BeginToBuffer, baton);
+
+    NanReturnValue(args.This());
+}
+
+void Database::Work_BeginToBuffer(Baton* baton) {
+    assert(baton->db->open);
+    assert(baton->db->_handle);
+    baton->db->pending++;
+    int status = Timeline::Queue(baton, "Database.ToBuffer", NULL,
+        Work_ToBuffer, Work_AfterToBuffer);
+    assert(status == 0);
+}
+
+void Database::Work_ToBuffer(uv_work_t* req) {
+    ToBufferBaton* baton = static_cast<ToBufferBaton*>(req->data);
+    Database* db = baton->db;
+
+    // Copy all pages into a new memory image in a single step and take the
+    // image's memory for the Buffer once the copy is closed.
+    std::string name = MemoryVfs::Create();
+    sqlite3* dest = NULL;
+    baton->status = sqlite3_open_v2(name.c_str(), &dest,
+        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, MemoryVfs::Name);
+    if (baton->status == SQLITE_OK) {
+        // The copy is thrown away on failure, so it needs no journal.
+        baton->status = sqlite3_exec(dest, "PRAGMA journal_mode = OFF", NULL, NULL, NULL);
+    }
+    if (baton->status == SQLITE_OK) {
+        sqlite3_backup* backup = sqlite3_backup_init(dest, "main", db->_handle, "main");
+        if (backup == NULL) {
+            baton->status = sqlite3_errcode(dest);
+        }
+        else {
+            sqlite3_backup_step(backup, -1);
+            baton->status = sqlite3_backup_finish(backup);
+        }
+    }
+    if (baton->status != SQLITE_OK) {
+        baton->message = std::string(sqlite3_errmsg(dest));
+    }
+    sqlite3_close(dest);
+
+    int taken = MemoryVfs::Take(name, &baton->data, &baton->size);
+    if (baton->status != SQLITE_OK) {
+        return;
+    }
+    if (taken != SQLITE_OK) {
+        baton->status = taken;
+        baton->message = taken == SQLITE_NOMEM ? "out of memory" : "Could not read the database copy";
+        return;
+    }
+
+    // Memory images have no shared memory for a WAL index, so a snapshot
+    // of a WAL database is turned into a rollback journal database.
+    if (baton->size > 19 && baton->data[18] == 2 && baton->data[19] == 2) {
+        baton->data[18] = baton->data[19] = 1;
+    }
+}
+
+void Database::Work_AfterToBuffer(uv_work_t* req) {
+    NanScope();
+    ToBufferBaton* baton = static_cast<ToBufferBaton*>(req->data);
+    Database* db = baton->db;
+
+    db->pending--;
+
+    Local<Function> cb = NanNew(baton->callback);
+
+    if (baton->status != SQLITE_OK) {
+        EXCEPTION(NanNew<String>(baton->message.c_str()), baton->status, exception);
+        Local<Value> argv[] = { exception };
+        TRY_CATCH_CALL(NanObjectWrapHandle(db), cb, 1, argv);
+    }
+    else {
+        // The Buffer takes over the image's memory.
+        Local<Value> argv[] = { NanNew(NanNull()),
+            NanNew(NanNewBufferHandle(baton->data, baton->size, FreeImage, NULL)) };
+        baton->data = NULL;
+        TRY_CATCH_CALL(NanObjectWrapHandle(db), cb, 2, argv);
+    }
+
+    db->Process();
+
+    delete baton;
+}
+
+void Database::FreeImage(char* data, void* hint) {
+    free(data);
+}
+
+bool Database::WaitForUnlock(int status, UnlockWait& wait) {
+    // Note: This function is called in the thread pool while holding the
+    // sqlite3_db_mutex.
+    if ((status & 0xff) == SQLITE_BUSY && busy_retry) {
+        uint64_t now = uv_hrtime();
+        if (wait.started == 0) wait.started = now;
+        bool retry = now - wait.started < (uint64_t)busy_timeout * 1000000;
+
+        NODE_SQLITE3_MUTEX_LOCK(&mutex)
+        if (retry) busy_retries++;
+        else busy_timeouts++;
+        NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
+
+        wait.busy = retry;
+        wait.waiting = retry;
+        return retry;
+    }
+
+#ifdef SQLITE_ENABLE_UNLOCK_NOTIFY
+    // Shared-cache table locks don't invoke the busy handler, so they'd
+    // fail right away otherwise.
+    if (status != SQLITE_LOCKED ||
+            sqlite3_extended_errcode(_handle) != SQLITE_LOCKED_SHAREDCACHE) {
+        return false;
+    }
+
+    wait.ticket = unlocks.Get();
+    // Fails with SQLITE_LOCKED if waiting would deadlock.
+    wait.waiting = sqlite3_unlock_notify(_handle, UnlockNotify, NULL) == SQLITE_OK;
+    return wait.waiting;
+#else
+    return false;
+#endif
+}
+
+void Database::UnlockNotify(void** args, int count) {
+    unlocks.Increment();
+    uv_async_send(&unlock_watcher);
+}
+
+void Database::RetryWhenUnlocked(UnlockWait& wait, Requeue_Callback callback, void* baton) {
+    wait.waiting = false;
+    if (wait.busy) {
+        // Exponential backoff with jitter, so that connections waiting for
+        // the same lock don't retry in lockstep.
+        unsigned int delay = BUSY_RETRY_MAX_DELAY;
+        if (wait.attempts < 16) {
+            delay = std::min(BUSY_RETRY_MIN_DELAY << wait.attempts, BUSY_RETRY_MAX_DELAY);
+        }
+        delay = delay / 2 + rand() % (delay / 2 + 1);
+        wait.busy = false;
+        wait.attempts++;
+        wait.retry = callback;
+        wait.baton = baton;
+        uv_timer_init(uv_default_loop(), &wait.timer);
+        wait.timer.data = &wait;
+        uv_timer_start(&wait.timer, reinterpret_cast<uv_timer_cb>(BusyTimer), delay, 0);
+        return;
+    }
+
+    if (wait.ticket != unlocks.Get()) {
+        // The lock was released while the work was finishing up.
+        callback(baton);
+        return;
+    }
+
+    if (locked_calls.empty()) {
+        uv_ref((uv_handle_t*)&unlock_watcher);
+    }
+    locked_calls.push_back(LockedCall(callback, baton));
+}
+
+void Database::BusyTimer(uv_timer_t* handle, int status) {
+    uv_close((uv_handle_t*)handle, BusyClosed);
+}
+
+void Database::BusyClosed(uv_handle_t* handle) {
+    UnlockWait* wait = static_cast<UnlockWait*>(handle->data);
+    wait->retry(wait->baton);
+}
+
+void Database::AsyncUnlock(uv_async_t* handle, int status) {
+    // Each connection can only wait for one notification at a time, so
+    // retry all waiting work. Work that is still blocked waits again.
+    std::vector<LockedCall> calls;
+    calls.swap(locked_calls);
+    if (calls.empty()) return;
+
+    uv_unref((uv_handle_t*)&unlock_watcher);
+    for (unsigned int i = 0; i < calls.size(); i++) {
+        calls[i].callback(calls[i].baton);
+    }
+}
+
 void Database::RemoveCallbacks() {
     if (debug_trace) {
         debug_trace->finish();
@@ -670,4 +2093,9 @@ void Database::RemoveCallbacks() {
         debug_profile->finish();
         debug_profile = NULL;
     }
+    if (change_feed) {
+        change_feed->finish();
+        change_feed = NULL;
+        ClearPendingChanges();
+    }
 }
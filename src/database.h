@@ -4,19 +4,30 @@
 
 #include <node.h>
 
+#include <stdint.h>
 #include <string>
 #include <queue>
+#include <deque>
+#include <vector>
+#include <map>
 
 #include <sqlite3.h>
 #include "nan.h"
 #include "async.h"
+#include "timeline.h"
 
 using namespace v8;
 using namespace node;
 
 namespace node_sqlite3 {
 
+namespace Values {
+    struct Field;
+}
+
 class Database;
+class UserFunction;
+class Checkpointer;
 
 
 class Database : public ObjectWrap {
@@ -31,12 +42,41 @@ public:
         return NanNew(constructor_template)->HasInstance(obj);
     }
 
+    typedef void (*Requeue_Callback)(void* baton);
+
+    // Set on the thread pool when work failed on a shared-cache table lock
+    // and waits for sqlite3_unlock_notify() to run again.
+    struct UnlockWait {
+        UnlockWait() : waiting(false), ticket(0), busy(false), attempts(0),
+            started(0), retry(NULL), baton(NULL) {}
+        bool waiting;
+        unsigned int ticket;
+        // Set instead when work failed with SQLITE_BUSY under the "retry"
+        // busy policy and runs again after a delay. started is when the
+        // first attempt failed, in uv_hrtime() nanoseconds.
+        bool busy;
+        unsigned int attempts;
+        uint64_t started;
+        uv_timer_t timer;
+        Requeue_Callback retry;
+        void* baton;
+    };
+
+    struct LockedCall {
+        LockedCall(Requeue_Callback cb_, void* baton_) :
+            callback(cb_), baton(baton_) {}
+        Requeue_Callback callback;
+        void* baton;
+    };
+
     struct Baton {
         uv_work_t request;
         Database* db;
         Persistent<Function> callback;
         int status;
         std::string message;
+        Timeline::Span span;
+        UnlockWait unlock;
 
         Baton(Database* db_, Handle<Function> cb_) :
                 db(db_), status(SQLITE_OK) {
@@ -50,17 +90,69 @@ public:
         }
     };
 
+    // How all() collects and converts its rows.
+    struct ResultOptions {
+        enum Policy { POLICY_ERROR, POLICY_SPILL };
+        ResultOptions() : bytes(0), policy(POLICY_ERROR), slice_rows(0), slice_time(0),
+            yield_steps(0) {}
+        // Bounds the memory used for the rows collected before they are
+        // converted; 0 for no limit. Past the limit, the query either fails
+        // or writes the remaining rows to a temporary file.
+        size_t bytes;
+        Policy policy;
+        // Converts at most this many rows, or for at most this many
+        // milliseconds, per turn of the event loop; 0 for no bound.
+        unsigned int slice_rows;
+        unsigned int slice_time;
+        // Releases the connection mutex every this many steps while the
+        // rows are read, so that other work on the connection can run in
+        // between; 0 to hold it until the query is done.
+        unsigned int yield_steps;
+    };
+
+    // Settings from the options object passed to the constructor.
+    struct OpenOptions {
+        int busy_timeout;
+        // Name of the VFS to open the database with; empty for the default.
+        std::string vfs;
+        // PRAGMA statements applied before the database is reported open.
+        std::vector<std::string> pragmas;
+        OpenOptions() : busy_timeout(1000) {}
+    };
+
     struct OpenBaton : Baton {
         std::string filename;
         int mode;
+        OpenOptions options;
         OpenBaton(Database* db_, Handle<Function> cb_, const char* filename_, int mode_) :
             Baton(db_, cb_), filename(filename_), mode(mode_) {}
     };
 
     struct ExecBaton : Baton {
         std::string sql;
-        ExecBaton(Database* db_, Handle<Function> cb_, const char* sql_) :
-            Baton(db_, cb_), sql(sql_) {}
+        // Runs one statement per turn when set; offset is where the next
+        // statement starts.
+        bool yield;
+        size_t offset;
+        ExecBaton(Database* db_, Handle<Function> cb_, const char* sql_, bool yield_) :
+            Baton(db_, cb_), sql(sql_), yield(yield_), offset(0) {}
+    };
+
+    struct CloseBaton : Baton {
+        // Stopped on the thread pool before the database is closed.
+        Checkpointer* checkpointer;
+        CloseBaton(Database* db_, Handle<Function> cb_) :
+            Baton(db_, cb_), checkpointer(NULL) {}
+    };
+
+    // Replaces the checkpointer; pages is 0 to go back to automatic
+    // checkpoints.
+    struct CheckpointerBaton : Baton {
+        int pages;
+        int limit;
+        Checkpointer* previous;
+        CheckpointerBaton(Database* db_, Handle<Function> cb_, int pages_, int limit_) :
+            Baton(db_, cb_), pages(pages_), limit(limit_), previous(NULL) {}
     };
 
     struct LoadExtensionBaton : Baton {
@@ -69,6 +161,49 @@ public:
             Baton(db_, cb_), filename(filename_) {}
     };
 
+    // An online backup, which runs one step at a time so that other work
+    // on the database can run in between. It counts as pending work until
+    // it is done, so exclusive work such as close() waits for it.
+    struct BackupBaton : Baton {
+        std::string filename;
+        int pages_per_step;
+        int pause;
+        sqlite3* dest;
+        sqlite3_backup* backup;
+        int remaining;
+        int page_count;
+        bool finished;
+        // Set when the last step found the source locked; the next step
+        // waits longer after every such step in a row.
+        bool busy;
+        unsigned int busy_attempts;
+        uv_timer_t timer;
+        BackupBaton(Database* db_, Handle<Function> cb_, const char* filename_,
+                int pages_per_step_, int pause_) :
+            Baton(db_, cb_), filename(filename_), pages_per_step(pages_per_step_),
+            pause(pause_), dest(NULL), backup(NULL), remaining(0), page_count(0),
+            finished(false), busy(false), busy_attempts(0) {}
+    };
+
+    // Snapshot of the database as a single image in memory.
+    struct ToBufferBaton : Baton {
+        char* data;
+        size_t size;
+        ToBufferBaton(Database* db_, Handle<Function> cb_) :
+            Baton(db_, cb_), data(NULL), size(0) {}
+        ~ToBufferBaton() {
+            free(data);
+        }
+    };
+
+    struct FunctionBaton : Baton {
+        UserFunction* function;
+        int flags;
+        FunctionBaton(Database* db_, Handle<Function> cb_, UserFunction* function_, int flags_) :
+            Baton(db_, cb_), function(function_), flags(flags_) {}
+        ~FunctionBaton();
+    };
+
     typedef void (*Work_Callback)(Baton* baton);
 
     struct Call {
@@ -84,6 +219,17 @@ public:
         sqlite3_int64 nsecs;
     };
 
+    struct SlowQueryInfo {
+        // Pointer to the statement's SQL as passed to the profile callback;
+        // only used to match the statement and never dereferenced.
+        const char* source;
+        std::string sql;
+        sqlite3_int64 nsecs;
+        std::vector<Values::Field*> parameters;
+        std::vector<std::string> plan;
+        ~SlowQueryInfo();
+    };
+
     struct UpdateInfo {
         int type;
         std::string database;
@@ -91,14 +237,26 @@ public:
         sqlite3_int64 rowid;
     };
 
+    // Rowids modified in one transaction, by operation.
+    struct ChangeTable {
+        std::vector<sqlite3_int64> inserted;
+        std::vector<sqlite3_int64> updated;
+        std::vector<sqlite3_int64> deleted;
+    };
+
+    // Changes of one transaction, by table name.
+    typedef std::map<std::string, ChangeTable> ChangeSet;
+
     bool IsOpen() { return open; }
     bool IsLocked() { return locked; }
 
     typedef Async<std::string, Database> AsyncTrace;
     typedef Async<ProfileInfo, Database> AsyncProfile;
     typedef Async<UpdateInfo, Database> AsyncUpdate;
+    typedef Async<ChangeSet, Database> AsyncChanges;
 
     friend class Statement;
+    friend class Blob;
 
 protected:
     Database() : ObjectWrap(),
@@ -109,17 +267,41 @@ protected:
         serialize(false),
         debug_trace(NULL),
         debug_profile(NULL),
-        update_event(NULL) {
+        update_event(NULL),
+        change_feed(NULL),
+        change_table(NULL),
+        committing(false),
+        slow_threshold(0),
+        slow_capturing(false),
+        busy_timeout(1000),
+        busy_retry(false),
+        busy_retries(0),
+        busy_timeouts(0),
+        exec_yield(false),
+        checkpointer(NULL),
+        backups(0),
+        closing(NULL),
+        external_memory(0),
+        lookaside(NULL) {
+        NODE_SQLITE3_MUTEX_INIT
     }
 
     ~Database() {
         RemoveCallbacks();
-        sqlite3_close(_handle);
+        StopCheckpointer();
+        if (sqlite3_close(_handle) == SQLITE_OK) {
+            ReleaseLookaside();
+            ReleaseImage();
+            ReleaseFunctions();
+        }
         _handle = NULL;
         open = false;
+        ClearSlowQueries();
+        NODE_SQLITE3_MUTEX_DESTROY
     }
 
     static NAN_METHOD(New);
+    static bool ParseOpenOptions(Local<Object> object, OpenOptions& options, std::string& error);
     static void Work_BeginOpen(Baton* baton);
     static void Work_Open(uv_work_t* req);
     static void Work_AfterOpen(uv_work_t* req);
@@ -134,6 +316,14 @@ protected:
     static void Work_Exec(uv_work_t* req);
     static void Work_AfterExec(uv_work_t* req);
 
+    static void Work_BeginCheckpointer(Baton* baton);
+    static void Work_Checkpointer(uv_work_t* req);
+    static void Work_AfterCheckpointer(uv_work_t* req);
+    // Goes back to automatic checkpoints. Returns the checkpointer, which
+    // waits for its checkpoint in progress when it is deleted.
+    Checkpointer* DetachCheckpointer();
+    void StopCheckpointer();
+
     static NAN_METHOD(Wait);
     static void Work_Wait(Baton* baton);
 
@@ -147,12 +337,36 @@ protected:
     static void Work_LoadExtension(uv_work_t* req);
     static void Work_AfterLoadExtension(uv_work_t* req);
 
+    static NAN_METHOD(Backup);
+    static void Work_BeginBackup(Baton* baton);
+    static void ScheduleBackupStep(BackupBaton* baton);
+    static void Work_Backup(uv_work_t* req);
+    static void Work_AfterBackup(uv_work_t* req);
+    static void BackupTimer(uv_timer_t* handle, int status);
+    static void BackupClosed(uv_handle_t* handle);
+
+    static NAN_METHOD(ToBuffer);
+    static void Work_BeginToBuffer(Baton* baton);
+    static void Work_ToBuffer(uv_work_t* req);
+    static void Work_AfterToBuffer(uv_work_t* req);
+    static void FreeImage(char* data, void* hint);
+
+    static NAN_METHOD(CreateFunction);
+    static void RegisterFunction(Baton* baton);
+
     static NAN_METHOD(Serialize);
     static NAN_METHOD(Parallelize);
 
     static NAN_METHOD(Configure);
+    // Whether option is one of the ResultOptions accepted by configure().
+    static bool IsResultOption(Handle<Value> option);
+    // Applies such an option. Returns false with a message for invalid
+    // values.
+    static bool ConfigureResults(ResultOptions& options, Handle<Value> option,
+        Handle<Value> value, std::string& error);
 
     static void SetBusyTimeout(Baton* baton);
+    static void SetBusyPolicy(Baton* baton);
 
     static void RegisterTraceCallback(Baton* baton);
     static void TraceCallback(void* db, const char* sql);
@@ -162,11 +376,38 @@ protected:
     static void ProfileCallback(void* db, const char* sql, sqlite3_uint64 nsecs);
     static void ProfileCallback(Database* db, ProfileInfo* info);
 
+    static void SetSlowQuery(Baton* baton);
+    static NAN_METHOD(SlowQueries);
+    static NAN_METHOD(Metrics);
+    void CaptureSlowQueries(sqlite3_stmt* stmt, const std::vector<Values::Field*>* parameters);
+    // Reports memory held by native result rows to V8, so that it collects
+    // garbage sooner while large results are around.
+    void AdjustExternalMemory(int64_t change);
+    void ClearSlowQueries();
+
     static void RegisterUpdateCallback(Baton* baton);
     static void UpdateCallback(void* db, int type, const char* database, const char* table, sqlite3_int64 rowid);
     static void UpdateCallback(Database* db, UpdateInfo* info);
 
+    static void RegisterChangesCallback(Baton* baton);
+    static int CommitCallback(void* db);
+    static void RollbackCallback(void* db);
+    static void ChangesCallback(Database* db, ChangeSet* changes);
+    void DeliverChanges();
+    void ClearPendingChanges();
+
     void RemoveCallbacks();
+    void ReleaseLookaside();
+    void ReleaseImage();
+    void ReleaseFunctions();
+
+    bool WaitForUnlock(int status, UnlockWait& wait);
+    static void RetryWhenUnlocked(UnlockWait& wait, Requeue_Callback callback, void* baton);
+    static void BusyTimer(uv_timer_t* handle, int status);
+    static void BusyClosed(uv_handle_t* handle);
+    static void RetryExec(void* baton);
+    static void UnlockNotify(void** args, int count);
+    static void AsyncUnlock(uv_async_t* handle, int status);
 
 protected:
     sqlite3* _handle;
@@ -182,6 +423,72 @@ protected:
     AsyncTrace* debug_trace;
     AsyncProfile* debug_profile;
     AsyncUpdate* update_event;
+
+    // Batched change feed. The pending changes of the current transaction
+    // are only accessed while holding the sqlite3_db_mutex; the last table
+    // is cached to avoid a map lookup for every modified row.
+    AsyncChanges* change_feed;
+    ChangeSet pending_changes;
+    std::string change_database;
+    std::string change_table_name;
+    ChangeTable* change_table;
+    // Set by the commit hook until the commit is done, see DeliverChanges().
+    bool committing;
+
+    // Statements slower than this many milliseconds are recorded in the
+    // slow query log; 0 disables it.
+    int slow_threshold;
+    bool slow_capturing;
+    // Under the "retry" busy policy, work that fails with SQLITE_BUSY runs
+    // again on a timer until it has waited busy_timeout milliseconds,
+    // instead of sleeping in the busy handler on the thread pool.
+    int busy_timeout;
+    bool busy_retry;
+    // Retries and calls that ran out of time, protected by mutex.
+    unsigned int busy_retries;
+    unsigned int busy_timeouts;
+    // Defaults for statements that don't set their own. Only used on the
+    // main thread; queries copy them when they start.
+    ResultOptions result_options;
+    // Whether exec() lets other work run between the statements of a
+    // script.
+    bool exec_yield;
+    // Checkpoints the WAL in the background when set. Only changed on the
+    // main thread while no other work runs.
+    Checkpointer* checkpointer;
+    // VFS the database was opened with; empty for the default.
+    std::string vfs;
+
+    // Backups that have started and not finished yet. close() waits for
+    // them in closing, counted as pending work so that nothing else runs.
+    unsigned int backups;
+    CloseBaton* closing;
+
+    // Bytes of result rows currently reported to V8 as external memory.
+    // Only used on the main thread.
+    int64_t external_memory;
+    // Only accessed while holding the sqlite3_db_mutex.
+    std::vector<SlowQueryInfo*> slow_pending;
+    // Bounded ring of captured slow queries, protected by mutex.
+    std::deque<SlowQueryInfo*> slow_queries;
+    NODE_SQLITE3_MUTEX_t
+
+    // Lookaside buffer from the page cache arena, if any.
+    void* lookaside;
+
+    // Memory VFS image the database was opened from, if any, and the Buffer
+    // holding its memory when the image is used in place.
+    std::string image;
+    Persistent<Object> image_buffer;
+
+    // SQL functions implemented in JavaScript; only accessed from the main
+    // thread.
+    std::vector<UserFunction*> functions;
+
+    // Work of all databases waiting for a shared-cache table lock; only
+    // accessed from the main thread.
+    static std::vector<LockedCall> locked_calls;
+    static uv_async_t unlock_watcher;
 };
 
 }
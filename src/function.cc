@@ -0,0 +1,427 @@
+#include <string.h>
+#include <map>
+#include <node.h>
+#include <node_buffer.h>
+
+#include "macros.h"
+#include "function.h"
+
+using namespace node_sqlite3;
+
+// Number of rows an aggregate collects before it hands them to the main
+// thread.
+#define AGGREGATE_BATCH_SIZE 1024
+
+std::vector<UserFunction::Call*> UserFunction::calls;
+uv_mutex_t UserFunction::mutex;
+uv_cond_t UserFunction::condition;
+uv_async_t UserFunction::watcher;
+
+namespace {
+
+Local<Value> FieldToJS(Values::Field* field) {
+    switch (field->type) {
+        case SQLITE_INTEGER:
+            return NanNew<Number>(((Values::Integer*)field)->value);
+        case SQLITE_FLOAT:
+            return NanNew<Number>(((Values::Float*)field)->value);
+        case SQLITE_TEXT:
+            return ((Values::Text*)field)->ToJS();
+        case SQLITE_BLOB:
+            return NanNew(NanNewBufferHandle(((Values::Blob*)field)->value,
+                ((Values::Blob*)field)->length));
+        default:
+            return NanNew(NanNull());
+    }
+}
+
+Local<Array> RowToArray(Row* row) {
+    Local<Array> array(NanNew<Array>(row->size()));
+    for (unsigned int i = 0; i < row->size(); i++) {
+        array->Set(i, FieldToJS((*row)[i]));
+    }
+    return array;
+}
+
+// Returns NULL for values SQLite can't store.
+Values::Field* ValueToField(Handle<Value> source) {
+    if (source->IsString()) {
+        String::Utf8Value val(source->ToString());
+        return new Values::Text(0, val.length(), *val);
+    }
+    else if (source->IsInt32()) {
+        return new Values::Integer(0, source->Int32Value());
+    }
+    else if (source->IsNumber() || source->IsDate()) {
+        return new Values::Float(0, source->NumberValue());
+    }
+    else if (source->IsBoolean()) {
+        return new Values::Integer(0, source->BooleanValue() ? 1 : 0);
+    }
+    else if (source->IsNull() || source->IsUndefined()) {
+        return new Values::Null((unsigned short)0);
+    }
+    else if (Buffer::HasInstance(source)) {
+        Local<Object> buffer = source->ToObject();
+        return new Values::Blob(0, Buffer::Length(buffer), Buffer::Data(buffer));
+    }
+    else {
+        return NULL;
+    }
+}
+
+// Calls the function and returns false with the error message if it threw.
+bool Invoke(Handle<Function> function, std::vector<Local<Value> >& argv,
+        Local<Value>& value, std::string& error) {
+    TryCatch try_catch;
+    value = function->Call(NanGetCurrentContext()->Global(), argv.size(),
+        argv.empty() ? NULL : &argv[0]);
+    if (try_catch.HasCaught()) {
+        String::Utf8Value message(try_catch.Exception());
+        error = *message ? *message : "Function threw an exception";
+        return false;
+    }
+    return true;
+}
+
+}
+
+void UserFunction::Init() {
+    uv_mutex_init(&mutex);
+    uv_cond_init(&condition);
+    // Workers waiting for a call keep the loop alive with their work.
+    uv_async_init(uv_default_loop(), &watcher,
+        reinterpret_cast<uv_async_cb>(AsyncCall));
+    uv_unref((uv_handle_t*)&watcher);
+}
+
+UserFunction::~UserFunction() {
+    NanDisposePersistent(function);
+    NanDisposePersistent(start);
+    NanDisposePersistent(step);
+    NanDisposePersistent(result);
+}
+
+bool UserFunction::Assign(Handle<Value> implementation, std::string& error) {
+    if (implementation->IsFunction()) {
+        aggregate = false;
+        NanAssignPersistent(function, implementation.As<Function>());
+        return true;
+    }
+    if (!implementation->IsObject()) {
+        error = "Function or aggregate object expected";
+        return false;
+    }
+
+    Local<Object> object = implementation.As<Object>();
+    Local<Value> step_value = object->Get(NanNew("step"));
+    Local<Value> result_value = object->Get(NanNew("result"));
+    if (!step_value->IsFunction()) {
+        error = "Aggregate step must be a function";
+        return false;
+    }
+    if (!result_value->IsUndefined() && !result_value->IsFunction()) {
+        error = "Aggregate result must be a function";
+        return false;
+    }
+
+    aggregate = true;
+    NanAssignPersistent(start, object->Get(NanNew("start")));
+    NanAssignPersistent(step, step_value.As<Function>());
+    if (result_value->IsFunction()) {
+        NanAssignPersistent(result, result_value.As<Function>());
+    }
+    return true;
+}
+
+UserFunction::Call::~Call() {
+    for (unsigned int i = 0; i < rows.size(); i++) {
+        Row* row = rows[i];
+        for (unsigned int j = 0; j < row->size(); j++) {
+            DELETE_FIELD((*row)[j]);
+        }
+        delete row;
+    }
+    DELETE_FIELD(result);
+}
+
+Row* UserFunction::GetArguments(int argc, sqlite3_value** argv) {
+    Row* row = new Row();
+    for (int i = 0; i < argc; i++) {
+        sqlite3_value* value = argv[i];
+        switch (sqlite3_value_type(value)) {
+            case SQLITE_INTEGER: {
+                row->push_back(new Values::Integer(i, sqlite3_value_int64(value)));
+            }   break;
+            case SQLITE_FLOAT: {
+                row->push_back(new Values::Float(i, sqlite3_value_double(value)));
+            }   break;
+            case SQLITE_TEXT: {
+                const char* text = (const char*)sqlite3_value_text(value);
+                int length = sqlite3_value_bytes(value);
+                Values::Text* field = new Values::Text(i, length, text);
+                field->Narrow();
+                row->push_back(field);
+            }   break;
+            case SQLITE_BLOB: {
+                const void* blob = sqlite3_value_blob(value);
+                int length = sqlite3_value_bytes(value);
+                row->push_back(new Values::Blob(i, length, blob));
+            }   break;
+            default: {
+                row->push_back(new Values::Null(i));
+            }   break;
+        }
+    }
+    return row;
+}
+
+void UserFunction::SetResult(sqlite3_context* context, Call* call) {
+    if (!call->error.empty()) {
+        sqlite3_result_error(context, call->error.c_str(), call->error.size());
+        return;
+    }
+
+    Values::Field* field = call->result;
+    switch (field ? field->type : SQLITE_NULL) {
+        case SQLITE_INTEGER: {
+            sqlite3_result_int64(context, ((Values::Integer*)field)->value);
+        } break;
+        case SQLITE_FLOAT: {
+            sqlite3_result_double(context, ((Values::Float*)field)->value);
+        } break;
+        case SQLITE_TEXT: {
+            Values::Text* text = (Values::Text*)field;
+            sqlite3_result_text(context, text->value.c_str(),
+                text->value.size(), SQLITE_TRANSIENT);
+        } break;
+        case SQLITE_BLOB: {
+            Values::Blob* blob = (Values::Blob*)field;
+            sqlite3_result_blob(context, blob->value, blob->length, SQLITE_TRANSIENT);
+        } break;
+        default: {
+            sqlite3_result_null(context);
+        } break;
+    }
+}
+
+void UserFunction::Scalar(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    // Note: This function is called in the thread pool.
+    Call call((UserFunction*)sqlite3_user_data(context), CALL_SCALAR);
+    call.rows.push_back(GetArguments(argc, argv));
+    Dispatch(&call);
+    SetResult(context, &call);
+}
+
+void UserFunction::Step(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    // Note: This function is called in the thread pool.
+    AggregateState** state = (AggregateState**)
+        sqlite3_aggregate_context(context, sizeof(AggregateState*));
+    if (state == NULL) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    if (*state == NULL) *state = new AggregateState();
+    if ((*state)->failed) return;
+
+    (*state)->rows.push_back(GetArguments(argc, argv));
+    if ((*state)->rows.size() < AGGREGATE_BATCH_SIZE) return;
+
+    Call call((UserFunction*)sqlite3_user_data(context), CALL_STEP);
+    call.state = *state;
+    call.rows.swap((*state)->rows);
+    Dispatch(&call);
+    if (!call.error.empty()) {
+        SetResult(context, &call);
+    }
+}
+
+void UserFunction::Final(sqlite3_context* context) {
+    // Note: This function is called in the thread pool.
+    AggregateState** state = (AggregateState**)sqlite3_aggregate_context(context, 0);
+    AggregateState empty;
+
+    Call call((UserFunction*)sqlite3_user_data(context), CALL_FINAL);
+    call.state = (state && *state) ? *state : &empty;
+    call.rows.swap(call.state->rows);
+    // A failed step already reported its error and released the state.
+    if (!call.state->failed) {
+        Dispatch(&call);
+        SetResult(context, &call);
+    }
+
+    if (call.state != &empty) delete call.state;
+}
+
+void UserFunction::Dispatch(Call* call) {
+    uv_mutex_lock(&mutex);
+    calls.push_back(call);
+    uv_mutex_unlock(&mutex);
+    uv_async_send(&watcher);
+
+    uv_mutex_lock(&mutex);
+    while (!call->done) {
+        uv_cond_wait(&condition, &mutex);
+    }
+    uv_mutex_unlock(&mutex);
+}
+
+void UserFunction::AsyncCall(uv_async_t* handle, int status) {
+    NanScope();
+
+    std::vector<Call*> pending;
+    uv_mutex_lock(&mutex);
+    pending.swap(calls);
+    uv_mutex_unlock(&mutex);
+
+    // Calls of batched functions are run together, one batch per JavaScript
+    // function. A connection only runs one call at a time, so the calls of
+    // a batch come from different connections, each with a UserFunction of
+    // its own.
+    std::vector<std::vector<Call*> > batches;
+    for (unsigned int i = 0; i < pending.size(); i++) {
+        Call* call = pending[i];
+        if (call->type != CALL_SCALAR) {
+            call->function->RunAggregate(call);
+        }
+        else if (call->function->batch) {
+            Local<Function> function = NanNew(call->function->function);
+            unsigned int j = 0;
+            while (j < batches.size() &&
+                    !NanNew(batches[j][0]->function->function)->StrictEquals(function)) {
+                j++;
+            }
+            if (j == batches.size()) batches.push_back(std::vector<Call*>());
+            batches[j].push_back(call);
+        }
+        else {
+            call->function->RunScalar(call);
+        }
+    }
+
+    for (unsigned int j = 0; j < batches.size(); j++) {
+        batches[j][0]->function->RunBatch(batches[j]);
+    }
+
+    // The calls live on the stacks of the waiting workers, so they must not
+    // be touched once they are done.
+    uv_mutex_lock(&mutex);
+    for (unsigned int i = 0; i < pending.size(); i++) {
+        pending[i]->done = true;
+    }
+    uv_cond_broadcast(&condition);
+    uv_mutex_unlock(&mutex);
+}
+
+void UserFunction::RunScalar(Call* call) {
+    Row* row = call->rows[0];
+    std::vector<Local<Value> > argv;
+    for (unsigned int i = 0; i < row->size(); i++) {
+        argv.push_back(FieldToJS((*row)[i]));
+    }
+
+    Local<Value> value;
+    if (!Invoke(NanNew(function), argv, value, call->error)) return;
+
+    call->result = ValueToField(value);
+    if (call->result == NULL) {
+        call->error = "Unsupported result type of function " + name;
+    }
+}
+
+void UserFunction::RunBatch(std::vector<Call*>& batch_calls) {
+    Local<Array> arguments(NanNew<Array>(batch_calls.size()));
+    for (unsigned int i = 0; i < batch_calls.size(); i++) {
+        arguments->Set(i, RowToArray(batch_calls[i]->rows[0]));
+    }
+
+    std::vector<Local<Value> > argv(1, arguments);
+    Local<Value> value;
+    std::string error;
+    if (Invoke(NanNew(function), argv, value, error)) {
+        if (!value->IsArray() ||
+                value.As<Array>()->Length() != batch_calls.size()) {
+            error = "Batched function " + name +
+                " must return an array with a result for every call";
+        }
+    }
+
+    for (unsigned int i = 0; i < batch_calls.size(); i++) {
+        Call* call = batch_calls[i];
+        if (!error.empty()) {
+            call->error = error;
+            continue;
+        }
+        call->result = ValueToField(value.As<Array>()->Get(i));
+        if (call->result == NULL) {
+            call->error = "Unsupported result type of function " + name;
+        }
+    }
+}
+
+void UserFunction::RunAggregate(Call* call) {
+    AggregateState* state = call->state;
+
+    Local<Value> accumulator;
+    if (!state->started) {
+        Local<Value> initial = NanNew(start);
+        std::vector<Local<Value> > none;
+        if (initial->IsFunction()) {
+            if (!Invoke(initial.As<Function>(), none, accumulator, call->error)) {
+                state->failed = true;
+                return;
+            }
+        }
+        else {
+            accumulator = initial;
+        }
+        state->started = true;
+    }
+    else {
+        accumulator = NanNew(state->accumulator);
+        NanDisposePersistent(state->accumulator);
+    }
+
+    // Batched aggregates get all collected rows at once.
+    Local<Function> step_function = NanNew(step);
+    if (batch && !call->rows.empty()) {
+        Local<Array> rows(NanNew<Array>(call->rows.size()));
+        for (unsigned int i = 0; i < call->rows.size(); i++) {
+            rows->Set(i, RowToArray(call->rows[i]));
+        }
+        std::vector<Local<Value> > argv;
+        argv.push_back(accumulator);
+        argv.push_back(rows);
+        if (!Invoke(step_function, argv, accumulator, call->error)) {
+            state->failed = true;
+            return;
+        }
+    }
+    else for (unsigned int i = 0; i < call->rows.size(); i++) {
+        Row* row = call->rows[i];
+        std::vector<Local<Value> > argv;
+        argv.push_back(accumulator);
+        for (unsigned int j = 0; j < row->size(); j++) {
+            argv.push_back(FieldToJS((*row)[j]));
+        }
+        if (!Invoke(step_function, argv, accumulator, call->error)) {
+            state->failed = true;
+            return;
+        }
+    }
+
+    if (call->type == CALL_STEP) {
+        NanAssignPersistent(state->accumulator, accumulator);
+        return;
+    }
+
+    Local<Value> value = accumulator;
+    if (!result.IsEmpty()) {
+        std::vector<Local<Value> > argv(1, accumulator);
+        if (!Invoke(NanNew(result), argv, value, call->error)) return;
+    }
+    call->result = ValueToField(value);
+    if (call->result == NULL) {
+        call->error = "Unsupported result type of aggregate " + name;
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef NODE_SQLITE3_SRC_FUNCTION_H
+#define NODE_SQLITE3_SRC_FUNCTION_H
+
+#include <node.h>
+
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+#include "nan.h"
+#include "statement.h"
+
+using namespace v8;
+using namespace node;
+
+namespace node_sqlite3 {
+
+// SQL function implemented in JavaScript. SQLite calls it on the thread pool
+// while the JavaScript function has to run on the main thread, so every
+// call is handed to the main thread and the worker waits for the result.
+// To make the handoff cheaper, all calls waiting at the same time are run
+// in one go: calls of batched scalar functions are passed to a single
+// invocation as an array of argument lists, and aggregates collect rows on
+// the worker and hand them over in chunks.
+class UserFunction {
+public:
+    static void Init();
+
+    UserFunction(const char* name_, bool batch_) : name(name_), batch(batch_) {}
+    ~UserFunction();
+
+    // Takes either a function for a scalar function or an object with
+    // start, step and result members for an aggregate.
+    bool Assign(Handle<Value> implementation, std::string& error);
+    bool IsAggregate() { return aggregate; }
+
+    // Callbacks for sqlite3_create_function(); called on the thread pool.
+    static void Scalar(sqlite3_context* context, int argc, sqlite3_value** argv);
+    static void Step(sqlite3_context* context, int argc, sqlite3_value** argv);
+    static void Final(sqlite3_context* context);
+
+    std::string name;
+
+protected:
+    enum CallType { CALL_SCALAR, CALL_STEP, CALL_FINAL };
+
+    // State of one group of an aggregate. The accumulator is only touched
+    // on the main thread.
+    struct AggregateState {
+        AggregateState() : started(false), failed(false) {}
+        Rows rows;
+        Persistent<Value> accumulator;
+        bool started;
+        bool failed;
+    };
+
+    struct Call {
+        Call(UserFunction* function_, CallType type_) :
+            function(function_), type(type_), state(NULL), result(NULL),
+            done(false) {}
+        ~Call();
+
+        UserFunction* function;
+        CallType type;
+        Rows rows;
+        AggregateState* state;
+        Values::Field* result;
+        std::string error;
+        bool done;
+    };
+
+    static Row* GetArguments(int argc, sqlite3_value** argv);
+    static void SetResult(sqlite3_context* context, Call* call);
+    static void Dispatch(Call* call);
+    static void AsyncCall(uv_async_t* handle, int status);
+
+    void RunScalar(Call* call);
+    void RunBatch(std::vector<Call*>& calls);
+    void RunAggregate(Call* call);
+
+    bool batch;
+    bool aggregate;
+    Persistent<Function> function;
+    Persistent<Value> start;
+    Persistent<Function> step;
+    Persistent<Function> result;
+
+    // Calls waiting for the main thread, protected by mutex. Workers wait
+    // on the condition until their call is done.
+    static std::vector<Call*> calls;
+    static uv_mutex_t mutex;
+    static uv_cond_t condition;
+    static uv_async_t watcher;
+};
+
+}
+
+#endif
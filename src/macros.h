@@ -119,8 +119,8 @@ const char* sqlite_authorizer_string(int type);
     assert(baton->stmt->prepared);                                             \
     baton->stmt->locked = true;                                                \
     baton->stmt->db->pending++;                                                \
-    int status = uv_queue_work(uv_default_loop(),                              \
-        &baton->request, Work_##type, (uv_after_work_cb)Work_After##type);                       \
+    int status = Timeline::Queue(baton, "Statement." #type,                    \
+        sqlite3_sql(baton->stmt->_handle), Work_##type, Work_After##type);     \
     assert(status == 0);
 
 #define STATEMENT_INIT(type)                                                   \
@@ -136,6 +136,31 @@ const char* sqlite_authorizer_string(int type);
     stmt->db->Process();                                                       \
     delete baton;
 
+#define BLOB_BEGIN(type)                                                       \
+    assert(baton);                                                             \
+    assert(baton->blob);                                                       \
+    assert(!baton->blob->locked);                                              \
+    assert(!baton->blob->closed);                                              \
+    assert(baton->blob->opened);                                               \
+    baton->blob->locked = true;                                                \
+    baton->blob->db->pending++;                                                \
+    int status = Timeline::Queue(baton, "Blob." #type, NULL,                   \
+        Work_##type, Work_After##type);                                        \
+    assert(status == 0);
+
+#define BLOB_INIT(type)                                                        \
+    type* baton = static_cast<type*>(req->data);                               \
+    Blob* blob = baton->blob;
+
+#define BLOB_END()                                                             \
+    assert(blob->locked);                                                      \
+    assert(blob->db->pending);                                                 \
+    blob->locked = false;                                                      \
+    blob->db->pending--;                                                       \
+    blob->Process();                                                           \
+    blob->db->Process();                                                       \
+    delete baton;
+
 #define DELETE_FIELD(field)                                                    \
     if (field != NULL) {                                                       \
         switch ((field)->type) {                                               \
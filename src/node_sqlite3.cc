@@ -2,6 +2,7 @@
 #include <node_buffer.h>
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <sstream>
 #include <cstring>
 #include <string>
@@ -10,24 +11,155 @@
 #include "macros.h"
 #include "database.h"
 #include "statement.h"
+#include "blob.h"
+#include "function.h"
+#include "vector.h"
+#include "timeline.h"
+#include "allocator.h"
+#include "arena.h"
+#ifdef NODE_SQLITE3_IO_URING
+#include "vfs_io_uring.h"
+#endif
 
 using namespace node_sqlite3;
 
 namespace {
 
+NAN_METHOD(MemoryStats) {
+    NanScope();
+
+    Local<Object> result(NanNew<Object>());
+    result->Set(NanNew("allocator"), NanNew(Allocator::IsInstalled() ? "pool" : "system"));
+    result->Set(NanNew("used"), NanNew<Number>(sqlite3_memory_used()));
+    result->Set(NanNew("highwater"), NanNew<Number>(sqlite3_memory_highwater(0)));
+
+    if (Allocator::IsInstalled()) {
+        Allocator::Stats stats;
+        Allocator::GetStats(&stats);
+        result->Set(NanNew("allocated"), NanNew<Number>(stats.allocated));
+        result->Set(NanNew("reserved"), NanNew<Number>(stats.reserved));
+        result->Set(NanNew("large"), NanNew<Number>(stats.large));
+        result->Set(NanNew("allocations"), NanNew<Number>(stats.allocations));
+        result->Set(NanNew("cacheHits"), NanNew<Number>(stats.cache_hits));
+        result->Set(NanNew("refills"), NanNew<Number>(stats.refills));
+    }
+
+    if (Arena::IsConfigured()) {
+        Arena::Stats stats;
+        Arena::GetStats(&stats);
+        int used = 0, overflow = 0, highwater = 0;
+        Local<Object> cache(NanNew<Object>());
+        cache->Set(NanNew("size"), NanNew<Number>(stats.size));
+        cache->Set(NanNew("hugePages"), NanNew<Boolean>(stats.huge_pages));
+        sqlite3_status(SQLITE_STATUS_PAGECACHE_USED, &used, &highwater, 0);
+        cache->Set(NanNew("pagesUsed"), NanNew<Integer>(used));
+        cache->Set(NanNew("pagesHighwater"), NanNew<Integer>(highwater));
+        sqlite3_status(SQLITE_STATUS_PAGECACHE_OVERFLOW, &overflow, &highwater, 0);
+        cache->Set(NanNew("overflow"), NanNew<Number>(overflow));
+        cache->Set(NanNew("lookasideFree"), NanNew<Integer>(stats.lookaside_free));
+        cache->Set(NanNew("lookasideUsed"), NanNew<Integer>(stats.connections - stats.lookaside_free));
+        result->Set(NanNew("pageCache"), cache);
+    }
+
+    NanReturnValue(result);
+}
+
+// Reads an optional non-negative integer option; returns false if the value
+// is present but invalid.
+bool GetOption(Local<Object> options, const char* name, int* value) {
+    Local<Value> option = options->Get(NanNew(name));
+    if (option->IsUndefined()) return true;
+    if (!option->IsInt32() || option->Int32Value() < 0) return false;
+    *value = option->Int32Value();
+    return true;
+}
+
+NAN_METHOD(ConfigurePageCache) {
+    NanScope();
+
+    if (args.Length() < 1 || !args[0]->IsObject()) {
+        return NanThrowTypeError("Options object expected");
+    }
+    Local<Object> options = args[0].As<Object>();
+
+    Arena::Options arena;
+    if (!GetOption(options, "pageSize", &arena.page_size) ||
+            !GetOption(options, "headerSize", &arena.header_size) ||
+            !GetOption(options, "pages", &arena.pages) ||
+            !GetOption(options, "lookasideSize", &arena.lookaside_size) ||
+            !GetOption(options, "lookasideSlots", &arena.lookaside_slots) ||
+            !GetOption(options, "connections", &arena.connections)) {
+        return NanThrowTypeError("Page cache options must be non-negative integers");
+    }
+    arena.huge_pages = options->Get(NanNew("hugePages"))->BooleanValue();
+    if (arena.lookaside_size > 0 && arena.lookaside_slots > 0 && arena.connections == 0) {
+        arena.connections = 1;
+    }
+
+    std::string message;
+    int status = Arena::Configure(arena, message);
+    if (status != SQLITE_OK) {
+        EXCEPTION(NanNew<String>(message.c_str()), status, exception);
+        return NanThrowError(exception);
+    }
+
+    NanReturnUndefined();
+}
+
+NAN_METHOD(EnableSharedCache) {
+    NanScope();
+
+    bool enable = args.Length() < 1 || args[0]->BooleanValue();
+    int status = sqlite3_enable_shared_cache(enable);
+    if (status != SQLITE_OK) {
+        EXCEPTION(NanNew("Unable to change the shared cache mode"), status, exception);
+        return NanThrowError(exception);
+    }
+
+    NanReturnUndefined();
+}
+
 void RegisterModule(v8::Handle<Object> target) {
     NanScope();
+
+    // The allocator has to be chosen before SQLite initializes itself, i.e.
+    // before the first database is opened.
+    const char* allocator = getenv("NODE_SQLITE3_MALLOC");
+    if (allocator != NULL && strcmp(allocator, "pool") == 0) {
+        Allocator::Install();
+    }
+
     Database::Init(target);
     Statement::Init(target);
+    Blob::Init(target);
+    UserFunction::Init();
+    VectorFunctions::Init();
+    Timeline::Init(target);
+
+    NODE_SET_METHOD(target, "memoryStats", MemoryStats);
+    NODE_SET_METHOD(target, "configurePageCache", ConfigurePageCache);
+    NODE_SET_METHOD(target, "enableSharedCache", EnableSharedCache);
 
     DEFINE_CONSTANT_INTEGER(target, SQLITE_OPEN_READONLY, OPEN_READONLY);
     DEFINE_CONSTANT_INTEGER(target, SQLITE_OPEN_READWRITE, OPEN_READWRITE);
     DEFINE_CONSTANT_INTEGER(target, SQLITE_OPEN_CREATE, OPEN_CREATE);
+    DEFINE_CONSTANT_INTEGER(target, SQLITE_OPEN_URI, OPEN_URI);
+    DEFINE_CONSTANT_INTEGER(target, SQLITE_OPEN_FULLMUTEX, OPEN_FULLMUTEX);
+    DEFINE_CONSTANT_INTEGER(target, SQLITE_OPEN_SHAREDCACHE, OPEN_SHAREDCACHE);
+    DEFINE_CONSTANT_INTEGER(target, SQLITE_OPEN_PRIVATECACHE, OPEN_PRIVATECACHE);
     DEFINE_CONSTANT_STRING(target, SQLITE_VERSION, VERSION);
 #ifdef SQLITE_SOURCE_ID
     DEFINE_CONSTANT_STRING(target, SQLITE_SOURCE_ID, SOURCE_ID);
 #endif
     DEFINE_CONSTANT_INTEGER(target, SQLITE_VERSION_NUMBER, VERSION_NUMBER);
+    // Kernels used by the vector functions: "avx2", "sse" or "scalar".
+    DEFINE_CONSTANT_STRING(target, VectorFunctions::Kernel(), VECTOR_KERNEL);
+#ifdef NODE_SQLITE3_IO_URING
+    // Whether the io_uring VFS actually uses io_uring; it falls back to
+    // the unix VFS otherwise.
+    (target)->ForceSet(NanNew("IO_URING"), NanNew<Boolean>(IoUringVfs::IsAvailable()),
+        static_cast<PropertyAttribute>(ReadOnly | DontDelete));
+#endif
 
     DEFINE_CONSTANT_INTEGER(target, SQLITE_OK, OK);
     DEFINE_CONSTANT_INTEGER(target, SQLITE_ERROR, ERROR);
@@ -0,0 +1,452 @@
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "sketch.h"
+
+using namespace node_sqlite3;
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+
+// Bounds the number of centroids of a t-digest to about this many; higher
+// values are more accurate and use more memory.
+const double COMPRESSION = 100;
+// Number of values collected before they are merged into the centroids.
+const unsigned int TDIGEST_BUFFER_SIZE = 500;
+
+// HyperLogLog with 2^14 registers, which has a standard error of 0.8%.
+const int HLL_PRECISION = 14;
+const int HLL_REGISTERS = 1 << HLL_PRECISION;
+
+const char TDIGEST_MAGIC[4] = { 'T', 'D', 'G', '1' };
+const char HLL_MAGIC[4] = { 'H', 'L', 'L', '1' };
+
+struct Centroid {
+    double mean;
+    double weight;
+    bool operator<(const Centroid& other) const { return mean < other.mean; }
+};
+
+// Merging t-digest (Dunning & Ertl). Values are collected in a buffer and
+// merged into the sorted centroids in batches; centroids near the tails
+// are kept small so that extreme quantiles stay accurate.
+class TDigest {
+public:
+    TDigest() : quantile(-1), total(0), min(HUGE_VAL), max(-HUGE_VAL) {}
+
+    void Add(double value, double weight) {
+        Centroid centroid = { value, weight };
+        buffer.push_back(centroid);
+        total += weight;
+        if (value < min) min = value;
+        if (value > max) max = value;
+        if (buffer.size() >= TDIGEST_BUFFER_SIZE) Compress();
+    }
+
+    bool Merge(const unsigned char* data, int size);
+    std::string Serialize();
+    double Quantile(double q);
+
+    bool IsEmpty() { return total == 0; }
+
+    // Quantile requested from percentile_approx().
+    double quantile;
+
+protected:
+    void Compress();
+
+    std::vector<Centroid> centroids;
+    std::vector<Centroid> buffer;
+    double total;
+    double min;
+    double max;
+};
+
+// Returns the largest quantile a centroid starting at quantile q may
+// reach, using the scale function k(q) = d / 2pi * asin(2q - 1).
+double QuantileLimit(double q) {
+    double k = COMPRESSION / (2 * PI) * asin(2 * q - 1) + 1;
+    if (k >= COMPRESSION / 4) return 1;
+    return (sin(k * 2 * PI / COMPRESSION) + 1) / 2;
+}
+
+void TDigest::Compress() {
+    if (buffer.empty()) return;
+    buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+    std::sort(buffer.begin(), buffer.end());
+    centroids.clear();
+
+    double so_far = 0;
+    double limit = total * QuantileLimit(0);
+    Centroid current = buffer[0];
+    for (unsigned int i = 1; i < buffer.size(); i++) {
+        const Centroid& next = buffer[i];
+        if (so_far + current.weight + next.weight <= limit) {
+            current.weight += next.weight;
+            current.mean += (next.mean - current.mean) * next.weight / current.weight;
+        }
+        else {
+            so_far += current.weight;
+            centroids.push_back(current);
+            limit = total * QuantileLimit(so_far / total);
+            current = next;
+        }
+    }
+    centroids.push_back(current);
+    buffer.clear();
+}
+
+double TDigest::Quantile(double q) {
+    Compress();
+    unsigned int n = centroids.size();
+    if (n == 1 || q <= 0) return n == 1 ? centroids[0].mean : min;
+    if (q >= 1) return max;
+
+    // Interpolate between the centers of the centroids, and between the
+    // extreme values and the outermost centers.
+    double index = q * total;
+    double position = centroids[0].weight / 2;
+    if (index < position) {
+        return min + (centroids[0].mean - min) * index / position;
+    }
+    for (unsigned int i = 0; i + 1 < n; i++) {
+        double step = (centroids[i].weight + centroids[i + 1].weight) / 2;
+        if (index < position + step) {
+            double t = (index - position) / step;
+            return centroids[i].mean + (centroids[i + 1].mean - centroids[i].mean) * t;
+        }
+        position += step;
+    }
+    double rest = centroids[n - 1].weight / 2;
+    double t = std::min(1.0, (index - position) / rest);
+    return centroids[n - 1].mean + (max - centroids[n - 1].mean) * t;
+}
+
+// Layout: magic, centroid count (uint32), min, max, then mean and weight
+// of each centroid, all doubles.
+std::string TDigest::Serialize() {
+    Compress();
+    uint32_t count = centroids.size();
+    std::string data(TDIGEST_MAGIC, sizeof(TDIGEST_MAGIC));
+    data.append((const char*)&count, sizeof(count));
+    data.append((const char*)&min, sizeof(min));
+    data.append((const char*)&max, sizeof(max));
+    for (unsigned int i = 0; i < count; i++) {
+        data.append((const char*)&centroids[i].mean, sizeof(double));
+        data.append((const char*)&centroids[i].weight, sizeof(double));
+    }
+    return data;
+}
+
+bool TDigest::Merge(const unsigned char* data, int size) {
+    const int header = sizeof(TDIGEST_MAGIC) + sizeof(uint32_t) + 2 * sizeof(double);
+    uint32_t count;
+    if (size < header || memcmp(data, TDIGEST_MAGIC, sizeof(TDIGEST_MAGIC)) != 0) return false;
+    memcpy(&count, data + sizeof(TDIGEST_MAGIC), sizeof(count));
+    if ((size - header) / (2 * sizeof(double)) != count ||
+            (size - header) % (2 * sizeof(double)) != 0) {
+        return false;
+    }
+
+    double other_min, other_max;
+    memcpy(&other_min, data + sizeof(TDIGEST_MAGIC) + sizeof(count), sizeof(double));
+    memcpy(&other_max, data + sizeof(TDIGEST_MAGIC) + sizeof(count) + sizeof(double), sizeof(double));
+    const unsigned char* p = data + header;
+    for (uint32_t i = 0; i < count; i++, p += 2 * sizeof(double)) {
+        Centroid centroid;
+        memcpy(&centroid.mean, p, sizeof(double));
+        memcpy(&centroid.weight, p + sizeof(double), sizeof(double));
+        if (!(centroid.weight > 0)) return false;
+        Add(centroid.mean, centroid.weight);
+    }
+    if (count > 0) {
+        if (other_min < min) min = other_min;
+        if (other_max > max) max = other_max;
+    }
+    return true;
+}
+
+// MurmurHash64A by Austin Appleby.
+uint64_t Murmur64(const void* key, int length, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (length * m);
+
+    const unsigned char* data = (const unsigned char*)key;
+    const unsigned char* end = data + (length / 8) * 8;
+    for (; data != end; data += 8) {
+        uint64_t k;
+        memcpy(&k, data, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (length & 7) {
+        case 7: h ^= uint64_t(data[6]) << 48;
+        case 6: h ^= uint64_t(data[5]) << 40;
+        case 5: h ^= uint64_t(data[4]) << 32;
+        case 4: h ^= uint64_t(data[3]) << 24;
+        case 3: h ^= uint64_t(data[2]) << 16;
+        case 2: h ^= uint64_t(data[1]) << 8;
+        case 1: h ^= uint64_t(data[0]);
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+// Hashes a value so that values SQL considers equal hash the same, e.g.
+// 1 and 1.0.
+uint64_t HashValue(sqlite3_value* value) {
+    switch (sqlite3_value_type(value)) {
+        case SQLITE_INTEGER: {
+            sqlite3_int64 i = sqlite3_value_int64(value);
+            return Murmur64(&i, sizeof(i), 0);
+        }
+        case SQLITE_FLOAT: {
+            double d = sqlite3_value_double(value);
+            if (d >= -9223372036854775808.0 && d < 9223372036854775808.0 && d == floor(d)) {
+                sqlite3_int64 i = (sqlite3_int64)d;
+                return Murmur64(&i, sizeof(i), 0);
+            }
+            return Murmur64(&d, sizeof(d), 1);
+        }
+        case SQLITE_TEXT:
+            return Murmur64(sqlite3_value_text(value), sqlite3_value_bytes(value), 2);
+        default:
+            return Murmur64(sqlite3_value_blob(value), sqlite3_value_bytes(value), 3);
+    }
+}
+
+void HllAdd(unsigned char* registers, uint64_t hash) {
+    int index = hash >> (64 - HLL_PRECISION);
+    uint64_t rest = hash << HLL_PRECISION;
+    // Position of the first set bit in the remaining bits.
+    unsigned char rank = 1;
+    while (rank <= 64 - HLL_PRECISION && !(rest & (1ULL << 63))) {
+        rest <<= 1;
+        rank++;
+    }
+    if (rank > registers[index]) registers[index] = rank;
+}
+
+double HllEstimate(const unsigned char* registers) {
+    const double m = HLL_REGISTERS;
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        sum += ldexp(1.0, -registers[i]);
+        if (registers[i] == 0) zeros++;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    // Linear counting is more accurate for small cardinalities.
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros);
+    }
+    return estimate;
+}
+
+const unsigned char* GetHll(sqlite3_value* value) {
+    if (sqlite3_value_type(value) != SQLITE_BLOB ||
+            sqlite3_value_bytes(value) != (int)sizeof(HLL_MAGIC) + HLL_REGISTERS) {
+        return NULL;
+    }
+    const unsigned char* data = (const unsigned char*)sqlite3_value_blob(value);
+    if (memcmp(data, HLL_MAGIC, sizeof(HLL_MAGIC)) != 0) return NULL;
+    return data + sizeof(HLL_MAGIC);
+}
+
+void InvalidSketch(sqlite3_context* context) {
+    std::string error = std::string((const char*)sqlite3_user_data(context)) + ": invalid sketch";
+    sqlite3_result_error(context, error.c_str(), -1);
+}
+
+// Reads q; returns false and sets an error if it is out of range.
+bool GetQuantile(sqlite3_context* context, sqlite3_value* value, double* q) {
+    int type = sqlite3_value_numeric_type(value);
+    *q = sqlite3_value_double(value);
+    if ((type != SQLITE_INTEGER && type != SQLITE_FLOAT) || !(*q >= 0 && *q <= 1)) {
+        std::string error = std::string((const char*)sqlite3_user_data(context)) +
+            ": q must be between 0 and 1";
+        sqlite3_result_error(context, error.c_str(), -1);
+        return false;
+    }
+    return true;
+}
+
+// The t-digest aggregates keep a pointer to the digest in the aggregate
+// context; it is created with the first value.
+TDigest* GetTDigest(sqlite3_context* context, bool create) {
+    TDigest** state = (TDigest**)sqlite3_aggregate_context(context, create ? sizeof(TDigest*) : 0);
+    if (state == NULL) {
+        if (create) sqlite3_result_error_nomem(context);
+        return NULL;
+    }
+    if (*state == NULL && create) *state = new TDigest();
+    return *state;
+}
+
+void PercentileStep(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    TDigest* digest = GetTDigest(context, true);
+    if (digest == NULL) return;
+    if (digest->quantile < 0 && !GetQuantile(context, argv[1], &digest->quantile)) return;
+    digest->Add(sqlite3_value_double(argv[0]), 1);
+}
+
+void PercentileFinal(sqlite3_context* context) {
+    TDigest* digest = GetTDigest(context, false);
+    if (digest != NULL && !digest->IsEmpty() && digest->quantile >= 0) {
+        sqlite3_result_double(context, digest->Quantile(digest->quantile));
+    }
+    else {
+        sqlite3_result_null(context);
+    }
+    delete digest;
+}
+
+void TDigestStep(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    TDigest* digest = GetTDigest(context, true);
+    if (digest != NULL) digest->Add(sqlite3_value_double(argv[0]), 1);
+}
+
+void TDigestMergeStep(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    TDigest* digest = GetTDigest(context, true);
+    if (digest == NULL) return;
+    if (sqlite3_value_type(argv[0]) != SQLITE_BLOB || !digest->Merge(
+            (const unsigned char*)sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0]))) {
+        InvalidSketch(context);
+    }
+}
+
+void TDigestFinal(sqlite3_context* context) {
+    TDigest* digest = GetTDigest(context, false);
+    if (digest != NULL) {
+        std::string data = digest->Serialize();
+        sqlite3_result_blob(context, data.data(), data.size(), SQLITE_TRANSIENT);
+        delete digest;
+    }
+    else {
+        sqlite3_result_null(context);
+    }
+}
+
+void TDigestPercentile(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+        sqlite3_result_null(context);
+        return;
+    }
+    double q;
+    if (!GetQuantile(context, argv[1], &q)) return;
+    TDigest digest;
+    if (sqlite3_value_type(argv[0]) != SQLITE_BLOB || !digest.Merge(
+            (const unsigned char*)sqlite3_value_blob(argv[0]), sqlite3_value_bytes(argv[0]))) {
+        InvalidSketch(context);
+        return;
+    }
+    if (digest.IsEmpty()) sqlite3_result_null(context);
+    else sqlite3_result_double(context, digest.Quantile(q));
+}
+
+// The HyperLogLog registers live in the aggregate context itself, which
+// SQLite zeroes and frees.
+void HllStep(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    unsigned char* registers = (unsigned char*)sqlite3_aggregate_context(context, HLL_REGISTERS);
+    if (registers == NULL) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    HllAdd(registers, HashValue(argv[0]));
+}
+
+void HllMergeStep(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+    const unsigned char* other = GetHll(argv[0]);
+    if (other == NULL) {
+        InvalidSketch(context);
+        return;
+    }
+    unsigned char* registers = (unsigned char*)sqlite3_aggregate_context(context, HLL_REGISTERS);
+    if (registers == NULL) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        if (other[i] > registers[i]) registers[i] = other[i];
+    }
+}
+
+void CountDistinctFinal(sqlite3_context* context) {
+    unsigned char* registers = (unsigned char*)sqlite3_aggregate_context(context, 0);
+    sqlite3_result_int64(context, registers ? (sqlite3_int64)floor(HllEstimate(registers) + 0.5) : 0);
+}
+
+void HllFinal(sqlite3_context* context) {
+    unsigned char* registers = (unsigned char*)sqlite3_aggregate_context(context, 0);
+    if (registers == NULL) {
+        sqlite3_result_null(context);
+        return;
+    }
+    std::string data(HLL_MAGIC, sizeof(HLL_MAGIC));
+    data.append((const char*)registers, HLL_REGISTERS);
+    sqlite3_result_blob(context, data.data(), data.size(), SQLITE_TRANSIENT);
+}
+
+void HllCount(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+        sqlite3_result_null(context);
+        return;
+    }
+    const unsigned char* registers = GetHll(argv[0]);
+    if (registers == NULL) {
+        InvalidSketch(context);
+        return;
+    }
+    sqlite3_result_int64(context, (sqlite3_int64)floor(HllEstimate(registers) + 0.5));
+}
+
+struct Definition {
+    const char* name;
+    int arguments;
+    void (*function)(sqlite3_context*, int, sqlite3_value**);
+    void (*step)(sqlite3_context*, int, sqlite3_value**);
+    void (*final)(sqlite3_context*);
+};
+
+const Definition definitions[] = {
+    { "percentile_approx", 2, NULL, PercentileStep, PercentileFinal },
+    { "count_distinct_approx", 1, NULL, HllStep, CountDistinctFinal },
+    { "tdigest", 1, NULL, TDigestStep, TDigestFinal },
+    { "tdigest_merge", 1, NULL, TDigestMergeStep, TDigestFinal },
+    { "tdigest_percentile", 2, TDigestPercentile, NULL, NULL },
+    { "hll", 1, NULL, HllStep, HllFinal },
+    { "hll_merge", 1, NULL, HllMergeStep, HllFinal },
+    { "hll_count", 1, HllCount, NULL, NULL }
+};
+
+}
+
+int SketchFunctions::Register(sqlite3* db) {
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+    int status = SQLITE_OK;
+    for (unsigned int i = 0; status == SQLITE_OK && i < sizeof(definitions) / sizeof(*definitions); i++) {
+        const Definition& definition = definitions[i];
+        status = sqlite3_create_function(db, definition.name, definition.arguments, flags,
+            (void*)definition.name, definition.function, definition.step, definition.final);
+    }
+    return status;
+}
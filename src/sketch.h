@@ -0,0 +1,29 @@
+#ifndef NODE_SQLITE3_SRC_SKETCH_H
+#define NODE_SQLITE3_SRC_SKETCH_H
+
+#include <sqlite3.h>
+
+namespace node_sqlite3 {
+
+// Aggregates that estimate statistics in bounded memory:
+//   percentile_approx(x, q)    q-quantile of x, 0 <= q <= 1 (t-digest)
+//   count_distinct_approx(x)   number of distinct values of x (HyperLogLog)
+// The sketches behind them can be stored as BLOBs and merged later, e.g.
+// to roll up per-minute sketches into hourly ones:
+//   tdigest(x)                 t-digest sketch of x
+//   tdigest_merge(sketch)      union of t-digest sketches
+//   tdigest_percentile(sketch, q)
+//   hll(x)                     HyperLogLog sketch of x
+//   hll_merge(sketch)          union of HyperLogLog sketches
+//   hll_count(sketch)
+// NULL values are ignored. Sketches use the native byte order.
+class SketchFunctions {
+public:
+    // Registers the functions on the connection. Returns the SQLite result
+    // code.
+    static int Register(sqlite3* db);
+};
+
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "macros.h"
+#include "spill.h"
+
+using namespace node_sqlite3;
+
+namespace {
+
+template <class T> inline void Append(std::string& buffer, const T& value) {
+    buffer.append((const char*)&value, sizeof(value));
+}
+
+template <class T> inline bool ReadValue(FILE* file, T* value) {
+    return fread(value, sizeof(T), 1, file) == 1;
+}
+
+}
+
+RowSpill::~RowSpill() {
+    if (file != NULL) fclose(file);
+}
+
+bool RowSpill::Open() {
+    // The file is deleted as soon as it is closed.
+    file = tmpfile();
+    return file != NULL;
+}
+
+// Each value is written as its type, followed by the value for numbers or
+// the length and the bytes for texts and BLOBs. Texts also record whether
+// they were narrowed to Latin-1.
+bool RowSpill::Write(Row* row) {
+    if (names.empty()) {
+        for (unsigned int i = 0; i < row->size(); i++) {
+            names.push_back((*row)[i]->name);
+        }
+    }
+
+    buffer.clear();
+    for (unsigned int i = 0; i < row->size(); i++) {
+        Values::Field* field = (*row)[i];
+        Append(buffer, (unsigned char)field->type);
+        switch (field->type) {
+            case SQLITE_INTEGER: {
+                Append(buffer, ((Values::Integer*)field)->value);
+            } break;
+            case SQLITE_FLOAT: {
+                Append(buffer, ((Values::Float*)field)->value);
+            } break;
+            case SQLITE_TEXT: {
+                Values::Text* text = (Values::Text*)field;
+                Append(buffer, (unsigned char)text->one_byte);
+                Append(buffer, (uint32_t)text->value.size());
+                buffer.append(text->value);
+            } break;
+            case SQLITE_BLOB: {
+                Values::Blob* blob = (Values::Blob*)field;
+                Append(buffer, (uint32_t)blob->length);
+                buffer.append(blob->value, blob->length);
+            } break;
+        }
+    }
+
+    if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+        return false;
+    }
+    count++;
+    return true;
+}
+
+bool RowSpill::Rewind() {
+    return fflush(file) == 0 && fseek(file, 0, SEEK_SET) == 0;
+}
+
+Row* RowSpill::Read() {
+    Row* row = new Row();
+    row->reserve(names.size());
+
+    bool ok = true;
+    for (unsigned int i = 0; ok && i < names.size(); i++) {
+        const char* name = names[i].c_str();
+        unsigned char type;
+        if (!ReadValue(file, &type)) break;
+
+        switch (type) {
+            case SQLITE_INTEGER: {
+                int64_t value;
+                ok = ReadValue(file, &value);
+                if (ok) row->push_back(new Values::Integer(name, value));
+            } break;
+            case SQLITE_FLOAT: {
+                double value;
+                ok = ReadValue(file, &value);
+                if (ok) row->push_back(new Values::Float(name, value));
+            } break;
+            case SQLITE_TEXT: {
+                unsigned char one_byte;
+                uint32_t length;
+                ok = ReadValue(file, &one_byte) && ReadValue(file, &length);
+                if (!ok) break;
+                buffer.resize(length);
+                ok = length == 0 || fread(&buffer[0], 1, length, file) == length;
+                if (!ok) break;
+                Values::Text* text = new Values::Text(name, length, buffer.data());
+                text->one_byte = one_byte != 0;
+                row->push_back(text);
+            } break;
+            case SQLITE_BLOB: {
+                uint32_t length;
+                ok = ReadValue(file, &length);
+                if (!ok) break;
+                buffer.resize(length);
+                ok = length == 0 || fread(&buffer[0], 1, length, file) == length;
+                if (ok) row->push_back(new Values::Blob(name, length, buffer.data()));
+            } break;
+            case SQLITE_NULL: {
+                row->push_back(new Values::Null(name));
+            } break;
+            default:
+                ok = false;
+        }
+    }
+
+    if (row->size() != names.size()) {
+        for (unsigned int i = 0; i < row->size(); i++) {
+            DELETE_FIELD((*row)[i]);
+        }
+        delete row;
+        return NULL;
+    }
+    return row;
+}
@@ -0,0 +1,41 @@
+#ifndef NODE_SQLITE3_SRC_SPILL_H
+#define NODE_SQLITE3_SRC_SPILL_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "statement.h"
+
+namespace node_sqlite3 {
+
+// Result rows that didn't fit into the memory limit of a query, encoded
+// into an anonymous temporary file. Rows are written on the thread pool
+// and read back in order on the main thread while they are converted.
+class RowSpill {
+public:
+    RowSpill() : file(NULL), count(0) {}
+    ~RowSpill();
+
+    // Creates the file; returns false if that isn't possible.
+    bool Open();
+    // Appends the row. The row is left to the caller.
+    bool Write(Row* row);
+    // Starts reading from the first row.
+    bool Rewind();
+    // Returns the next row, or NULL if it can't be read.
+    Row* Read();
+
+    unsigned int Count() { return count; }
+
+protected:
+    FILE* file;
+    unsigned int count;
+    // All rows have the same columns, so their names are only kept once.
+    std::vector<std::string> names;
+    std::string buffer;
+};
+
+}
+
+#endif
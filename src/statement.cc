@@ -1,4 +1,7 @@
 #include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <sstream>
 #include <node.h>
 #include <node_buffer.h>
 #include <node_version.h>
@@ -6,11 +9,113 @@
 #include "macros.h"
 #include "database.h"
 #include "statement.h"
+#include "spill.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STATEMENT_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace node_sqlite3;
 
 Persistent<FunctionTemplate> Statement::constructor_template;
 
+namespace {
+
+// One-byte texts at least this long are handed to V8 as external strings.
+// Below that, copying is cheaper than tracking another external string.
+const size_t EXTERNAL_TEXT_SIZE = 64 * 1024;
+
+class ExternalText : public NanExternalOneByteStringResource {
+public:
+    ExternalText(std::string& value_) {
+        value.swap(value_);
+        NanAdjustExternalMemory(value.size());
+    }
+    ~ExternalText() {
+        NanAdjustExternalMemory(-(int)value.size());
+    }
+    const char* data() const { return value.data(); }
+    size_t length() const { return value.size(); }
+
+protected:
+    std::string value;
+};
+
+// Returns the length of the leading run of ASCII characters.
+size_t AsciiPrefix(const char* data, size_t length) {
+    size_t i = 0;
+#ifdef STATEMENT_SSE2
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+        if (_mm_movemask_epi8(chunk) != 0) break;
+    }
+#else
+    for (; i + 8 <= length; i += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, data + i, sizeof(chunk));
+        if (chunk & 0x8080808080808080ULL) break;
+    }
+#endif
+    while (i < length && !(data[i] & 0x80)) i++;
+    return i;
+}
+
+}
+
+void Values::Text::Narrow() {
+    size_t length = value.size();
+    size_t start = AsciiPrefix(value.data(), length);
+    if (start == length) {
+        one_byte = true;
+        return;
+    }
+
+    // Characters up to U+00FF take two bytes in UTF-8, starting with 0xC2
+    // or 0xC3. Check that there are no others before rewriting anything.
+    const char* data = value.data();
+    for (size_t i = start; i < length; ) {
+        unsigned char c = data[i];
+        if (c < 0x80) {
+            i += AsciiPrefix(data + i, length - i);
+        }
+        else if ((c == 0xC2 || c == 0xC3) && i + 1 < length &&
+                (data[i + 1] & 0xC0) == 0x80) {
+            i += 2;
+        }
+        else {
+            return;
+        }
+    }
+
+    char* output = &value[0];
+    size_t position = start;
+    for (size_t i = start; i < length; ) {
+        unsigned char c = output[i];
+        if (c < 0x80) {
+            output[position++] = output[i++];
+        }
+        else {
+            output[position++] = ((c & 0x03) << 6) | (output[i + 1] & 0x3F);
+            i += 2;
+        }
+    }
+    value.resize(position);
+    one_byte = true;
+}
+
+Local<String> Values::Text::ToJS() {
+    if (!one_byte) {
+        return NanNew<String>(value.c_str(), value.size());
+    }
+    else if (value.size() >= EXTERNAL_TEXT_SIZE) {
+        return NanNew(static_cast<NanExternalOneByteStringResource*>(new ExternalText(value)));
+    }
+    else {
+        return NanNew<String>((const uint8_t*)value.data(), value.size());
+    }
+}
+
 void Statement::Init(Handle<Object> target) {
     NanScope();
 
@@ -26,6 +131,7 @@ void Statement::Init(Handle<Object> target) {
     NODE_SET_PROTOTYPE_METHOD(t, "each", Each);
     NODE_SET_PROTOTYPE_METHOD(t, "reset", Reset);
     NODE_SET_PROTOTYPE_METHOD(t, "finalize", Finalize);
+    NODE_SET_PROTOTYPE_METHOD(t, "configure", Configure);
 
     NanAssignPersistent(constructor_template, t);
     target->Set(NanNew("Statement"),
@@ -41,12 +147,15 @@ void Statement::Process() {
         Call* call = queue.front();
         queue.pop();
 
+        Timeline::Dequeued(call->baton->span);
         call->callback(call->baton);
         delete call;
     }
 }
 
 void Statement::Schedule(Work_Callback callback, Baton* baton) {
+    Timeline::Scheduled(baton->span);
+
     if (finalized) {
         queue.push(new Call(callback, baton));
         CleanQueue();
@@ -55,6 +164,7 @@ void Statement::Schedule(Work_Callback callback, Baton* baton) {
         queue.push(new Call(callback, baton));
     }
     else {
+        Timeline::Dequeued(baton->span);
         callback(baton);
     }
 }
@@ -79,6 +189,18 @@ template <class T> void Statement::Error(T* baton) {
     }
 }
 
+// Queues work again after it waited for a shared-cache table lock. The
+// statement stays locked in the meantime.
+template <class T, Timeline::Work_Callback work, Timeline::Work_Callback after>
+void Statement::Requeue(void* data) {
+    T* baton = static_cast<T*>(data);
+    std::string sql(baton->span.sql);
+    int status = Timeline::Queue(baton,
+        baton->span.name ? baton->span.name : "Statement.Retry",
+        sql.c_str(), work, after);
+    assert(status == 0);
+}
+
 // { Database db, String sql, Array params, Function callback }
 NAN_METHOD(Statement::New) {
     NanScope();
@@ -117,8 +239,9 @@ NAN_METHOD(Statement::New) {
 void Statement::Work_BeginPrepare(Database::Baton* baton) {
     assert(baton->db->open);
     baton->db->pending++;
-    int status = uv_queue_work(uv_default_loop(),
-        &baton->request, Work_Prepare, (uv_after_work_cb)Work_AfterPrepare);
+    PrepareBaton* prepare_baton = static_cast<PrepareBaton*>(baton);
+    int status = Timeline::Queue(baton, "Statement.Prepare",
+        prepare_baton->sql.c_str(), Work_Prepare, Work_AfterPrepare);
     assert(status == 0);
 }
 
@@ -139,7 +262,9 @@ void Statement::Work_Prepare(uv_work_t* req) {
     );
 
     if (stmt->status != SQLITE_OK) {
-        stmt->message = std::string(sqlite3_errmsg(baton->db->_handle));
+        if (!baton->db->WaitForUnlock(stmt->status, baton->unlock)) {
+            stmt->message = std::string(sqlite3_errmsg(baton->db->_handle));
+        }
         stmt->_handle = NULL;
     }
 
@@ -150,6 +275,12 @@ void Statement::Work_AfterPrepare(uv_work_t* req) {
     NanScope();
     STATEMENT_INIT(PrepareBaton);
 
+    if (baton->unlock.waiting) {
+        Database::RetryWhenUnlocked(baton->unlock,
+            Requeue<PrepareBaton, Work_Prepare, Work_AfterPrepare>, baton);
+        return;
+    }
+
     if (stmt->status != SQLITE_OK) {
         Error(baton);
         stmt->Finalize();
@@ -254,7 +385,7 @@ bool Statement::Bind(const Parameters & parameters) {
         return true;
     }
 
-    sqlite3_reset(_handle);
+    ResetHandle();
     sqlite3_clear_bindings(_handle);
 
     Parameters::const_iterator it = parameters.begin();
@@ -306,6 +437,24 @@ bool Statement::Bind(const Parameters & parameters) {
     return true;
 }
 
+void Statement::ResetHandle() {
+    // Note: This function is called in the thread pool.
+    sqlite3_mutex* mtx = sqlite3_db_mutex(db->_handle);
+    sqlite3_mutex_enter(mtx);
+    sqlite3_reset(_handle);
+    db->CaptureSlowQueries(_handle, &profiled);
+    sqlite3_mutex_leave(mtx);
+    ClearProfiled();
+}
+
+void Statement::ClearProfiled() {
+    for (unsigned int i = 0; i < profiled.size(); i++) {
+        Values::Field* field = profiled[i];
+        DELETE_FIELD(field);
+    }
+    profiled.clear();
+}
+
 NAN_METHOD(Statement::Bind) {
     NanScope();
     Statement* stmt = ObjectWrap::Unwrap<Statement>(args.This());
@@ -382,16 +531,31 @@ void Statement::Work_Get(uv_work_t* req) {
         if (stmt->Bind(baton->parameters)) {
             stmt->status = sqlite3_step(stmt->_handle);
 
-            if (!(stmt->status == SQLITE_ROW || stmt->status == SQLITE_DONE)) {
+            if (!(stmt->status == SQLITE_ROW || stmt->status == SQLITE_DONE) &&
+                    !stmt->db->WaitForUnlock(stmt->status, baton->unlock)) {
                 stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
             }
         }
 
+        if (stmt->status == SQLITE_ROW) {
+            // The statement isn't reset until a later call, so its run is
+            // captured then, see ResetHandle().
+            if (baton->parameters.size()) {
+                stmt->ClearProfiled();
+                stmt->profiled.swap(baton->parameters);
+            }
+        }
+        else {
+            stmt->db->CaptureSlowQueries(stmt->_handle,
+                baton->parameters.size() ? &baton->parameters : &stmt->profiled);
+            stmt->ClearProfiled();
+        }
+        stmt->db->DeliverChanges();
         sqlite3_mutex_leave(mtx);
 
         if (stmt->status == SQLITE_ROW) {
             // Acquire one result row before returning.
-            GetRow(&baton->row, stmt->_handle);
+            stmt->GetRow(&baton->row);
         }
     }
 }
@@ -400,6 +564,12 @@ void Statement::Work_AfterGet(uv_work_t* req) {
     NanScope();
     STATEMENT_INIT(RowBaton);
 
+    if (baton->unlock.waiting) {
+        Database::RetryWhenUnlocked(baton->unlock,
+            Requeue<RowBaton, Work_Get, Work_AfterGet>, baton);
+        return;
+    }
+
     if (stmt->status != SQLITE_ROW && stmt->status != SQLITE_DONE) {
         Error(baton);
     }
@@ -409,7 +579,7 @@ void Statement::Work_AfterGet(uv_work_t* req) {
         if (!cb.IsEmpty() && cb->IsFunction()) {
             if (stmt->status == SQLITE_ROW) {
                 // Create the result array from the data we acquired.
-                Local<Value> argv[] = { NanNew(NanNull()), RowToJS(&baton->row) };
+                Local<Value> argv[] = { NanNew(NanNull()), RowToJS(&baton->row, &stmt->columns) };
                 TRY_CATCH_CALL(NanObjectWrapHandle(stmt), cb, 2, argv);
             }
             else {
@@ -448,14 +618,16 @@ void Statement::Work_Run(uv_work_t* req) {
 
     // Make sure that we also reset when there are no parameters.
     if (!baton->parameters.size()) {
-        sqlite3_reset(stmt->_handle);
+        stmt->ResetHandle();
     }
 
     if (stmt->Bind(baton->parameters)) {
         stmt->status = sqlite3_step(stmt->_handle);
 
         if (!(stmt->status == SQLITE_ROW || stmt->status == SQLITE_DONE)) {
-            stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
+            if (!stmt->db->WaitForUnlock(stmt->status, baton->unlock)) {
+                stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
+            }
         }
         else {
             baton->inserted_id = sqlite3_last_insert_rowid(stmt->db->_handle);
@@ -463,6 +635,8 @@ void Statement::Work_Run(uv_work_t* req) {
         }
     }
 
+    stmt->db->CaptureSlowQueries(stmt->_handle, &baton->parameters);
+    stmt->db->DeliverChanges();
     sqlite3_mutex_leave(mtx);
 }
 
@@ -470,6 +644,12 @@ void Statement::Work_AfterRun(uv_work_t* req) {
     NanScope();
     STATEMENT_INIT(RunBaton);
 
+    if (baton->unlock.waiting) {
+        Database::RetryWhenUnlocked(baton->unlock,
+            Requeue<RunBaton, Work_Run, Work_AfterRun>, baton);
+        return;
+    }
+
     if (stmt->status != SQLITE_ROW && stmt->status != SQLITE_DONE) {
         Error(baton);
     }
@@ -502,7 +682,25 @@ NAN_METHOD(Statement::All) {
     }
 }
 
+Statement::RowsBaton::~RowsBaton() {
+    // Rows that weren't converted, e.g. after an error.
+    for (unsigned int i = 0; i < rows.size(); i++) {
+        Row* row = rows[i];
+        if (row == NULL) continue;
+        for (unsigned int j = 0; j < row->size(); j++) {
+            DELETE_FIELD((*row)[j]);
+        }
+        delete row;
+    }
+    delete spill;
+    NanDisposePersistent(result);
+    if (reported) stmt->db->AdjustExternalMemory(-(int64_t)reported);
+}
+
 void Statement::Work_BeginAll(Baton* baton) {
+    Statement* stmt = baton->stmt;
+    static_cast<RowsBaton*>(baton)->options = stmt->has_result_options ?
+        stmt->result_options : stmt->db->result_options;
     STATEMENT_BEGIN(All);
 }
 
@@ -514,21 +712,75 @@ void Statement::Work_All(uv_work_t* req) {
 
     // Make sure that we also reset when there are no parameters.
     if (!baton->parameters.size()) {
-        sqlite3_reset(stmt->_handle);
+        stmt->ResetHandle();
     }
 
     if (stmt->Bind(baton->parameters)) {
+        const Database::ResultOptions& options = baton->options;
+        bool failed = false;
+        unsigned int steps = 0;
+
         while ((stmt->status = sqlite3_step(stmt->_handle)) == SQLITE_ROW) {
             Row* row = new Row();
-            GetRow(row, stmt->_handle);
-            baton->rows.push_back(row);
+            stmt->GetRow(row);
+
+            size_t size = baton->spill == NULL ? RowSize(row) : 0;
+            if (options.bytes > 0 && baton->spill == NULL &&
+                    baton->bytes + size > options.bytes) {
+                if (options.policy == Database::ResultOptions::POLICY_SPILL) {
+                    baton->spill = new RowSpill();
+                    failed = !baton->spill->Open();
+                }
+                else {
+                    std::ostringstream message;
+                    message << "Result exceeds the limit of " << options.bytes << " bytes";
+                    stmt->status = SQLITE_TOOBIG;
+                    stmt->message = message.str();
+                    failed = true;
+                }
+            }
+
+            if (baton->spill != NULL && !failed) {
+                failed = !baton->spill->Write(row);
+            }
+            if (failed && stmt->status == SQLITE_ROW) {
+                stmt->status = SQLITE_IOERR;
+                stmt->message = "Could not write result rows to a temporary file";
+            }
+
+            if (baton->spill != NULL || failed) {
+                for (unsigned int i = 0; i < row->size(); i++) {
+                    DELETE_FIELD((*row)[i]);
+                }
+                delete row;
+            }
+            else {
+                baton->rows.push_back(row);
+                baton->bytes += size;
+            }
+            if (failed) {
+                // Don't keep the read transaction open until the next call.
+                sqlite3_reset(stmt->_handle);
+                break;
+            }
+
+            if (options.yield_steps > 0 && ++steps % options.yield_steps == 0) {
+                sqlite3_mutex_leave(mtx);
+                NODE_SQLITE3_YIELD
+                sqlite3_mutex_enter(mtx);
+            }
         }
 
-        if (stmt->status != SQLITE_DONE) {
+        // Table locks are taken on the first step, so no rows have been
+        // read when waiting for one.
+        if (!failed && stmt->status != SQLITE_DONE && !(baton->rows.empty() &&
+                stmt->db->WaitForUnlock(stmt->status, baton->unlock))) {
             stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
         }
     }
 
+    stmt->db->CaptureSlowQueries(stmt->_handle, &baton->parameters);
+    stmt->db->DeliverChanges();
     sqlite3_mutex_leave(mtx);
 }
 
@@ -536,6 +788,104 @@ void Statement::Work_AfterAll(uv_work_t* req) {
     NanScope();
     STATEMENT_INIT(RowsBaton);
 
+    if (baton->unlock.waiting) {
+        Database::RetryWhenUnlocked(baton->unlock,
+            Requeue<RowsBaton, Work_All, Work_AfterAll>, baton);
+        return;
+    }
+
+    // Until the rows are freed, so that the collector can take them into
+    // account while they are converted.
+    baton->reported = baton->bytes;
+    stmt->db->AdjustExternalMemory(baton->reported);
+
+    Local<Array> result;
+    Local<Function> cb = NanNew(baton->callback);
+    if (stmt->status == SQLITE_DONE && !cb.IsEmpty() && cb->IsFunction()) {
+        // The spilled rows follow the ones kept in memory.
+        unsigned int spilled = baton->spill ? baton->spill->Count() : 0;
+        result = NanNew<Array>(baton->rows.size() + spilled);
+        if (spilled && !baton->spill->Rewind()) {
+            stmt->status = SQLITE_IOERR;
+            stmt->message = "Could not read result rows from a temporary file";
+        }
+        else if (!ConvertRows(baton, result)) {
+            // Convert the rest in later turns of the event loop.
+            NanAssignPersistent(baton->result, result);
+            uv_idle_init(uv_default_loop(), &baton->idle);
+            baton->idle.data = baton;
+            uv_idle_start(&baton->idle, reinterpret_cast<uv_idle_cb>(ConvertSlice));
+            return;
+        }
+    }
+
+    FinishAll(baton, result);
+}
+
+// Converts rows into result after the ones converted before. If slices are
+// configured, stops when the slice is used up, after at least one row.
+// Returns true when done, which includes failing to read a spilled row.
+bool Statement::ConvertRows(RowsBaton* baton, Local<Array> result) {
+    Statement* stmt = baton->stmt;
+    const Database::ResultOptions& options = baton->options;
+    unsigned int total = result->Length();
+    uint64_t deadline = options.slice_time ?
+        uv_hrtime() + (uint64_t)options.slice_time * 1000000 : 0;
+
+    for (unsigned int count = 0; baton->converted < total; count++) {
+        if (count > 0 && ((options.slice_rows && count >= options.slice_rows) ||
+                (deadline && uv_hrtime() >= deadline))) {
+            return false;
+        }
+
+        unsigned int i = baton->converted;
+        bool spilled = i >= baton->rows.size();
+        Row* row;
+        if (!spilled) {
+            row = baton->rows[i];
+            baton->rows[i] = NULL;
+        }
+        else if ((row = baton->spill->Read()) == NULL) {
+            stmt->status = SQLITE_IOERR;
+            stmt->message = "Could not read result rows from a temporary file";
+            return true;
+        }
+
+        size_t external = 0;
+        result->Set(i, RowToJS(row, &stmt->columns, spilled ? NULL : &external));
+        delete row;
+        baton->converted++;
+
+        // Don't report texts that external strings report now a second time.
+        if (external > baton->reported) external = baton->reported;
+        if (external > 0) {
+            baton->reported -= external;
+            stmt->db->AdjustExternalMemory(-(int64_t)external);
+        }
+    }
+    return true;
+}
+
+void Statement::ConvertSlice(uv_idle_t* handle, int status) {
+    NanScope();
+    RowsBaton* baton = static_cast<RowsBaton*>(handle->data);
+
+    if (ConvertRows(baton, NanNew(baton->result))) {
+        uv_idle_stop(handle);
+        uv_close(reinterpret_cast<uv_handle_t*>(handle), AfterConvert);
+    }
+}
+
+void Statement::AfterConvert(uv_handle_t* handle) {
+    NanScope();
+    RowsBaton* baton = static_cast<RowsBaton*>(handle->data);
+    FinishAll(baton, NanNew(baton->result));
+}
+
+void Statement::FinishAll(RowsBaton* baton, Local<Array> result) {
+    NanScope();
+    Statement* stmt = baton->stmt;
+
     if (stmt->status != SQLITE_DONE) {
         Error(baton);
     }
@@ -543,27 +893,8 @@ void Statement::Work_AfterAll(uv_work_t* req) {
         // Fire callbacks.
         Local<Function> cb = NanNew(baton->callback);
         if (!cb.IsEmpty() && cb->IsFunction()) {
-            if (baton->rows.size()) {
-                // Create the result array from the data we acquired.
-                Local<Array> result(NanNew<Array>(baton->rows.size()));
-                Rows::const_iterator it = baton->rows.begin();
-                Rows::const_iterator end = baton->rows.end();
-                for (int i = 0; it < end; ++it, i++) {
-                    result->Set(i, RowToJS(*it));
-                    delete *it;
-                }
-
-                Local<Value> argv[] = { NanNew(NanNull()), result };
-                TRY_CATCH_CALL(NanObjectWrapHandle(stmt), cb, 2, argv);
-            }
-            else {
-                // There were no result rows.
-                Local<Value> argv[] = {
-                    NanNew(NanNull()),
-                    NanNew<Array>(0)
-                };
-                TRY_CATCH_CALL(NanObjectWrapHandle(stmt), cb, 2, argv);
-            }
+            Local<Value> argv[] = { NanNew(NanNull()), result };
+            TRY_CATCH_CALL(NanObjectWrapHandle(stmt), cb, 2, argv);
         }
     }
 
@@ -614,7 +945,7 @@ void Statement::Work_Each(uv_work_t* req) {
 
     // Make sure that we also reset when there are no parameters.
     if (!baton->parameters.size()) {
-        sqlite3_reset(stmt->_handle);
+        stmt->ResetHandle();
     }
 
     if (stmt->Bind(baton->parameters)) {
@@ -624,26 +955,34 @@ void Statement::Work_Each(uv_work_t* req) {
             if (stmt->status == SQLITE_ROW) {
                 sqlite3_mutex_leave(mtx);
                 Row* row = new Row();
-                GetRow(row, stmt->_handle);
+                stmt->GetRow(row);
+                size_t size = RowSize(row);
                 NODE_SQLITE3_MUTEX_LOCK(&async->mutex)
                 async->data.push_back(row);
+                async->bytes += size;
                 retrieved++;
                 NODE_SQLITE3_MUTEX_UNLOCK(&async->mutex)
 
                 uv_async_send(&async->watcher);
             }
             else {
-                if (stmt->status != SQLITE_DONE) {
+                if (stmt->status != SQLITE_DONE && !(retrieved == 0 &&
+                        stmt->db->WaitForUnlock(stmt->status, baton->unlock))) {
                     stmt->message = std::string(sqlite3_errmsg(stmt->db->_handle));
                 }
+                stmt->db->CaptureSlowQueries(stmt->_handle, &baton->parameters);
+                stmt->db->DeliverChanges();
                 sqlite3_mutex_leave(mtx);
                 break;
             }
         }
     }
 
-    async->completed = true;
-    uv_async_send(&async->watcher);
+    // The row callbacks stay registered while waiting for a table lock.
+    if (!baton->unlock.waiting) {
+        async->completed = true;
+        uv_async_send(&async->watcher);
+    }
 }
 
 void Statement::CloseCallback(uv_handle_t* handle) {
@@ -662,11 +1001,15 @@ void Statement::AsyncEach(uv_async_t* handle, int status) {
         Rows rows;
         NODE_SQLITE3_MUTEX_LOCK(&async->mutex)
         rows.swap(async->data);
+        int64_t bytes = async->bytes;
+        async->bytes = 0;
         NODE_SQLITE3_MUTEX_UNLOCK(&async->mutex)
 
         if (rows.empty()) {
             break;
         }
+        Database* db = async->stmt->db;
+        db->AdjustExternalMemory(bytes);
 
         Local<Function> cb = NanNew(async->item_cb);
         if (!cb.IsEmpty() && cb->IsFunction()) {
@@ -676,12 +1019,17 @@ void Statement::AsyncEach(uv_async_t* handle, int status) {
             Rows::const_iterator it = rows.begin();
             Rows::const_iterator end = rows.end();
             for (int i = 0; it < end; ++it, i++) {
-                argv[1] = RowToJS(*it);
+                // External strings report their text themselves from here on.
+                size_t external = 0;
+                argv[1] = RowToJS(*it, &async->stmt->columns, &external);
+                db->AdjustExternalMemory(-(int64_t)external);
+                bytes -= external;
                 async->retrieved++;
                 TRY_CATCH_CALL(NanObjectWrapHandle(async->stmt), cb, 2, argv);
                 delete *it;
             }
         }
+        db->AdjustExternalMemory(-bytes);
     }
 
     Local<Function> cb = NanNew(async->completed_cb);
@@ -702,6 +1050,12 @@ void Statement::Work_AfterEach(uv_work_t* req) {
     NanScope();
     STATEMENT_INIT(EachBaton);
 
+    if (baton->unlock.waiting) {
+        Database::RetryWhenUnlocked(baton->unlock,
+            Requeue<EachBaton, Work_Each, Work_AfterEach>, baton);
+        return;
+    }
+
     if (stmt->status != SQLITE_DONE) {
         Error(baton);
     }
@@ -728,7 +1082,7 @@ void Statement::Work_BeginReset(Baton* baton) {
 void Statement::Work_Reset(uv_work_t* req) {
     STATEMENT_INIT(Baton);
 
-    sqlite3_reset(stmt->_handle);
+    stmt->ResetHandle();
     stmt->status = SQLITE_OK;
 }
 
@@ -746,74 +1100,240 @@ void Statement::Work_AfterReset(uv_work_t* req) {
     STATEMENT_END();
 }
 
-Local<Object> Statement::RowToJS(Row* row) {
-    NanEscapableScope();
+namespace {
 
-    Local<Object> result(NanNew<Object>());
+Values::Field* DecodeValue(sqlite3_stmt* stmt, int i, const char* name) {
+    switch (sqlite3_column_type(stmt, i)) {
+        case SQLITE_INTEGER: {
+            return new Values::Integer(name, sqlite3_column_int64(stmt, i));
+        }
+        case SQLITE_FLOAT: {
+            return new Values::Float(name, sqlite3_column_double(stmt, i));
+        }
+        case SQLITE_TEXT: {
+            const char* text = (const char*)sqlite3_column_text(stmt, i);
+            int length = sqlite3_column_bytes(stmt, i);
+            Values::Text* field = new Values::Text(name, length, text);
+            field->Narrow();
+            return field;
+        }
+        case SQLITE_BLOB: {
+            const void* blob = sqlite3_column_blob(stmt, i);
+            int length = sqlite3_column_bytes(stmt, i);
+            return new Values::Blob(name, length, blob);
+        }
+        case SQLITE_NULL: {
+            return new Values::Null(name);
+        }
+        default:
+            assert(false);
+            return NULL;
+    }
+}
 
-    Row::const_iterator it = row->begin();
-    Row::const_iterator end = row->end();
-    for (int i = 0; it < end; ++it, i++) {
-        Values::Field* field = *it;
+// Integers that fit into 32 bits become small integers, which V8 doesn't
+// have to allocate.
+inline Local<Value> IntegerToJS(int64_t value) {
+    if (value == (int32_t)value) {
+        return NanNew<Integer>((int32_t)value);
+    }
+    return NanNew<Number>((double)value);
+}
+
+Local<Value> ConvertValue(Values::Field* field) {
+    switch (field->type) {
+        case SQLITE_INTEGER:
+            return IntegerToJS(((Values::Integer*)field)->value);
+        case SQLITE_FLOAT:
+            return NanNew<Number>(((Values::Float*)field)->value);
+        case SQLITE_TEXT:
+            return ((Values::Text*)field)->ToJS();
+        case SQLITE_BLOB:
+            return NanNew(NanNewBufferHandle(((Values::Blob*)field)->value, ((Values::Blob*)field)->length));
+        default:
+            return NanNew(NanNull());
+    }
+}
+
+// The generic versions handle columns without a known type.
+template <int TYPE> Values::Field* DecodeColumn(sqlite3_stmt* stmt, int i, const char* name) {
+    return DecodeValue(stmt, i, name);
+}
+
+template <int TYPE> Local<Value> ConvertColumn(Values::Field* field) {
+    return ConvertValue(field);
+}
+
+template <> Values::Field* DecodeColumn<SQLITE_INTEGER>(sqlite3_stmt* stmt, int i, const char* name) {
+    if (sqlite3_column_type(stmt, i) != SQLITE_INTEGER) return DecodeValue(stmt, i, name);
+    return new Values::Integer(name, sqlite3_column_int64(stmt, i));
+}
+
+template <> Local<Value> ConvertColumn<SQLITE_INTEGER>(Values::Field* field) {
+    if (field->type != SQLITE_INTEGER) return ConvertValue(field);
+    return IntegerToJS(((Values::Integer*)field)->value);
+}
+
+template <> Values::Field* DecodeColumn<SQLITE_FLOAT>(sqlite3_stmt* stmt, int i, const char* name) {
+    if (sqlite3_column_type(stmt, i) != SQLITE_FLOAT) return DecodeValue(stmt, i, name);
+    return new Values::Float(name, sqlite3_column_double(stmt, i));
+}
+
+template <> Local<Value> ConvertColumn<SQLITE_FLOAT>(Values::Field* field) {
+    if (field->type != SQLITE_FLOAT) return ConvertValue(field);
+    return NanNew<Number>(((Values::Float*)field)->value);
+}
+
+template <> Values::Field* DecodeColumn<SQLITE_TEXT>(sqlite3_stmt* stmt, int i, const char* name) {
+    if (sqlite3_column_type(stmt, i) != SQLITE_TEXT) return DecodeValue(stmt, i, name);
+    const char* text = (const char*)sqlite3_column_text(stmt, i);
+    Values::Text* field = new Values::Text(name, sqlite3_column_bytes(stmt, i), text);
+    field->Narrow();
+    return field;
+}
+
+template <> Local<Value> ConvertColumn<SQLITE_TEXT>(Values::Field* field) {
+    if (field->type != SQLITE_TEXT) return ConvertValue(field);
+    return ((Values::Text*)field)->ToJS();
+}
+
+template <int TYPE> Statement::Column MakeColumn() {
+    Statement::Column column = { DecodeColumn<TYPE>, ConvertColumn<TYPE> };
+    return column;
+}
+
+// Returns the type of values expected for a declared column type, using
+// SQLite's rules for column affinity, or SQLITE_NULL if any type is likely.
+int DeclaredType(const char* declared) {
+    std::string type(declared);
+    for (unsigned int i = 0; i < type.size(); i++) type[i] = toupper(type[i]);
+
+    if (type.find("INT") != std::string::npos) return SQLITE_INTEGER;
+    if (type.find("CHAR") != std::string::npos || type.find("CLOB") != std::string::npos ||
+            type.find("TEXT") != std::string::npos) {
+        return SQLITE_TEXT;
+    }
+    if (type.find("REAL") != std::string::npos || type.find("FLOA") != std::string::npos ||
+            type.find("DOUB") != std::string::npos) {
+        return SQLITE_FLOAT;
+    }
+    return SQLITE_NULL;
+}
 
-        Local<Value> value;
+}
 
+size_t node_sqlite3::RowSize(Row* row) {
+    size_t size = sizeof(Row) + row->capacity() * sizeof(Values::Field*);
+    for (unsigned int i = 0; i < row->size(); i++) {
+        Values::Field* field = (*row)[i];
+        size += field->name.size();
         switch (field->type) {
-            case SQLITE_INTEGER: {
-                value = NanNew<Number>(((Values::Integer*)field)->value);
-            } break;
-            case SQLITE_FLOAT: {
-                value = NanNew<Number>(((Values::Float*)field)->value);
-            } break;
-            case SQLITE_TEXT: {
-                value = NanNew<String>(((Values::Text*)field)->value.c_str(), ((Values::Text*)field)->value.size());
-            } break;
-            case SQLITE_BLOB: {
-                value = NanNew(NanNewBufferHandle(((Values::Blob*)field)->value, ((Values::Blob*)field)->length));
-            } break;
-            case SQLITE_NULL: {
-                value = NanNew(NanNull());
-            } break;
+            case SQLITE_INTEGER: size += sizeof(Values::Integer); break;
+            case SQLITE_FLOAT: size += sizeof(Values::Float); break;
+            case SQLITE_TEXT:
+                size += sizeof(Values::Text) + ((Values::Text*)field)->value.size();
+                break;
+            case SQLITE_BLOB:
+                size += sizeof(Values::Blob) + ((Values::Blob*)field)->length;
+                break;
+            default: size += sizeof(Values::Field); break;
         }
+    }
+    return size;
+}
+
+// Adds the size of the texts handed to V8 as external strings to external,
+// if given. Those strings report their size themselves.
+Local<Object> Statement::RowToJS(Row* row, const Columns* columns, size_t* external) {
+    NanEscapableScope();
 
+    Local<Object> result(NanNew<Object>());
+
+    unsigned int described = columns ? columns->size() : 0;
+    for (unsigned int i = 0; i < row->size(); i++) {
+        Values::Field* field = (*row)[i];
+        size_t length = field->type == SQLITE_TEXT ?
+            ((Values::Text*)field)->value.size() : 0;
+
+        Local<Value> value = i < described ?
+            (*columns)[i].convert(field) : ConvertValue(field);
         result->Set(NanNew(field->name.c_str()), value);
 
+        // External strings take the text along, see Values::Text::ToJS().
+        if (external != NULL && length > 0 && ((Values::Text*)field)->value.empty()) {
+            *external += length;
+        }
+
         DELETE_FIELD(field);
     }
 
     return NanEscapeScope(result);
 }
 
-void Statement::GetRow(Row* row, sqlite3_stmt* stmt) {
-    int rows = sqlite3_column_count(stmt);
+void Statement::DescribeColumns() {
+    int count = sqlite3_column_count(_handle);
+    columns.reserve(count);
+
+    for (int i = 0; i < count; i++) {
+        // The first value tells best what to expect; if it is NULL, go by
+        // the declared type.
+        int type = sqlite3_column_type(_handle, i);
+        if (type == SQLITE_NULL) {
+            const char* declared = sqlite3_column_decltype(_handle, i);
+            if (declared != NULL) type = DeclaredType(declared);
+        }
 
-    for (int i = 0; i < rows; i++) {
-        int type = sqlite3_column_type(stmt, i);
-        const char* name = sqlite3_column_name(stmt, i);
         switch (type) {
-            case SQLITE_INTEGER: {
-                row->push_back(new Values::Integer(name, sqlite3_column_int64(stmt, i)));
-            }   break;
-            case SQLITE_FLOAT: {
-                row->push_back(new Values::Float(name, sqlite3_column_double(stmt, i)));
-            }   break;
-            case SQLITE_TEXT: {
-                const char* text = (const char*)sqlite3_column_text(stmt, i);
-                int length = sqlite3_column_bytes(stmt, i);
-                row->push_back(new Values::Text(name, length, text));
-            } break;
-            case SQLITE_BLOB: {
-                const void* blob = sqlite3_column_blob(stmt, i);
-                int length = sqlite3_column_bytes(stmt, i);
-                row->push_back(new Values::Blob(name, length, blob));
-            }   break;
-            case SQLITE_NULL: {
-                row->push_back(new Values::Null(name));
-            }   break;
-            default:
-                assert(false);
+            case SQLITE_INTEGER: columns.push_back(MakeColumn<SQLITE_INTEGER>()); break;
+            case SQLITE_FLOAT: columns.push_back(MakeColumn<SQLITE_FLOAT>()); break;
+            case SQLITE_TEXT: columns.push_back(MakeColumn<SQLITE_TEXT>()); break;
+            default: columns.push_back(MakeColumn<SQLITE_NULL>()); break;
+        }
+    }
+}
+
+void Statement::GetRow(Row* row) {
+    if (columns.empty()) DescribeColumns();
+
+    // The number of columns can change when the statement is prepared
+    // again after a schema change.
+    int count = sqlite3_column_count(_handle);
+    int described = columns.size();
+    row->reserve(count);
+
+    for (int i = 0; i < count; i++) {
+        const char* name = sqlite3_column_name(_handle, i);
+        row->push_back(i < described ?
+            columns[i].decode(_handle, i, name) : DecodeValue(_handle, i, name));
+    }
+}
+
+NAN_METHOD(Statement::Configure) {
+    NanScope();
+    Statement* stmt = ObjectWrap::Unwrap<Statement>(args.This());
+
+    REQUIRE_ARGUMENTS(2);
+
+    if (Database::IsResultOption(args[0])) {
+        // Start from the database's options so that the others are
+        // inherited.
+        Database::ResultOptions options = stmt->has_result_options ?
+            stmt->result_options : stmt->db->result_options;
+        std::string error;
+        if (!Database::ConfigureResults(options, args[0], args[1], error)) {
+            return NanThrowTypeError(error.c_str());
         }
+        stmt->result_options = options;
+        stmt->has_result_options = true;
+    }
+    else {
+        return NanThrowError(Exception::Error(String::Concat(
+            args[0]->ToString(),
+            NanNew<String>(" is not a valid configuration option")
+        )));
     }
+
+    NanReturnValue(args.This());
 }
 
 NAN_METHOD(Statement::Finalize) {
@@ -844,13 +1364,75 @@ void Statement::Finalize() {
     assert(!finalized);
     finalized = true;
     CleanQueue();
+
+    // A query on the thread pool may hold the connection mutex while it
+    // waits for a JavaScript function to run on this thread, so don't wait
+    // for the mutex here and finalize on the thread pool instead.
+    if (_handle != NULL && !db->functions.empty()) {
+        sqlite3_mutex* mtx = sqlite3_db_mutex(db->_handle);
+        if (sqlite3_mutex_try(mtx) != SQLITE_OK) {
+            FinalizeBaton* baton = new FinalizeBaton(db, _handle);
+            baton->profiled.swap(profiled);
+            db->pending++;
+            int status = Timeline::Queue(baton, "Statement.Finalize", NULL,
+                Work_Finalize, Work_AfterFinalize);
+            assert(status == 0);
+            _handle = NULL;
+            db->Unref();
+            return;
+        }
+        // Keep holding the mutex, so that no query takes it and waits for
+        // this thread before the statement is finalized. It is recursive,
+        // so FinalizeHandle() can enter it again.
+        FinalizeHandle(db, _handle, profiled);
+        sqlite3_mutex_leave(mtx);
+        _handle = NULL;
+        db->Unref();
+        return;
+    }
+
     // Finalize returns the status code of the last operation. We already fired
     // error events in case those failed.
-    sqlite3_finalize(_handle);
+    if (_handle != NULL) {
+        FinalizeHandle(db, _handle, profiled);
+    }
     _handle = NULL;
     db->Unref();
 }
 
+void Statement::Work_Finalize(uv_work_t* req) {
+    FinalizeBaton* baton = static_cast<FinalizeBaton*>(req->data);
+    FinalizeHandle(baton->db, baton->handle, baton->profiled);
+}
+
+void Statement::FinalizeHandle(Database* db, sqlite3_stmt* handle, Parameters& profiled) {
+    // Reset first, so that a get() that stopped at a row is captured with
+    // the parameters it ran with.
+    sqlite3_mutex* mtx = sqlite3_db_mutex(db->_handle);
+    sqlite3_mutex_enter(mtx);
+    sqlite3_reset(handle);
+    db->CaptureSlowQueries(handle, &profiled);
+    sqlite3_finalize(handle);
+    sqlite3_mutex_leave(mtx);
+
+    for (unsigned int i = 0; i < profiled.size(); i++) {
+        Values::Field* field = profiled[i];
+        DELETE_FIELD(field);
+    }
+    profiled.clear();
+}
+
+void Statement::Work_AfterFinalize(uv_work_t* req) {
+    NanScope();
+    FinalizeBaton* baton = static_cast<FinalizeBaton*>(req->data);
+    Database* db = baton->db;
+
+    db->pending--;
+    db->Process();
+
+    delete baton;
+}
+
 void Statement::CleanQueue() {
     NanScope();
     if (prepared && !queue.empty()) {
@@ -20,6 +20,8 @@ using namespace node;
 
 namespace node_sqlite3 {
 
+class RowSpill;
+
 namespace Values {
     struct Field {
         inline Field(unsigned short _index, unsigned short _type = SQLITE_NULL) :
@@ -46,8 +48,20 @@ namespace Values {
 
     struct Text : Field {
         template <class T> inline Text(T _name, size_t len, const char* val) :
-            Field(_name, SQLITE_TEXT), value(val, len) {}
+            Field(_name, SQLITE_TEXT), value(val, len), one_byte(false) {}
+
+        // Converts the value to Latin-1 if it only contains characters
+        // that fit in one byte, so that the main thread can create the
+        // string without decoding UTF-8. Called on the thread pool for
+        // values that are only passed to JavaScript.
+        void Narrow();
+        // Creates the JavaScript string. Takes the value of large one-byte
+        // texts, which become external strings instead of being copied.
+        Local<String> ToJS();
+
         std::string value;
+        // Whether the value holds Latin-1 instead of UTF-8.
+        bool one_byte;
     };
 
     struct Blob : Field {
@@ -70,6 +84,9 @@ typedef std::vector<Values::Field*> Row;
 typedef std::vector<Row*> Rows;
 typedef Row Parameters;
 
+// Approximate number of bytes the row takes in memory.
+size_t RowSize(Row* row);
+
 
 
 class Statement : public ObjectWrap {
@@ -84,6 +101,8 @@ public:
         Statement* stmt;
         Persistent<Function> callback;
         Parameters parameters;
+        Timeline::Span span;
+        Database::UnlockWait unlock;
 
         Baton(Statement* stmt_, Handle<Function> cb_) : stmt(stmt_) {
             stmt->Ref();
@@ -115,8 +134,20 @@ public:
 
     struct RowsBaton : Baton {
         RowsBaton(Statement* stmt_, Handle<Function> cb_) :
-            Baton(stmt_, cb_) {}
+            Baton(stmt_, cb_), bytes(0), reported(0), spill(NULL), converted(0) {}
+        virtual ~RowsBaton();
         Rows rows;
+        // Size of the rows, and how much of it was reported to V8.
+        size_t bytes;
+        size_t reported;
+        Database::ResultOptions options;
+        // Rows past the limit when they are spilled to disk.
+        RowSpill* spill;
+        // Result array and number of rows converted so far, when the rows
+        // are converted in slices.
+        Persistent<Array> result;
+        unsigned int converted;
+        uv_idle_t idle;
     };
 
     struct Async;
@@ -149,6 +180,30 @@ public:
         }
     };
 
+    // Finalizes a statement on the thread pool.
+    struct FinalizeBaton : Database::Baton {
+        sqlite3_stmt* handle;
+        Parameters profiled;
+        FinalizeBaton(Database* db_, sqlite3_stmt* handle_) :
+            Baton(db_, Local<Function>()), handle(handle_) {}
+        virtual ~FinalizeBaton() {
+            for (unsigned int i = 0; i < profiled.size(); i++) {
+                Values::Field* field = profiled[i];
+                DELETE_FIELD(field);
+            }
+        }
+    };
+
+    // Reads the value of one column on the thread pool and converts it on
+    // the main thread. Chosen per column from its declared type and the
+    // type of its first value, with fast paths for that type that fall
+    // back to the generic conversion for values of other types.
+    struct Column {
+        Values::Field* (*decode)(sqlite3_stmt* stmt, int i, const char* name);
+        Local<Value> (*convert)(Values::Field* field);
+    };
+    typedef std::vector<Column> Columns;
+
     typedef void (*Work_Callback)(Baton* baton);
 
     struct Call {
@@ -161,6 +216,8 @@ public:
         uv_async_t watcher;
         Statement* stmt;
         Rows data;
+        // Size of the rows in data.
+        size_t bytes;
         NODE_SQLITE3_MUTEX_t;
         bool completed;
         int retrieved;
@@ -171,7 +228,7 @@ public:
         Persistent<Function> completed_cb;
 
         Async(Statement* st, uv_async_cb async_cb) :
-                stmt(st), completed(false), retrieved(0) {
+                stmt(st), bytes(0), completed(false), retrieved(0) {
             watcher.data = this;
             NODE_SQLITE3_MUTEX_INIT
             stmt->Ref();
@@ -192,12 +249,14 @@ public:
             status(SQLITE_OK),
             prepared(false),
             locked(true),
-            finalized(false) {
+            finalized(false),
+            has_result_options(false) {
         db->Ref();
     }
 
     ~Statement() {
         if (!finalized) Finalize();
+        ClearProfiled();
     }
 
     WORK_DEFINITION(Bind);
@@ -208,6 +267,9 @@ public:
     WORK_DEFINITION(Reset);
 
     static NAN_METHOD(Finalize);
+    static NAN_METHOD(Configure);
+
+    friend class Database;
 
 protected:
     static void Work_BeginPrepare(Database::Baton* baton);
@@ -219,17 +281,31 @@ protected:
 
     static void Finalize(Baton* baton);
     void Finalize();
+    static void FinalizeHandle(Database* db, sqlite3_stmt* handle, Parameters& profiled);
+    static void Work_Finalize(uv_work_t* req);
+    static void Work_AfterFinalize(uv_work_t* req);
 
     template <class T> inline Values::Field* BindParameter(const Handle<Value> source, T pos);
     template <class T> T* Bind(_NAN_METHOD_ARGS, int start = 0, int end = -1);
     bool Bind(const Parameters &parameters);
-
-    static void GetRow(Row* row, sqlite3_stmt* stmt);
-    static Local<Object> RowToJS(Row* row);
+    void ResetHandle();
+    void ClearProfiled();
+
+    static bool ConvertRows(RowsBaton* baton, Local<Array> result);
+    static void ConvertSlice(uv_idle_t* handle, int status);
+    static void AfterConvert(uv_handle_t* handle);
+    static void FinishAll(RowsBaton* baton, Local<Array> result);
+
+    void GetRow(Row* row);
+    void DescribeColumns();
+    static Local<Object> RowToJS(Row* row, const Columns* columns = NULL,
+        size_t* external = NULL);
     void Schedule(Work_Callback callback, Baton* baton);
     void Process();
     void CleanQueue();
     template <class T> static void Error(T* baton);
+    template <class T, Timeline::Work_Callback work, Timeline::Work_Callback after>
+        static void Requeue(void* baton);
 
 protected:
     Database* db;
@@ -242,6 +318,19 @@ protected:
     bool locked;
     bool finalized;
     std::queue<Call*> queue;
+
+    // Parameters of a get() that stopped at a row. SQLite only profiles
+    // the run once the statement is reset or finalized, so they're kept
+    // for its slow query entry until then.
+    Parameters profiled;
+
+    // Overrides the database's result options when set.
+    Database::ResultOptions result_options;
+    bool has_result_options;
+
+    // Set up on the thread pool when the first row is read and not changed
+    // afterwards, so the main thread can use it while rows are read.
+    Columns columns;
 };
 
 }
@@ -16,9 +16,12 @@
 
     #define NODE_SQLITE3_MUTEX_DESTROY CloseHandle(mutex);
 
+    #define NODE_SQLITE3_YIELD SwitchToThread();
+
 #elif defined(NODE_SQLITE3_BOOST_THREADING)
 
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
     #define NODE_SQLITE3_MUTEX_t boost::mutex mutex;
 
@@ -30,8 +33,12 @@
 
     #define NODE_SQLITE3_MUTEX_DESTROY mutex.unlock();
 
+    #define NODE_SQLITE3_YIELD boost::this_thread::yield();
+
 #else
 
+#include <sched.h>
+
     #define NODE_SQLITE3_MUTEX_t pthread_mutex_t mutex;
 
     #define NODE_SQLITE3_MUTEX_INIT pthread_mutex_init(&mutex,NULL);
@@ -42,6 +49,8 @@
 
     #define NODE_SQLITE3_MUTEX_DESTROY pthread_mutex_destroy(&mutex);
 
+    #define NODE_SQLITE3_YIELD sched_yield();
+
 #endif
 
 
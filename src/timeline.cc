@@ -0,0 +1,93 @@
+#include <node.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "timeline.h"
+
+using namespace node_sqlite3;
+
+volatile bool Timeline::enabled = false;
+std::vector<Timeline::Event> Timeline::events;
+std::map<unsigned long, int> Timeline::threads;
+
+void Timeline::Init(Handle<Object> target) {
+    NanScope();
+
+    NODE_SET_METHOD(target, "startTimeline", Start);
+    NODE_SET_METHOD(target, "stopTimeline", Stop);
+}
+
+unsigned long Timeline::CurrentThread() {
+#ifdef _WIN32
+    return (unsigned long)GetCurrentThreadId();
+#else
+    return (unsigned long)pthread_self();
+#endif
+}
+
+void Timeline::Record(const Span& span, uint64_t completed, uint64_t done) {
+    // Note: This function is called in the main V8 thread.
+    if (!enabled) return;
+
+    // Number the thread pool threads in order of appearance; the main
+    // thread is 0.
+    if (threads.find(span.thread) == threads.end()) {
+        int index = threads.size() + 1;
+        threads[span.thread] = index;
+    }
+
+    Event event;
+    event.span = span;
+    event.completed = completed;
+    event.done = done;
+    events.push_back(event);
+}
+
+NAN_METHOD(Timeline::Start) {
+    NanScope();
+
+    events.clear();
+    threads.clear();
+    enabled = true;
+
+    NanReturnUndefined();
+}
+
+static inline Local<Number> Microseconds(uint64_t hrtime) {
+    return NanNew<Number>((double)hrtime / 1000.0);
+}
+
+NAN_METHOD(Timeline::Stop) {
+    NanScope();
+
+    enabled = false;
+
+    std::vector<Event> recorded;
+    recorded.swap(events);
+
+    Local<Array> result(NanNew<Array>(recorded.size()));
+    for (unsigned int i = 0; i < recorded.size(); i++) {
+        const Event& event = recorded[i];
+        const Span& span = event.span;
+
+        Local<Object> item(NanNew<Object>());
+        item->Set(NanNew("name"), NanNew(span.name));
+        item->Set(NanNew("sql"), NanNew<String>(span.sql.c_str()));
+        item->Set(NanNew("thread"), NanNew<Integer>(threads[span.thread]));
+        item->Set(NanNew("scheduled"), Microseconds(span.scheduled));
+        item->Set(NanNew("dequeued"), Microseconds(span.dequeued));
+        item->Set(NanNew("started"), Microseconds(span.started));
+        item->Set(NanNew("finished"), Microseconds(span.finished));
+        item->Set(NanNew("completed"), Microseconds(event.completed));
+        item->Set(NanNew("done"), Microseconds(event.done));
+        result->Set(i, item);
+    }
+
+    threads.clear();
+
+    NanReturnValue(result);
+}
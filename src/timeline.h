@@ -0,0 +1,111 @@
+#ifndef NODE_SQLITE3_SRC_TIMELINE_H
+#define NODE_SQLITE3_SRC_TIMELINE_H
+
+#include <node.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "nan.h"
+
+using namespace v8;
+using namespace node;
+
+namespace node_sqlite3 {
+
+// Opt-in recorder for the life cycle of batons: when they were scheduled,
+// dequeued, run on the thread pool and completed on the main thread.
+// lib/sqlite3.js turns the recorded events into Chrome trace event JSON.
+class Timeline {
+public:
+    typedef void (*Work_Callback)(uv_work_t* req);
+
+    struct Span {
+        Span() : name(NULL), work(NULL), after(NULL), scheduled(0),
+            dequeued(0), started(0), finished(0), thread(0) {}
+
+        const char* name;
+        std::string sql;
+        Work_Callback work;
+        Work_Callback after;
+        // Timestamps from uv_hrtime(); 0 when not recorded.
+        uint64_t scheduled;
+        uint64_t dequeued;
+        uint64_t started;
+        uint64_t finished;
+        unsigned long thread;
+    };
+
+    static void Init(Handle<Object> target);
+
+    static inline void Scheduled(Span& span) {
+        if (enabled) span.scheduled = uv_hrtime();
+    }
+
+    static inline void Dequeued(Span& span) {
+        if (enabled) span.dequeued = uv_hrtime();
+    }
+
+    // Drop-in replacement for uv_queue_work() that wraps the work and
+    // after-work callbacks to record timestamps while the timeline is on.
+    template <class T> static int Queue(T* baton, const char* name, const char* sql,
+            Work_Callback work, Work_Callback after) {
+        if (!enabled) {
+            return uv_queue_work(uv_default_loop(),
+                &baton->request, work, (uv_after_work_cb)after);
+        }
+
+        Span& span = baton->span;
+        span.name = name;
+        span.sql = sql ? sql : "";
+        span.work = work;
+        span.after = after;
+        uint64_t now = uv_hrtime();
+        if (span.scheduled == 0) span.scheduled = now;
+        if (span.dequeued == 0) span.dequeued = now;
+
+        return uv_queue_work(uv_default_loop(),
+            &baton->request, Work<T>, (uv_after_work_cb)AfterWork<T>);
+    }
+
+protected:
+    struct Event {
+        Span span;
+        uint64_t completed;
+        uint64_t done;
+    };
+
+    static NAN_METHOD(Start);
+    static NAN_METHOD(Stop);
+
+    template <class T> static void Work(uv_work_t* req) {
+        // Note: This function is called in the thread pool.
+        Span& span = static_cast<T*>(req->data)->span;
+        span.started = uv_hrtime();
+        span.thread = CurrentThread();
+        span.work(req);
+        span.finished = uv_hrtime();
+    }
+
+    template <class T> static void AfterWork(uv_work_t* req) {
+        // The after-work callback deletes the baton, so keep a copy.
+        Span span = static_cast<T*>(req->data)->span;
+        uint64_t completed = uv_hrtime();
+        span.after(req);
+        Record(span, completed, uv_hrtime());
+    }
+
+    static void Record(const Span& span, uint64_t completed, uint64_t done);
+    static unsigned long CurrentThread();
+
+    static volatile bool enabled;
+    // Only accessed from the main thread.
+    static std::vector<Event> events;
+    static std::map<unsigned long, int> threads;
+};
+
+}
+
+#endif
@@ -0,0 +1,424 @@
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "vector.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define VECTOR_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Lets the kernels use instructions the rest of the module isn't compiled
+// for; they only run after checking the CPU.
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TARGET_SSE
+#define TARGET_AVX2
+#endif
+
+using namespace node_sqlite3;
+
+namespace {
+
+typedef float (*Dot_Kernel)(const unsigned char* a, const unsigned char* b, int n);
+typedef float (*Distance_Kernel)(const unsigned char* a, const unsigned char* b, int n);
+typedef void (*Cosine_Kernel)(const unsigned char* a, const unsigned char* b, int n,
+    float* dot, float* norm_a, float* norm_b);
+
+struct Kernels {
+    const char* name;
+    Dot_Kernel dot;
+    // Squared Euclidean distance.
+    Distance_Kernel l2;
+    Cosine_Kernel cosine;
+};
+
+// BLOB data has no particular alignment.
+inline float Load(const unsigned char* p) {
+    float value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+float DotScalar(const unsigned char* a, const unsigned char* b, int n) {
+    float sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += Load(a + 4 * i) * Load(b + 4 * i);
+    }
+    return sum;
+}
+
+float L2Scalar(const unsigned char* a, const unsigned char* b, int n) {
+    float sum = 0;
+    for (int i = 0; i < n; i++) {
+        float diff = Load(a + 4 * i) - Load(b + 4 * i);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+void CosineScalar(const unsigned char* a, const unsigned char* b, int n,
+        float* dot, float* norm_a, float* norm_b) {
+    float ab = 0, aa = 0, bb = 0;
+    for (int i = 0; i < n; i++) {
+        float x = Load(a + 4 * i);
+        float y = Load(b + 4 * i);
+        ab += x * y;
+        aa += x * x;
+        bb += y * y;
+    }
+    *dot = ab;
+    *norm_a = aa;
+    *norm_b = bb;
+}
+
+#ifdef VECTOR_X86
+
+TARGET_SSE inline float Sum128(__m128 v) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+TARGET_SSE float DotSse(const unsigned char* a, const unsigned char* b, int n) {
+    const float* x = (const float*)a;
+    const float* y = (const float*)b;
+    __m128 sum = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+    }
+    float result = Sum128(sum);
+    for (; i < n; i++) {
+        result += Load(a + 4 * i) * Load(b + 4 * i);
+    }
+    return result;
+}
+
+TARGET_SSE float L2Sse(const unsigned char* a, const unsigned char* b, int n) {
+    const float* x = (const float*)a;
+    const float* y = (const float*)b;
+    __m128 sum = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 diff = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i));
+        sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+    }
+    float result = Sum128(sum);
+    for (; i < n; i++) {
+        float diff = Load(a + 4 * i) - Load(b + 4 * i);
+        result += diff * diff;
+    }
+    return result;
+}
+
+TARGET_SSE void CosineSse(const unsigned char* a, const unsigned char* b, int n,
+        float* dot, float* norm_a, float* norm_b) {
+    const float* x = (const float*)a;
+    const float* y = (const float*)b;
+    __m128 ab = _mm_setzero_ps();
+    __m128 aa = _mm_setzero_ps();
+    __m128 bb = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        ab = _mm_add_ps(ab, _mm_mul_ps(vx, vy));
+        aa = _mm_add_ps(aa, _mm_mul_ps(vx, vx));
+        bb = _mm_add_ps(bb, _mm_mul_ps(vy, vy));
+    }
+    float sum_ab = Sum128(ab), sum_aa = Sum128(aa), sum_bb = Sum128(bb);
+    for (; i < n; i++) {
+        float vx = Load(a + 4 * i);
+        float vy = Load(b + 4 * i);
+        sum_ab += vx * vy;
+        sum_aa += vx * vx;
+        sum_bb += vy * vy;
+    }
+    *dot = sum_ab;
+    *norm_a = sum_aa;
+    *norm_b = sum_bb;
+}
+
+TARGET_AVX2 inline float Sum256(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// The AVX2 kernels keep two accumulators to hide the latency of the fused
+// multiply-adds.
+TARGET_AVX2 float DotAvx2(const unsigned char* a, const unsigned char* b, int n) {
+    const float* x = (const float*)a;
+    const float* y = (const float*)b;
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), sum1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), sum0);
+    }
+    float result = Sum256(_mm256_add_ps(sum0, sum1));
+    for (; i < n; i++) {
+        result += Load(a + 4 * i) * Load(b + 4 * i);
+    }
+    return result;
+}
+
+TARGET_AVX2 float L2Avx2(const unsigned char* a, const unsigned char* b, int n) {
+    const float* x = (const float*)a;
+    const float* y = (const float*)b;
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 diff0 = _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+        __m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8));
+        sum0 = _mm256_fmadd_ps(diff0, diff0, sum0);
+        sum1 = _mm256_fmadd_ps(diff1, diff1, sum1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+        sum0 = _mm256_fmadd_ps(diff, diff, sum0);
+    }
+    float result = Sum256(_mm256_add_ps(sum0, sum1));
+    for (; i < n; i++) {
+        float diff = Load(a + 4 * i) - Load(b + 4 * i);
+        result += diff * diff;
+    }
+    return result;
+}
+
+TARGET_AVX2 void CosineAvx2(const unsigned char* a, const unsigned char* b, int n,
+        float* dot, float* norm_a, float* norm_b) {
+    const float* x = (const float*)a;
+    const float* y = (const float*)b;
+    __m256 ab = _mm256_setzero_ps();
+    __m256 aa = _mm256_setzero_ps();
+    __m256 bb = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+        ab = _mm256_fmadd_ps(vx, vy, ab);
+        aa = _mm256_fmadd_ps(vx, vx, aa);
+        bb = _mm256_fmadd_ps(vy, vy, bb);
+    }
+    float sum_ab = Sum256(ab), sum_aa = Sum256(aa), sum_bb = Sum256(bb);
+    for (; i < n; i++) {
+        float vx = Load(a + 4 * i);
+        float vy = Load(b + 4 * i);
+        sum_ab += vx * vy;
+        sum_aa += vx * vx;
+        sum_bb += vy * vy;
+    }
+    *dot = sum_ab;
+    *norm_a = sum_aa;
+    *norm_b = sum_bb;
+}
+
+bool HasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!fma || !osxsave || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+bool HasSse() {
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;
+#elif defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#else
+    return false;
+#endif
+}
+
+#endif
+
+const Kernels scalar_kernels = { "scalar", DotScalar, L2Scalar, CosineScalar };
+#ifdef VECTOR_X86
+const Kernels sse_kernels = { "sse", DotSse, L2Sse, CosineSse };
+const Kernels avx2_kernels = { "avx2", DotAvx2, L2Avx2, CosineAvx2 };
+#endif
+
+const Kernels* kernels = &scalar_kernels;
+
+// Checks the arguments of a function taking two vectors. Returns false if
+// the result is already set, i.e. for NULL arguments and errors.
+bool GetVectors(sqlite3_context* context, sqlite3_value** argv,
+        const unsigned char** a, const unsigned char** b, int* n) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL ||
+            sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+        sqlite3_result_null(context);
+        return false;
+    }
+
+    const char* name = (const char*)sqlite3_user_data(context);
+    if (sqlite3_value_type(argv[0]) != SQLITE_BLOB ||
+            sqlite3_value_type(argv[1]) != SQLITE_BLOB) {
+        std::string error = std::string(name) + ": arguments must be BLOBs of float32 values";
+        sqlite3_result_error(context, error.c_str(), -1);
+        return false;
+    }
+
+    *a = (const unsigned char*)sqlite3_value_blob(argv[0]);
+    *b = (const unsigned char*)sqlite3_value_blob(argv[1]);
+    int bytes = sqlite3_value_bytes(argv[0]);
+    if (bytes != sqlite3_value_bytes(argv[1]) || bytes % sizeof(float) != 0) {
+        std::string error = std::string(name) + ": vectors must have the same number of dimensions";
+        sqlite3_result_error(context, error.c_str(), -1);
+        return false;
+    }
+    *n = bytes / sizeof(float);
+    return true;
+}
+
+void Dot(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    const unsigned char *a, *b;
+    int n;
+    if (!GetVectors(context, argv, &a, &b, &n)) return;
+    sqlite3_result_double(context, n ? kernels->dot(a, b, n) : 0.0);
+}
+
+void Cosine(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    const unsigned char *a, *b;
+    int n;
+    if (!GetVectors(context, argv, &a, &b, &n)) return;
+
+    float dot = 0, norm_a = 0, norm_b = 0;
+    if (n) kernels->cosine(a, b, n, &dot, &norm_a, &norm_b);
+    // The similarity is undefined for zero vectors.
+    if (norm_a == 0 || norm_b == 0) {
+        sqlite3_result_null(context);
+        return;
+    }
+    sqlite3_result_double(context, dot / sqrt((double)norm_a * norm_b));
+}
+
+void L2(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    const unsigned char *a, *b;
+    int n;
+    if (!GetVectors(context, argv, &a, &b, &n)) return;
+    sqlite3_result_double(context, n ? sqrt((double)kernels->l2(a, b, n)) : 0.0);
+}
+
+// Max-heap of the k smallest scores seen so far.
+struct TopK {
+    typedef std::pair<double, sqlite3_int64> Entry;
+    int k;
+    std::vector<Entry> heap;
+};
+
+void TopKStep(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    TopK** state = (TopK**)sqlite3_aggregate_context(context, sizeof(TopK*));
+    if (state == NULL) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    if (*state == NULL) {
+        if (sqlite3_value_type(argv[2]) != SQLITE_INTEGER || sqlite3_value_int(argv[2]) <= 0) {
+            sqlite3_result_error(context, "vec_top_k: k must be a positive integer", -1);
+            return;
+        }
+        *state = new TopK();
+        (*state)->k = sqlite3_value_int(argv[2]);
+    }
+
+    if (sqlite3_value_type(argv[1]) == SQLITE_NULL) return;
+    if (sqlite3_value_type(argv[0]) != SQLITE_INTEGER) {
+        sqlite3_result_error(context, "vec_top_k: id must be an integer", -1);
+        return;
+    }
+    double score = sqlite3_value_double(argv[1]);
+    // JSON can't represent them, and they don't order anyway.
+    if (score != score || score == HUGE_VAL || score == -HUGE_VAL) return;
+
+    TopK* top = *state;
+    TopK::Entry entry(score, sqlite3_value_int64(argv[0]));
+    if ((int)top->heap.size() < top->k) {
+        top->heap.push_back(entry);
+        std::push_heap(top->heap.begin(), top->heap.end());
+    }
+    else if (entry < top->heap.front()) {
+        std::pop_heap(top->heap.begin(), top->heap.end());
+        top->heap.back() = entry;
+        std::push_heap(top->heap.begin(), top->heap.end());
+    }
+}
+
+void TopKFinal(sqlite3_context* context) {
+    TopK** state = (TopK**)sqlite3_aggregate_context(context, 0);
+    TopK* top = state ? *state : NULL;
+
+    std::string json("[");
+    if (top != NULL) {
+        std::sort_heap(top->heap.begin(), top->heap.end());
+        char entry[64];
+        for (unsigned int i = 0; i < top->heap.size(); i++) {
+            snprintf(entry, sizeof(entry), "%s[%lld,%.17g]", i ? "," : "",
+                (long long)top->heap[i].second, top->heap[i].first);
+            json += entry;
+        }
+        delete top;
+    }
+    json += "]";
+    sqlite3_result_text(context, json.c_str(), json.size(), SQLITE_TRANSIENT);
+}
+
+}
+
+void VectorFunctions::Init() {
+#ifdef VECTOR_X86
+    if (HasAvx2()) {
+        kernels = &avx2_kernels;
+    }
+    else if (HasSse()) {
+        kernels = &sse_kernels;
+    }
+#endif
+}
+
+const char* VectorFunctions::Kernel() {
+    return kernels->name;
+}
+
+int VectorFunctions::Register(sqlite3* db) {
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+    int status = sqlite3_create_function(db, "vec_dot", 2, flags, (void*)"vec_dot", Dot, NULL, NULL);
+    if (status == SQLITE_OK) {
+        status = sqlite3_create_function(db, "vec_cosine", 2, flags, (void*)"vec_cosine", Cosine, NULL, NULL);
+    }
+    if (status == SQLITE_OK) {
+        status = sqlite3_create_function(db, "vec_l2", 2, flags, (void*)"vec_l2", L2, NULL, NULL);
+    }
+    if (status == SQLITE_OK) {
+        status = sqlite3_create_function(db, "vec_top_k", 3, flags, NULL, NULL, TopKStep, TopKFinal);
+    }
+    return status;
+}
@@ -0,0 +1,32 @@
+#ifndef NODE_SQLITE3_SRC_VECTOR_H
+#define NODE_SQLITE3_SRC_VECTOR_H
+
+#include <sqlite3.h>
+
+namespace node_sqlite3 {
+
+// SQL functions over vectors stored as BLOBs of float32 values in native
+// byte order:
+//   vec_dot(a, b)             dot product
+//   vec_cosine(a, b)          cosine similarity
+//   vec_l2(a, b)              Euclidean distance
+//   vec_top_k(id, score, k)   aggregate returning the k integer ids with
+//                             the smallest scores as a JSON array of
+//                             [id, score] pairs, closest first
+// The kernels use AVX2 or SSE when the CPU supports them.
+class VectorFunctions {
+public:
+    // Picks the kernels for this CPU; called once at module load.
+    static void Init();
+
+    // Name of the kernels in use: "avx2", "sse" or "scalar".
+    static const char* Kernel();
+
+    // Registers the functions on the connection. Returns the SQLite result
+    // code.
+    static int Register(sqlite3* db);
+};
+
+}
+
+#endif
@@ -0,0 +1,477 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <sqlite3.h>
+
+#include "vfs_io_uring.h"
+
+using namespace node_sqlite3;
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+// Requests are submitted one at a time because SQLite waits for every read
+// and write, so the rings can stay small.
+#define RING_ENTRIES 8
+
+// Size of the registered buffer, which fits the largest SQLite page.
+#define FIXED_BUFFER_SIZE 65536
+
+const char* const IoUringVfs::Name = "io_uring";
+
+namespace {
+
+class Ring {
+public:
+    Ring() : fd(-1), sq_ring(NULL), cq_ring(NULL), sqes(NULL),
+        buffer(NULL), fixed(false) {}
+
+    ~Ring() {
+        if (buffer) munmap(buffer, FIXED_BUFFER_SIZE);
+        if (sqes) munmap(sqes, sqes_size);
+        if (cq_ring && cq_ring != sq_ring) munmap(cq_ring, cq_size);
+        if (sq_ring) munmap(sq_ring, sq_size);
+        if (fd >= 0) close(fd);
+    }
+
+    bool Init() {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+        if (fd < 0) return false;
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single && cq_size > sq_size) sq_size = cq_size;
+
+        sq_ring = Map(sq_size, IORING_OFF_SQ_RING);
+        if (sq_ring == NULL) return false;
+        cq_ring = single ? sq_ring : Map(cq_size, IORING_OFF_CQ_RING);
+        if (cq_ring == NULL) return false;
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = (struct io_uring_sqe*)Map(sqes_size, IORING_OFF_SQES);
+        if (sqes == NULL) return false;
+
+        sq_head = (unsigned*)(sq_ring + params.sq_off.head);
+        sq_tail = (unsigned*)(sq_ring + params.sq_off.tail);
+        sq_mask = (unsigned*)(sq_ring + params.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq_ring + params.sq_off.array);
+        cq_head = (unsigned*)(cq_ring + params.cq_off.head);
+        cq_tail = (unsigned*)(cq_ring + params.cq_off.tail);
+        cq_mask = (unsigned*)(cq_ring + params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+
+        // Without a registered buffer (e.g. because of RLIMIT_MEMLOCK) the
+        // ring reads and writes the caller's buffers directly.
+        void* memory = mmap(NULL, FIXED_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory != MAP_FAILED) {
+            buffer = (char*)memory;
+            struct iovec iov = { buffer, FIXED_BUFFER_SIZE };
+            fixed = syscall(__NR_io_uring_register, fd,
+                IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+        }
+        return true;
+    }
+
+    // Reads or writes up to len bytes at offset and returns the number of
+    // bytes transferred or a negative errno.
+    int Transfer(bool write, int file, char* data, unsigned len, sqlite3_int64 offset) {
+        bool bounce = fixed && len <= FIXED_BUFFER_SIZE;
+        struct iovec iov = { data, len };
+
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = file;
+        sqe->off = offset;
+        if (bounce) {
+            if (write) memcpy(buffer, data, len);
+            sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->addr = (uint64_t)(uintptr_t)buffer;
+            sqe->len = len;
+            sqe->buf_index = 0;
+        }
+        else {
+            sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->addr = (uint64_t)(uintptr_t)&iov;
+            sqe->len = 1;
+        }
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        int result = Wait();
+        if (bounce && !write && result > 0) memcpy(data, buffer, result);
+        return result;
+    }
+
+protected:
+    char* Map(size_t size, off_t offset) {
+        void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, offset);
+        return memory == MAP_FAILED ? NULL : (char*)memory;
+    }
+
+    // Submits the queued request, waits for its completion and returns its
+    // result.
+    int Wait() {
+        unsigned head = *cq_head;
+        while (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            unsigned pending = *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            int status = syscall(__NR_io_uring_enter, fd, pending, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+            if (status < 0 && errno != EINTR) return -errno;
+        }
+        int result = cqes[head & *cq_mask].res;
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return result;
+    }
+
+    int fd;
+    char* sq_ring;
+    char* cq_ring;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    char* buffer;
+    bool fixed;
+};
+
+// Rings are created by the threads that use them and live as long as the
+// process, like the thread pool threads.
+__thread Ring* thread_ring = NULL;
+__thread bool thread_ring_failed = false;
+
+Ring* ThreadRing() {
+    if (thread_ring == NULL && !thread_ring_failed) {
+        Ring* ring = new Ring();
+        if (ring->Init()) {
+            thread_ring = ring;
+        }
+        else {
+            delete ring;
+            thread_ring_failed = true;
+        }
+    }
+    return thread_ring;
+}
+
+// Leading members of the unix VFS's unixFile, which have been stable across
+// SQLite releases. The descriptor is verified with fstat() before use.
+struct UnixFile {
+    const sqlite3_io_methods* methods;
+    sqlite3_vfs* vfs;
+    void* inode;
+    int fd;
+};
+
+struct File {
+    sqlite3_file base;
+    // The unix VFS's file, allocated right after this struct.
+    sqlite3_file* real;
+    // Descriptor for io_uring or -1 if reads and writes are forwarded.
+    int fd;
+};
+
+sqlite3_vfs vfs;
+sqlite3_vfs* unix_vfs = NULL;
+int available = -1;
+
+inline sqlite3_file* Real(sqlite3_file* file) {
+    return ((File*)file)->real;
+}
+
+int Descriptor(sqlite3_file* real, const char* name) {
+    int fd = ((UnixFile*)real)->fd;
+    struct stat opened, named;
+    if (fd < 0 || fstat(fd, &opened) != 0 || stat(name, &named) != 0 ||
+            opened.st_dev != named.st_dev || opened.st_ino != named.st_ino) {
+        return -1;
+    }
+    return fd;
+}
+
+int Close(sqlite3_file* file) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xClose(real);
+}
+
+int Read(sqlite3_file* file, void* data, int amount, sqlite3_int64 offset) {
+    File* self = (File*)file;
+    Ring* ring = self->fd >= 0 ? ThreadRing() : NULL;
+    if (ring == NULL) {
+        return self->real->pMethods->xRead(self->real, data, amount, offset);
+    }
+
+    int got = 0;
+    while (got < amount) {
+        int result = ring->Transfer(false, self->fd, (char*)data + got,
+            amount - got, offset + got);
+        if (result == -EINTR || result == -EAGAIN) continue;
+        if (result < 0) return SQLITE_IOERR_READ;
+        if (result == 0) break;
+        got += result;
+    }
+
+    if (got < amount) {
+        // Unread parts of the buffer must be zero-filled.
+        memset((char*)data + got, 0, amount - got);
+        return SQLITE_IOERR_SHORT_READ;
+    }
+    return SQLITE_OK;
+}
+
+int Write(sqlite3_file* file, const void* data, int amount, sqlite3_int64 offset) {
+    File* self = (File*)file;
+    Ring* ring = self->fd >= 0 ? ThreadRing() : NULL;
+    if (ring == NULL) {
+        return self->real->pMethods->xWrite(self->real, data, amount, offset);
+    }
+
+    int wrote = 0;
+    while (wrote < amount) {
+        int result = ring->Transfer(true, self->fd, (char*)data + wrote,
+            amount - wrote, offset + wrote);
+        if (result == -EINTR || result == -EAGAIN) continue;
+        if (result == -ENOSPC || result == 0) return SQLITE_FULL;
+        if (result < 0) return SQLITE_IOERR_WRITE;
+        wrote += result;
+    }
+    return SQLITE_OK;
+}
+
+int Truncate(sqlite3_file* file, sqlite3_int64 size) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xTruncate(real, size);
+}
+
+int Sync(sqlite3_file* file, int flags) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xSync(real, flags);
+}
+
+int FileSize(sqlite3_file* file, sqlite3_int64* size) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xFileSize(real, size);
+}
+
+int Lock(sqlite3_file* file, int lock) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xLock(real, lock);
+}
+
+int Unlock(sqlite3_file* file, int lock) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xUnlock(real, lock);
+}
+
+int CheckReservedLock(sqlite3_file* file, int* result) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xCheckReservedLock(real, result);
+}
+
+int FileControl(sqlite3_file* file, int op, void* arg) {
+    sqlite3_file* real = Real(file);
+    if (op == SQLITE_FCNTL_VFSNAME) {
+        *(char**)arg = sqlite3_mprintf("%s", IoUringVfs::Name);
+        return SQLITE_OK;
+    }
+    return real->pMethods->xFileControl(real, op, arg);
+}
+
+int SectorSize(sqlite3_file* file) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xSectorSize(real);
+}
+
+int DeviceCharacteristics(sqlite3_file* file) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xDeviceCharacteristics(real);
+}
+
+int ShmMap(sqlite3_file* file, int page, int size, int extend, void volatile** memory) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xShmMap(real, page, size, extend, memory);
+}
+
+int ShmLock(sqlite3_file* file, int offset, int n, int flags) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xShmLock(real, offset, n, flags);
+}
+
+void ShmBarrier(sqlite3_file* file) {
+    sqlite3_file* real = Real(file);
+    real->pMethods->xShmBarrier(real);
+}
+
+int ShmUnmap(sqlite3_file* file, int remove) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xShmUnmap(real, remove);
+}
+
+int Fetch(sqlite3_file* file, sqlite3_int64 offset, int amount, void** pointer) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xFetch(real, offset, amount, pointer);
+}
+
+int Unfetch(sqlite3_file* file, sqlite3_int64 offset, void* pointer) {
+    sqlite3_file* real = Real(file);
+    return real->pMethods->xUnfetch(real, offset, pointer);
+}
+
+const sqlite3_io_methods methods = {
+    3,
+    Close,
+    Read,
+    Write,
+    Truncate,
+    Sync,
+    FileSize,
+    Lock,
+    Unlock,
+    CheckReservedLock,
+    FileControl,
+    SectorSize,
+    DeviceCharacteristics,
+    ShmMap,
+    ShmLock,
+    ShmBarrier,
+    ShmUnmap,
+    Fetch,
+    Unfetch
+};
+
+int Open(sqlite3_vfs* self, const char* name, sqlite3_file* file, int flags, int* out_flags) {
+    File* wrapper = (File*)file;
+    wrapper->real = (sqlite3_file*)&wrapper[1];
+    wrapper->fd = -1;
+
+    int status = unix_vfs->xOpen(unix_vfs, name, wrapper->real, flags, out_flags);
+    if (wrapper->real->pMethods == NULL) {
+        file->pMethods = NULL;
+        return status;
+    }
+    file->pMethods = &methods;
+
+    // Only database and WAL files see enough I/O to be worth it; journals
+    // and temporary files go through the unix VFS.
+    if (status == SQLITE_OK && available == 1 && name != NULL &&
+            (flags & (SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_WAL))) {
+        wrapper->fd = Descriptor(wrapper->real, name);
+    }
+    return status;
+}
+
+int Delete(sqlite3_vfs* self, const char* name, int sync) {
+    return unix_vfs->xDelete(unix_vfs, name, sync);
+}
+
+int Access(sqlite3_vfs* self, const char* name, int flags, int* result) {
+    return unix_vfs->xAccess(unix_vfs, name, flags, result);
+}
+
+int FullPathname(sqlite3_vfs* self, const char* name, int size, char* result) {
+    return unix_vfs->xFullPathname(unix_vfs, name, size, result);
+}
+
+void* DlOpen(sqlite3_vfs* self, const char* name) {
+    return unix_vfs->xDlOpen(unix_vfs, name);
+}
+
+void DlError(sqlite3_vfs* self, int size, char* message) {
+    unix_vfs->xDlError(unix_vfs, size, message);
+}
+
+void (*DlSym(sqlite3_vfs* self, void* library, const char* symbol))(void) {
+    return unix_vfs->xDlSym(unix_vfs, library, symbol);
+}
+
+void DlClose(sqlite3_vfs* self, void* library) {
+    unix_vfs->xDlClose(unix_vfs, library);
+}
+
+int Randomness(sqlite3_vfs* self, int size, char* result) {
+    return unix_vfs->xRandomness(unix_vfs, size, result);
+}
+
+int Sleep(sqlite3_vfs* self, int microseconds) {
+    return unix_vfs->xSleep(unix_vfs, microseconds);
+}
+
+int CurrentTime(sqlite3_vfs* self, double* result) {
+    return unix_vfs->xCurrentTime(unix_vfs, result);
+}
+
+int GetLastError(sqlite3_vfs* self, int size, char* message) {
+    return unix_vfs->xGetLastError(unix_vfs, size, message);
+}
+
+int CurrentTimeInt64(sqlite3_vfs* self, sqlite3_int64* result) {
+    return unix_vfs->xCurrentTimeInt64(unix_vfs, result);
+}
+
+}
+
+bool IoUringVfs::IsAvailable() {
+    if (available < 0) {
+        // Creating a ring fails with ENOSYS on old kernels and with EPERM
+        // where io_uring is disabled by policy.
+        Ring probe;
+        available = probe.Init() ? 1 : 0;
+    }
+    return available == 1;
+}
+
+int IoUringVfs::Register() {
+    if (unix_vfs != NULL) return SQLITE_OK;
+
+    sqlite3_vfs* base = sqlite3_vfs_find("unix");
+    if (base == NULL) return SQLITE_ERROR;
+    IsAvailable();
+
+    memset(&vfs, 0, sizeof(vfs));
+    vfs.iVersion = 2;
+    vfs.szOsFile = sizeof(File) + base->szOsFile;
+    vfs.mxPathname = base->mxPathname;
+    vfs.zName = Name;
+    vfs.xOpen = Open;
+    vfs.xDelete = Delete;
+    vfs.xAccess = Access;
+    vfs.xFullPathname = FullPathname;
+    vfs.xDlOpen = DlOpen;
+    vfs.xDlError = DlError;
+    vfs.xDlSym = DlSym;
+    vfs.xDlClose = DlClose;
+    vfs.xRandomness = Randomness;
+    vfs.xSleep = Sleep;
+    vfs.xCurrentTime = CurrentTime;
+    vfs.xGetLastError = GetLastError;
+    vfs.xCurrentTimeInt64 = CurrentTimeInt64;
+
+    unix_vfs = base;
+    return sqlite3_vfs_register(&vfs, 0);
+}
@@ -0,0 +1,28 @@
+#ifndef NODE_SQLITE3_SRC_VFS_IO_URING_H
+#define NODE_SQLITE3_SRC_VFS_IO_URING_H
+
+namespace node_sqlite3 {
+
+// SQLite VFS that wraps the default unix VFS and performs the reads and
+// writes of database and WAL files through io_uring. Every thread pool
+// thread owns a ring with a registered bounce buffer, so page-sized I/O
+// needs neither locking nor pinning user pages. Locking, syncing, shared
+// memory and all other files are left to the unix VFS. When the kernel
+// doesn't support io_uring the VFS forwards everything to the unix VFS.
+class IoUringVfs {
+public:
+    static const char* const Name;
+
+    // Checks whether the kernel supports io_uring. Doesn't touch SQLite, so
+    // it is safe to call at module load.
+    static bool IsAvailable();
+
+    // Registers the VFS under Name. This initializes SQLite, so it is only
+    // called when a database asks for the VFS. Returns the SQLite result
+    // code.
+    static int Register();
+};
+
+}
+
+#endif
@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <map>
+#include <sqlite3.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "threading.h"
+#include "vfs_memory.h"
+
+using namespace node_sqlite3;
+
+// Images grow in steps of at least this many bytes.
+#define GROWTH 65536
+
+const char* const MemoryVfs::Name = "memvfs";
+
+namespace {
+
+struct Image {
+    Image(char* data_, size_t size_, bool owned_) :
+        data(data_), size(size_), capacity(size_), owned(owned_) {}
+    ~Image() {
+        if (owned) free(data);
+    }
+
+    char* data;
+    size_t size;
+    size_t capacity;
+    // Images that don't own their memory are read-only.
+    bool owned;
+};
+
+// Files are opened and closed on the thread pool, so the table of images
+// is protected by a mutex. An image itself is only used by the connection
+// that opened it.
+struct Images {
+    NODE_SQLITE3_MUTEX_t
+    std::map<std::string, Image*> images;
+    unsigned int counter;
+
+    void Init() {
+        NODE_SQLITE3_MUTEX_INIT
+        counter = 0;
+    }
+
+    std::string Add(Image* image) {
+        char name[64];
+        NODE_SQLITE3_MUTEX_LOCK(&mutex)
+        snprintf(name, sizeof(name), "/%s-%u", MemoryVfs::Name, ++counter);
+        if (image) images[name] = image;
+        NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
+        return name;
+    }
+
+    Image* Find(const std::string& name, bool create) {
+        NODE_SQLITE3_MUTEX_LOCK(&mutex)
+        Image* image = NULL;
+        std::map<std::string, Image*>::iterator it = images.find(name);
+        if (it != images.end()) {
+            image = it->second;
+        }
+        else if (create) {
+            image = images[name] = new Image(NULL, 0, true);
+        }
+        NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
+        return image;
+    }
+
+    Image* Remove(const std::string& name) {
+        NODE_SQLITE3_MUTEX_LOCK(&mutex)
+        Image* image = NULL;
+        std::map<std::string, Image*>::iterator it = images.find(name);
+        if (it != images.end()) {
+            image = it->second;
+            images.erase(it);
+        }
+        NODE_SQLITE3_MUTEX_UNLOCK(&mutex)
+        return image;
+    }
+};
+
+Images images;
+sqlite3_vfs vfs;
+sqlite3_vfs* default_vfs = NULL;
+
+struct File {
+    sqlite3_file base;
+    Image* image;
+    const char* name;
+    bool temporary;
+    bool delete_on_close;
+};
+
+int Close(sqlite3_file* file) {
+    File* self = (File*)file;
+    if (self->temporary) {
+        delete self->image;
+    }
+    else if (self->delete_on_close) {
+        delete images.Remove(self->name);
+    }
+    return SQLITE_OK;
+}
+
+int Read(sqlite3_file* file, void* data, int amount, sqlite3_int64 offset) {
+    Image* image = ((File*)file)->image;
+    size_t available = (size_t)offset < image->size ? image->size - offset : 0;
+    if (available >= (size_t)amount) {
+        memcpy(data, image->data + offset, amount);
+        return SQLITE_OK;
+    }
+
+    // Unread parts of the buffer must be zero-filled.
+    if (available > 0) memcpy(data, image->data + offset, available);
+    memset((char*)data + available, 0, amount - available);
+    return SQLITE_IOERR_SHORT_READ;
+}
+
+int Write(sqlite3_file* file, const void* data, int amount, sqlite3_int64 offset) {
+    Image* image = ((File*)file)->image;
+    if (!image->owned) return SQLITE_READONLY;
+
+    size_t end = offset + amount;
+    if (end > image->capacity) {
+        size_t capacity = image->capacity * 2;
+        if (capacity < end) capacity = end;
+        if (capacity < GROWTH) capacity = GROWTH;
+        char* resized = (char*)realloc(image->data, capacity);
+        if (resized == NULL) return SQLITE_FULL;
+        image->data = resized;
+        image->capacity = capacity;
+    }
+    if ((size_t)offset > image->size) {
+        memset(image->data + image->size, 0, offset - image->size);
+    }
+    memcpy(image->data + offset, data, amount);
+    if (end > image->size) image->size = end;
+    return SQLITE_OK;
+}
+
+int Truncate(sqlite3_file* file, sqlite3_int64 size) {
+    Image* image = ((File*)file)->image;
+    if (!image->owned) return SQLITE_READONLY;
+    if ((size_t)size < image->size) image->size = size;
+    return SQLITE_OK;
+}
+
+int Sync(sqlite3_file* file, int flags) {
+    return SQLITE_OK;
+}
+
+int FileSize(sqlite3_file* file, sqlite3_int64* size) {
+    *size = ((File*)file)->image->size;
+    return SQLITE_OK;
+}
+
+// Every image belongs to a single connection, so there's nothing to lock.
+int Lock(sqlite3_file* file, int lock) {
+    return SQLITE_OK;
+}
+
+int Unlock(sqlite3_file* file, int lock) {
+    return SQLITE_OK;
+}
+
+int CheckReservedLock(sqlite3_file* file, int* result) {
+    *result = 0;
+    return SQLITE_OK;
+}
+
+int FileControl(sqlite3_file* file, int op, void* arg) {
+    return SQLITE_NOTFOUND;
+}
+
+int SectorSize(sqlite3_file* file) {
+    return 4096;
+}
+
+int DeviceCharacteristics(sqlite3_file* file) {
+    return SQLITE_IOCAP_ATOMIC | SQLITE_IOCAP_SAFE_APPEND |
+        SQLITE_IOCAP_SEQUENTIAL | SQLITE_IOCAP_POWERSAFE_OVERWRITE;
+}
+
+const sqlite3_io_methods methods = {
+    1,
+    Close,
+    Read,
+    Write,
+    Truncate,
+    Sync,
+    FileSize,
+    Lock,
+    Unlock,
+    CheckReservedLock,
+    FileControl,
+    SectorSize,
+    DeviceCharacteristics
+};
+
+int Open(sqlite3_vfs* self, const char* name, sqlite3_file* file, int flags, int* out_flags) {
+    File* wrapper = (File*)file;
+    file->pMethods = NULL;
+
+    if (name == NULL) {
+        // Temporary files without a name aren't visible to anyone else and
+        // only live as long as they are open.
+        wrapper->image = new Image(NULL, 0, true);
+        wrapper->temporary = true;
+        wrapper->delete_on_close = false;
+    }
+    else {
+        Image* image = images.Find(name, (flags & SQLITE_OPEN_CREATE) != 0);
+        if (image == NULL) return SQLITE_CANTOPEN;
+        if (!image->owned && (flags & SQLITE_OPEN_READWRITE)) return SQLITE_READONLY;
+        wrapper->image = image;
+        wrapper->temporary = false;
+        wrapper->delete_on_close = (flags & SQLITE_OPEN_DELETEONCLOSE) != 0;
+    }
+    // SQLite keeps the name alive as long as the file is open.
+    wrapper->name = name;
+
+    if (out_flags) *out_flags = flags;
+    file->pMethods = &methods;
+    return SQLITE_OK;
+}
+
+int Delete(sqlite3_vfs* self, const char* name, int sync) {
+    delete images.Remove(name);
+    return SQLITE_OK;
+}
+
+int Access(sqlite3_vfs* self, const char* name, int flags, int* result) {
+    *result = images.Find(name, false) != NULL;
+    return SQLITE_OK;
+}
+
+int FullPathname(sqlite3_vfs* self, const char* name, int size, char* result) {
+    sqlite3_snprintf(size, result, "%s", name);
+    return SQLITE_OK;
+}
+
+void* DlOpen(sqlite3_vfs* self, const char* name) {
+    return NULL;
+}
+
+void DlError(sqlite3_vfs* self, int size, char* message) {
+    sqlite3_snprintf(size, message, "Loadable extensions are not supported");
+}
+
+void (*DlSym(sqlite3_vfs* self, void* library, const char* symbol))(void) {
+    return NULL;
+}
+
+void DlClose(sqlite3_vfs* self, void* library) {
+}
+
+int Randomness(sqlite3_vfs* self, int size, char* result) {
+    return default_vfs->xRandomness(default_vfs, size, result);
+}
+
+int Sleep(sqlite3_vfs* self, int microseconds) {
+    return default_vfs->xSleep(default_vfs, microseconds);
+}
+
+int CurrentTime(sqlite3_vfs* self, double* result) {
+    return default_vfs->xCurrentTime(default_vfs, result);
+}
+
+int GetLastError(sqlite3_vfs* self, int size, char* message) {
+    return 0;
+}
+
+}
+
+int MemoryVfs::Register() {
+    if (default_vfs != NULL) return SQLITE_OK;
+
+    sqlite3_vfs* base = sqlite3_vfs_find(NULL);
+    if (base == NULL) return SQLITE_ERROR;
+    images.Init();
+
+    memset(&vfs, 0, sizeof(vfs));
+    vfs.iVersion = 1;
+    vfs.szOsFile = sizeof(File);
+    vfs.mxPathname = 512;
+    vfs.zName = Name;
+    vfs.xOpen = Open;
+    vfs.xDelete = Delete;
+    vfs.xAccess = Access;
+    vfs.xFullPathname = FullPathname;
+    vfs.xDlOpen = DlOpen;
+    vfs.xDlError = DlError;
+    vfs.xDlSym = DlSym;
+    vfs.xDlClose = DlClose;
+    vfs.xRandomness = Randomness;
+    vfs.xSleep = Sleep;
+    vfs.xCurrentTime = CurrentTime;
+    vfs.xGetLastError = GetLastError;
+
+    default_vfs = base;
+    return sqlite3_vfs_register(&vfs, 0);
+}
+
+std::string MemoryVfs::Add(char* data, size_t size, bool copy) {
+    Image* image;
+    if (copy) {
+        char* owned = (char*)malloc(size ? size : 1);
+        if (owned == NULL) return std::string();
+        memcpy(owned, data, size);
+        image = new Image(owned, size, true);
+    }
+    else {
+        image = new Image(data, size, false);
+    }
+    return images.Add(image);
+}
+
+std::string MemoryVfs::Create() {
+    return images.Add(NULL);
+}
+
+int MemoryVfs::Take(const std::string& name, char** data, size_t* size) {
+    Image* image = images.Remove(name);
+    if (image == NULL) return SQLITE_NOTFOUND;
+
+    if (image->owned) {
+        *data = image->data;
+        image->owned = false;
+    }
+    else {
+        *data = (char*)malloc(image->size ? image->size : 1);
+        if (*data == NULL) {
+            delete image;
+            return SQLITE_NOMEM;
+        }
+        memcpy(*data, image->data, image->size);
+    }
+    *size = image->size;
+    delete image;
+    return SQLITE_OK;
+}
+
+void MemoryVfs::Remove(const std::string& name) {
+    delete images.Remove(name);
+}
@@ -0,0 +1,40 @@
+#ifndef NODE_SQLITE3_SRC_VFS_MEMORY_H
+#define NODE_SQLITE3_SRC_VFS_MEMORY_H
+
+#include <stddef.h>
+#include <string>
+
+namespace node_sqlite3 {
+
+// SQLite VFS that keeps files as images in memory. A database image can be
+// backed by memory owned by someone else (e.g. a Buffer) for read-only use,
+// and journals or other files created by SQLite live in memory as well.
+// Images are identified by unique names handed out by Add() and Create().
+class MemoryVfs {
+public:
+    static const char* const Name;
+
+    // Registers the VFS under Name; does nothing if it is registered
+    // already. Returns the SQLite result code.
+    static int Register();
+
+    // Adds a database image and returns its file name. Unless copy is set,
+    // the memory is used in place and has to stay valid until the image is
+    // removed; such images can only be opened read-only. Returns an empty
+    // name if the copy can't be allocated.
+    static std::string Add(char* data, size_t size, bool copy);
+
+    // Returns a file name for an empty image created when it is opened.
+    static std::string Create();
+
+    // Removes the image and hands its memory, allocated with malloc(), to
+    // the caller. Returns SQLITE_NOTFOUND if there's no image with this
+    // name and SQLITE_NOMEM if its memory can't be copied.
+    static int Take(const std::string& name, char** data, size_t* size);
+
+    static void Remove(const std::string& name);
+};
+
+}
+
+#endif
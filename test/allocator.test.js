@@ -0,0 +1,38 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var child_process = require('child_process');
+var path = require('path');
+
+describe('allocator', function() {
+    it('should report memory statistics', function() {
+        var stats = sqlite3.memoryStats();
+        assert.equal(stats.allocator, 'system');
+        assert.ok(typeof stats.used === "number");
+        assert.ok(typeof stats.highwater === "number");
+    });
+
+    it('should install the pool allocator from the environment', function(done) {
+        var env = {};
+        for (var k in process.env) env[k] = process.env[k];
+        env.NODE_SQLITE3_MALLOC = 'pool';
+
+        var script =
+            "var sqlite3 = require(" + JSON.stringify(path.join(__dirname, '..')) + ");" +
+            "var db = new sqlite3.Database(':memory:');" +
+            "db.all('SELECT randomblob(100000) AS a, randomblob(100) AS b', function(err, rows) {" +
+            "  if (err) throw err;" +
+            "  db.close(function() { console.log(JSON.stringify(sqlite3.memoryStats())); });" +
+            "});";
+
+        child_process.execFile(process.execPath, [ '-e', script ], { env: env }, function(err, stdout) {
+            if (err) throw err;
+            var stats = JSON.parse(stdout);
+            assert.equal(stats.allocator, 'pool');
+            assert.ok(stats.allocations > 0);
+            assert.ok(stats.reserved > 0);
+            assert.ok(stats.cacheHits > 0);
+            assert.equal(stats.large, 0);
+            done();
+        });
+    });
+});
@@ -0,0 +1,109 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('backup', function() {
+    var source = 'test/tmp/test_backup_source.db';
+    var target = 'test/tmp/test_backup_target.db';
+    var db;
+
+    before(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile(source);
+        helper.deleteFile(target);
+        db = new sqlite3.Database(source);
+        db.exec("CREATE TABLE foo (id INT, data BLOB);" +
+            "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 1000) " +
+            "INSERT INTO foo SELECT x, randomblob(1000) FROM c;", done);
+    });
+
+    it('should copy the database step by step', function(done) {
+        var progress = [];
+        var queried = false;
+        db.on('backup', function(status) {
+            assert.equal(status.filename, target);
+            progress.push(status);
+        });
+
+        db.backup(target, { pagesPerStep: 50, pauseMs: 1 }, function(err) {
+            if (err) throw err;
+            db.removeAllListeners('backup');
+            assert.ok(queried);
+            assert.ok(progress.length > 2);
+            assert.equal(progress[progress.length - 1].remaining, 0);
+            assert.ok(progress[0].remaining < progress[0].pageCount);
+
+            var copy = new sqlite3.Database(target, sqlite3.OPEN_READONLY);
+            copy.get("SELECT count(*) AS count, sum(length(data)) AS size FROM foo", function(err, row) {
+                if (err) throw err;
+                assert.deepEqual(row, { count: 1000, size: 1000000 });
+                copy.close(done);
+            });
+        });
+
+        // Queries run while the backup is in progress.
+        db.get("SELECT count(*) AS count FROM foo", function(err, row) {
+            if (err) throw err;
+            assert.equal(row.count, 1000);
+            queried = true;
+        });
+    });
+
+    it('should run serialized queries between steps', function(done) {
+        var finished = false;
+        var queried = false;
+        db.serialize(function() {
+            db.backup(target, { pagesPerStep: 10, pauseMs: 5 }, function(err) {
+                if (err) throw err;
+                finished = true;
+                assert.ok(queried);
+                done();
+            });
+            db.get("SELECT count(*) AS count FROM foo", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.count, 1000);
+                assert.ok(!finished);
+                queried = true;
+            });
+        });
+    });
+
+    it('should report errors', function(done) {
+        db.backup('test/tmp/does/not/exist.db', function(err) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_CANTOPEN');
+            done();
+        });
+    });
+
+    it('should validate options', function() {
+        assert.throws(function() {
+            db.backup(target, { pagesPerStep: 0 });
+        }, /pagesPerStep must be a non-zero integer/);
+        assert.throws(function() {
+            db.backup(target, { pauseMs: -1 });
+        }, /pauseMs must be a non-negative integer/);
+    });
+
+    it('should finish the backup before closing', function(done) {
+        var other = new sqlite3.Database(source);
+        var finished = false;
+        other.backup(target, { pagesPerStep: 50 }, function(err) {
+            if (err) throw err;
+            finished = true;
+        });
+        other.close(function(err) {
+            if (err) throw err;
+            assert.ok(finished);
+            done();
+        });
+    });
+
+    after(function(done) {
+        db.close(function() {
+            helper.deleteFile(source);
+            helper.deleteFile(target);
+            done();
+        });
+    });
+});
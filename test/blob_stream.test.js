@@ -0,0 +1,107 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('blob streams', function() {
+    var db;
+    var data = new Buffer(300000);
+    for (var i = 0; i < data.length; i++) data[i] = i % 251;
+
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.serialize(function() {
+            db.run("CREATE TABLE files (id INTEGER PRIMARY KEY, content BLOB)");
+            db.run("INSERT INTO files VALUES (1, zeroblob(?))", data.length);
+            db.run("INSERT INTO files VALUES (2, ?)", new Buffer('second'), done);
+        });
+    });
+
+    function collect(stream, callback) {
+        var chunks = [];
+        stream.on('data', function(chunk) { chunks.push(chunk); });
+        stream.on('error', callback);
+        stream.on('end', function() { callback(null, Buffer.concat(chunks)); });
+    }
+
+    it('should write a blob through a stream', function(done) {
+        var blob = db.openBlob('files', 'content', 1, { writable: true }, function(err) {
+            if (err) throw err;
+            assert.equal(blob.size, data.length);
+            var stream = blob.createWriteStream();
+            stream.on('finish', function() {
+                blob.close(done);
+            });
+            for (var i = 0; i < data.length; i += 50000) {
+                stream.write(data.slice(i, i + 50000));
+            }
+            stream.end();
+        });
+    });
+
+    it('should read a blob in chunks through a stream', function(done) {
+        var blob = db.openBlob('files', 'content', 1);
+        var chunks = 0;
+        var stream = blob.createReadStream({ highWaterMark: 16384 });
+        stream.on('data', function() { chunks++; });
+        collect(stream, function(err, result) {
+            if (err) throw err;
+            assert.ok(chunks > 10);
+            assert.equal(result.toString('hex'), data.toString('hex'));
+            blob.close(done);
+        });
+    });
+
+    it('should read a range and reopen another row', function(done) {
+        var blob = db.openBlob('files', 'content', 1);
+        collect(blob.createReadStream({ start: 1000, end: 1010 }), function(err, result) {
+            if (err) throw err;
+            assert.equal(result.toString('hex'), data.slice(1000, 1010).toString('hex'));
+            blob.reopen(2, function(err) {
+                if (err) throw err;
+                assert.equal(blob.size, 6);
+                blob.read(0, 100, function(err, chunk) {
+                    if (err) throw err;
+                    assert.equal(chunk.toString(), 'second');
+                    blob.close(done);
+                });
+            });
+        });
+    });
+
+    it('should not write to a read-only blob', function(done) {
+        var blob = db.openBlob('files', 'content', 2);
+        blob.write(0, new Buffer('x'), function(err) {
+            assert.equal(err.code, 'SQLITE_READONLY');
+            blob.close(done);
+        });
+    });
+
+    it('should not write past the end of a blob', function(done) {
+        var blob = db.openBlob('files', 'content', 2, { writable: true });
+        blob.write(4, new Buffer('long'), function(err) {
+            assert.equal(err.code, 'SQLITE_ERROR');
+            blob.close(done);
+        });
+    });
+
+    it('should report missing rows', function(done) {
+        db.openBlob('files', 'content', 3, function(err) {
+            assert.equal(err.code, 'SQLITE_ERROR');
+            assert.ok(/no such rowid: 3/.test(err.message));
+            done();
+        });
+    });
+
+    it('should fail operations after closing', function(done) {
+        var blob = db.openBlob('files', 'content', 2);
+        blob.close();
+        blob.read(0, 1, function(err) {
+            assert.equal(err.code, 'SQLITE_MISUSE');
+            assert.ok(/Blob is already closed/.test(err.message));
+            done();
+        });
+    });
+
+    after(function(done) {
+        db.close(done);
+    });
+});
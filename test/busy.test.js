@@ -0,0 +1,81 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('busy retry', function() {
+    var filename = 'test/tmp/busy.db';
+    var holder, waiter;
+
+    before(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile(filename);
+        holder = new sqlite3.Database(filename);
+        holder.exec("CREATE TABLE foo (id INTEGER)", function(err) {
+            if (err) throw err;
+            waiter = new sqlite3.Database(filename, done);
+        });
+    });
+
+    it('should reject invalid policies', function() {
+        assert.throws(function() {
+            waiter.configure('busyPolicy', 'spin');
+        }, /"wait" or "retry"/);
+    });
+
+    it('should retry statements until the lock is released', function(done) {
+        waiter.configure('busyPolicy', 'retry');
+        waiter.configure('busyTimeout', 5000);
+        holder.exec("BEGIN EXCLUSIVE", function(err) {
+            if (err) throw err;
+            var released = false;
+            waiter.run("INSERT INTO foo VALUES (1)", function(err) {
+                if (err) throw err;
+                assert.ok(released);
+                assert.ok(waiter.metrics().busyRetries > 0);
+                done();
+            });
+            setTimeout(function() {
+                released = true;
+                holder.exec("COMMIT");
+            }, 100);
+        });
+    });
+
+    it('should continue scripts at the statement that was busy', function(done) {
+        holder.exec("BEGIN EXCLUSIVE", function(err) {
+            if (err) throw err;
+            waiter.exec("DELETE FROM foo; INSERT INTO foo VALUES (2); INSERT INTO foo VALUES (3)", function(err) {
+                if (err) throw err;
+                waiter.all("SELECT id FROM foo ORDER BY id", function(err, rows) {
+                    if (err) throw err;
+                    assert.deepEqual(rows, [ { id: 2 }, { id: 3 } ]);
+                    done();
+                });
+            });
+            setTimeout(function() {
+                holder.exec("COMMIT");
+            }, 100);
+        });
+    });
+
+    it('should fail after the busy timeout', function(done) {
+        waiter.configure('busyTimeout', 50);
+        holder.exec("BEGIN EXCLUSIVE", function(err) {
+            if (err) throw err;
+            var timeouts = waiter.metrics().busyTimeouts;
+            waiter.run("INSERT INTO foo VALUES (4)", function(err) {
+                assert.ok(err);
+                assert.equal(err.code, 'SQLITE_BUSY');
+                assert.equal(waiter.metrics().busyTimeouts, timeouts + 1);
+                holder.exec("COMMIT", done);
+            });
+        });
+    });
+
+    after(function(done) {
+        waiter.close(function(err) {
+            if (err) throw err;
+            holder.close(done);
+        });
+    });
+});
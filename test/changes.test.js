@@ -0,0 +1,140 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('change feed', function() {
+    var db;
+    var feed = [];
+    function listener(changes) { feed.push(changes); }
+
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.run("CREATE TABLE foo (id INTEGER PRIMARY KEY, txt TEXT)");
+        db.run("CREATE TABLE bar (id INTEGER PRIMARY KEY)", done);
+        db.on('changes', listener);
+    });
+
+    it('should deliver one event per transaction', function(done) {
+        db.serialize(function() {
+            db.run("BEGIN");
+            var stmt = db.prepare("INSERT INTO foo VALUES (?, ?)");
+            for (var i = 10; i > 0; i--) {
+                stmt.run(i, 'Row ' + i);
+            }
+            stmt.finalize();
+            db.run("UPDATE foo SET txt = 'changed' WHERE id <= 3");
+            db.run("UPDATE foo SET txt = 'changed again' WHERE id <= 2");
+            db.run("DELETE FROM foo WHERE id = 10");
+            db.run("INSERT INTO bar VALUES (42)");
+            db.run("COMMIT", function(err) {
+                if (err) throw err;
+                setImmediate(function() {
+                    assert.equal(feed.length, 1);
+                    assert.deepEqual(feed[0], {
+                        foo: {
+                            insert: [ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 ],
+                            update: [ 1, 2, 3 ],
+                            delete: [ 10 ]
+                        },
+                        bar: { insert: [ 42 ] }
+                    });
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should treat autocommit statements as transactions', function(done) {
+        feed = [];
+        db.run("DELETE FROM foo WHERE id > 5", function(err) {
+            if (err) throw err;
+            setImmediate(function() {
+                assert.deepEqual(feed, [ { foo: { delete: [ 6, 7, 8, 9 ] } } ]);
+                done();
+            });
+        });
+    });
+
+    it('should discard rolled back changes', function(done) {
+        feed = [];
+        db.serialize(function() {
+            db.run("BEGIN");
+            db.run("DELETE FROM foo");
+            db.run("ROLLBACK", function(err) {
+                if (err) throw err;
+                setImmediate(function() {
+                    assert.deepEqual(feed, []);
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should stop delivering after removing the listener', function(done) {
+        feed = [];
+        db.removeListener('changes', listener);
+        db.run("DELETE FROM foo", function(err) {
+            if (err) throw err;
+            setImmediate(function() {
+                assert.deepEqual(feed, []);
+                done();
+            });
+        });
+    });
+
+    after(function(done) {
+        db.close(done);
+    });
+});
+
+describe('change feed with a busy commit', function() {
+    var filename = 'test/tmp/changes_busy.db';
+    var db, reader;
+    var feed = [];
+
+    before(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile(filename);
+        db = new sqlite3.Database(filename);
+        db.configure('busyTimeout', 0);
+        db.on('changes', function(changes) { feed.push(changes); });
+        db.run("CREATE TABLE foo (id INTEGER PRIMARY KEY)", function(err) {
+            if (err) throw err;
+            reader = new sqlite3.Database(filename, done);
+        });
+    });
+
+    it('should only deliver changes once the commit is done', function(done) {
+        // The open read transaction keeps the COMMIT from getting the lock.
+        reader.exec("BEGIN; SELECT * FROM foo", function(err) {
+            if (err) throw err;
+            db.serialize(function() {
+                db.run("BEGIN");
+                db.run("INSERT INTO foo VALUES (1)");
+                db.run("COMMIT", function(err) {
+                    assert.equal(err.code, 'SQLITE_BUSY');
+                    setImmediate(function() {
+                        assert.deepEqual(feed, []);
+                        reader.exec("COMMIT", function(err) {
+                            if (err) throw err;
+                            db.run("COMMIT", function(err) {
+                                if (err) throw err;
+                                setImmediate(function() {
+                                    assert.deepEqual(feed, [ { foo: { insert: [ 1 ] } } ]);
+                                    done();
+                                });
+                            });
+                        });
+                    });
+                });
+            });
+        });
+    });
+
+    after(function(done) {
+        reader.close(function(err) {
+            if (err) throw err;
+            db.close(done);
+        });
+    });
+});
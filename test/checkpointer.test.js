@@ -0,0 +1,66 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var fs = require('fs');
+var helper = require('./support/helper');
+
+describe('checkpointer', function() {
+    var filename = 'test/tmp/checkpointer.db';
+    var db;
+
+    before(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile(filename);
+        helper.deleteFile(filename + '-wal');
+        db = new sqlite3.Database(filename);
+        db.exec("PRAGMA journal_mode = WAL; CREATE TABLE foo (id INTEGER, data BLOB)", done);
+    });
+
+    it('should reject invalid options', function() {
+        assert.throws(function() {
+            db.configure('checkpointer', { pages: 0 });
+        }, /pages must be a positive integer/);
+        assert.throws(function() {
+            db.configure('checkpointer', { pages: 100, limit: 10 });
+        }, /limit must be an integer of at least pages/);
+    });
+
+    it('should checkpoint in the background', function(done) {
+        db.configure('checkpointer', { pages: 20, limit: 200 });
+        db.serialize(function() {
+            var stmt = db.prepare("INSERT INTO foo VALUES (?, randomblob(2000))");
+            for (var i = 0; i < 1000; i++) stmt.run(i);
+            stmt.finalize();
+        });
+        db.wait(function check() {
+            if (db.metrics().checkpoints === 0) return setTimeout(check, 10);
+            assert.ok(db.metrics().walFrames >= 20);
+            // Each row takes a page, so the WAL would be several megabytes
+            // without checkpoints.
+            assert.ok(fs.statSync(filename + '-wal').size < 1024 * 1024);
+            done();
+        });
+    });
+
+    it('should go back to automatic checkpoints', function(done) {
+        db.configure('checkpointer', false);
+        db.run("INSERT INTO foo VALUES (1000, NULL)", function(err) {
+            if (err) throw err;
+            assert.equal(db.metrics().checkpoints, 0);
+            done();
+        });
+    });
+
+    it('should need a database file', function(done) {
+        var memory = new sqlite3.Database(':memory:');
+        memory.on('error', function(err) {
+            assert.equal(err.code, 'SQLITE_MISUSE');
+            assert.ok(/needs a database file/.test(err.message));
+            memory.close(done);
+        });
+        memory.configure('checkpointer', true);
+    });
+
+    after(function(done) {
+        db.close(done);
+    });
+});
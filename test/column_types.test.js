@@ -0,0 +1,62 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('column types', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.serialize(function() {
+            db.run("CREATE TABLE foo (id INTEGER, score REAL, name VARCHAR(20), data)");
+            db.run("INSERT INTO foo VALUES (1, 1.5, 'one', 1)");
+            db.run("INSERT INTO foo VALUES (NULL, NULL, NULL, NULL)");
+            db.run("INSERT INTO foo VALUES (9007199254740991, 2, 'three', 'text')");
+            db.run("INSERT INTO foo VALUES (-2147483649, 'not a number', 4, x'0102')");
+            db.run("INSERT INTO foo VALUES ('five', -0.5, 5.5, 2.5)", done);
+        });
+    });
+
+    var expected = [
+        { id: 1, score: 1.5, name: 'one', data: 1 },
+        { id: null, score: null, name: null, data: null },
+        { id: 9007199254740991, score: 2, name: 'three', data: 'text' },
+        { id: -2147483649, score: 'not a number', name: '4', data: new Buffer([ 1, 2 ]) },
+        { id: 'five', score: -0.5, name: '5.5', data: 2.5 }
+    ];
+
+    function check(rows) {
+        assert.equal(rows.length, expected.length);
+        rows.forEach(function(row, i) {
+            assert.deepEqual(row, expected[i]);
+        });
+    }
+
+    it('should convert values that differ from the first row', function(done) {
+        db.all("SELECT * FROM foo ORDER BY rowid", function(err, rows) {
+            if (err) throw err;
+            check(rows);
+            done();
+        });
+    });
+
+    it('should use the declared types when the first row is NULL', function(done) {
+        db.all("SELECT * FROM foo ORDER BY id IS NOT NULL, rowid", function(err, rows) {
+            if (err) throw err;
+            check([ rows[1], rows[0], rows[2], rows[3], rows[4] ]);
+            done();
+        });
+    });
+
+    it('should convert rows of each()', function(done) {
+        var rows = [];
+        db.each("SELECT * FROM foo ORDER BY rowid", function(err, row) {
+            if (err) throw err;
+            rows.push(row);
+        }, function(err) {
+            if (err) throw err;
+            check(rows);
+            done();
+        });
+    });
+
+    after(function(done) { db.close(done); });
+});
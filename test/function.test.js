@@ -0,0 +1,137 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('user functions', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.exec("CREATE TABLE foo (id INT, name TEXT, score REAL);" +
+            "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 3000) " +
+            "INSERT INTO foo SELECT x, 'name ' || x, x / 10.0 FROM c;", done);
+    });
+
+    it('should call a scalar function', function(done) {
+        db.function('add_prefix', function(prefix, value) {
+            return prefix + value;
+        }, { deterministic: true }, function(err) {
+            if (err) throw err;
+            db.get("SELECT add_prefix('x', name) AS value FROM foo WHERE id = 7", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.value, 'xname 7');
+                done();
+            });
+        });
+    });
+
+    it('should convert arguments and results', function(done) {
+        db.function('echo', function(value) { return value; });
+        db.get("SELECT echo(1) AS i, echo(2.5) AS f, echo('text') AS t, " +
+                "echo(x'0102') AS b, echo(NULL) AS n", function(err, row) {
+            if (err) throw err;
+            assert.equal(row.i, 1);
+            assert.equal(row.f, 2.5);
+            assert.equal(row.t, 'text');
+            assert.deepEqual(Array.prototype.slice.call(row.b), [ 1, 2 ]);
+            assert.equal(row.n, null);
+            done();
+        });
+    });
+
+    it('should batch calls of concurrent queries', function(done) {
+        var invocations = 0;
+        var calls = 0;
+        function doubleScore(rows) {
+            invocations++;
+            calls += rows.length;
+            return rows.map(function(args) { return args[0] * 2; });
+        }
+
+        // A connection runs one call at a time, so only calls from
+        // different connections end up in a batch.
+        var remaining = 4;
+        function query(other) {
+            other.serialize(function() {
+                other.function('double_score', doubleScore, { batch: true });
+                other.exec("CREATE TABLE foo (score REAL);" +
+                    "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 3000) " +
+                    "INSERT INTO foo SELECT x / 10.0 FROM c;");
+                other.get("SELECT sum(double_score(score)) AS total FROM foo", function(err, row) {
+                    if (err) throw err;
+                    assert.equal(Math.round(row.total), 900300);
+                    other.close();
+                    if (--remaining) return;
+                    assert.equal(calls, 12000);
+                    assert.ok(invocations < calls);
+                    done();
+                });
+            });
+        }
+        for (var i = 0; i < 4; i++) query(new sqlite3.Database(':memory:'));
+    });
+
+    it('should run aggregates', function(done) {
+        db.function('product_mod', {
+            start: 1,
+            step: function(total, value) { return (total * value) % 1000003; }
+        });
+        db.function('collect', {
+            start: function() { return []; },
+            step: function(list, rows) {
+                rows.forEach(function(args) { list.push(args[0]); });
+                return list;
+            },
+            result: function(list) { return list.length + ':' + list[list.length - 1]; }
+        }, { batch: true });
+
+        db.all("SELECT id % 3 AS grp, collect(id) AS list, product_mod(id) AS product " +
+                "FROM foo GROUP BY grp ORDER BY grp", function(err, rows) {
+            if (err) throw err;
+            assert.equal(rows.length, 3);
+            assert.equal(rows[0].list, '1000:3000');
+            assert.equal(rows[1].list, '1000:2998');
+            assert.equal(rows[2].list, '1000:2999');
+            var expected = 1;
+            for (var i = 3; i <= 3000; i += 3) expected = (expected * i) % 1000003;
+            assert.equal(rows[0].product, expected);
+            done();
+        });
+    });
+
+    it('should return the start value for empty groups', function(done) {
+        db.get("SELECT product_mod(id) AS product FROM foo WHERE id < 0", function(err, row) {
+            if (err) throw err;
+            assert.equal(row.product, 1);
+            done();
+        });
+    });
+
+    it('should report exceptions as query errors', function(done) {
+        db.function('fail', function() { throw new Error('boom'); });
+        db.get("SELECT fail() AS value", function(err) {
+            assert.equal(err.code, 'SQLITE_ERROR');
+            assert.ok(/boom/.test(err.message));
+            done();
+        });
+    });
+
+    it('should reject unsupported results', function(done) {
+        db.function('object', function() { return {}; });
+        db.get("SELECT object() AS value", function(err) {
+            assert.ok(/Unsupported result type of function object/.test(err.message));
+            done();
+        });
+    });
+
+    it('should validate the implementation', function() {
+        assert.throws(function() {
+            db.function('bad', 42);
+        }, /Function or aggregate object expected/);
+        assert.throws(function() {
+            db.function('bad', { start: 0 });
+        }, /Aggregate step must be a function/);
+    });
+
+    after(function(done) {
+        db.close(done);
+    });
+});
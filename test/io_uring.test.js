@@ -0,0 +1,59 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('io_uring vfs', function() {
+    it('should report unknown vfs names', function(done) {
+        new sqlite3.Database(':memory:', { vfs: 'does-not-exist' }, function(err) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_ERROR');
+            assert.ok(/no such vfs/.test(err.message));
+            done();
+        });
+    });
+
+    if (sqlite3.IO_URING === undefined) return;
+
+    var filename = 'test/tmp/test_io_uring.db';
+    var db;
+    before(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile(filename);
+        db = new sqlite3.Database(filename, { vfs: 'io_uring', journalMode: 'WAL' }, done);
+    });
+
+    it('should write and read back data', function(done) {
+        db.exec("CREATE TABLE foo (id INT, data BLOB);" +
+            "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 5000) " +
+            "INSERT INTO foo SELECT x, randomblob(500) FROM c;" +
+            "PRAGMA wal_checkpoint(TRUNCATE);", function(err) {
+            if (err) throw err;
+            db.get("SELECT count(*) AS count, sum(id) AS sum, sum(length(data)) AS size FROM foo", function(err, row) {
+                if (err) throw err;
+                assert.deepEqual(row, { count: 5000, sum: 12502500, size: 2500000 });
+                done();
+            });
+        });
+    });
+
+    it('should pass an integrity check after reopening', function(done) {
+        db.close(function(err) {
+            if (err) throw err;
+            db = new sqlite3.Database(filename, { vfs: 'io_uring' });
+            db.get("PRAGMA integrity_check", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.integrity_check, 'ok');
+                done();
+            });
+        });
+    });
+
+    after(function(done) {
+        db.close(function() {
+            helper.deleteFile(filename);
+            helper.deleteFile(filename + '-wal');
+            helper.deleteFile(filename + '-shm');
+            done();
+        });
+    });
+});
@@ -0,0 +1,91 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('buffers', function() {
+    var image;
+
+    before(function(done) {
+        var db = new sqlite3.Database(':memory:');
+        db.exec("CREATE TABLE foo (id INT, data BLOB);" +
+            "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 100) " +
+            "INSERT INTO foo SELECT x, randomblob(100) FROM c;", function(err) {
+            if (err) throw err;
+            db.toBuffer(function(err, buffer) {
+                if (err) throw err;
+                image = buffer;
+                db.close(done);
+            });
+        });
+    });
+
+    function count(db, callback) {
+        db.get("SELECT count(*) AS count FROM foo", function(err, row) {
+            if (err) throw err;
+            callback(row.count);
+        });
+    }
+
+    it('should snapshot a database into a Buffer', function() {
+        assert.ok(Buffer.isBuffer(image));
+        assert.equal(image.toString('ascii', 0, 15), 'SQLite format 3');
+        assert.equal(image.length % 1024, 0);
+    });
+
+    it('should open a Buffer read-only in place', function(done) {
+        var db = new sqlite3.Database(image, sqlite3.OPEN_READONLY, function(err) {
+            if (err) throw err;
+            count(db, function(count) {
+                assert.equal(count, 100);
+                db.run("INSERT INTO foo VALUES (101, NULL)", function(err) {
+                    assert.equal(err.code, 'SQLITE_READONLY');
+                    db.close(done);
+                });
+            });
+        });
+    });
+
+    it('should open a writable copy of a Buffer', function(done) {
+        var original = new Buffer(image);
+        var db = new sqlite3.Database(image);
+        db.run("DELETE FROM foo WHERE id > 50", function(err) {
+            if (err) throw err;
+            count(db, function(count) {
+                assert.equal(count, 50);
+                assert.equal(image.toString('hex'), original.toString('hex'));
+                db.close(done);
+            });
+        });
+    });
+
+    it('should snapshot a WAL database', function(done) {
+        var filename = 'test/tmp/test_to_buffer.db';
+        helper.ensureExists('test/tmp');
+        helper.deleteFile(filename);
+        var db = new sqlite3.Database(filename, { journalMode: 'wal' });
+        db.exec("CREATE TABLE foo (id INT); INSERT INTO foo VALUES (1), (2);", function(err) {
+            if (err) throw err;
+            db.toBuffer(function(err, buffer) {
+                if (err) throw err;
+                db.close(function() {
+                    helper.deleteFile(filename);
+                    helper.deleteFile(filename + '-wal');
+                    helper.deleteFile(filename + '-shm');
+                    var copy = new sqlite3.Database(buffer, sqlite3.OPEN_READONLY);
+                    count(copy, function(count) {
+                        assert.equal(count, 2);
+                        copy.close(done);
+                    });
+                });
+            });
+        });
+    });
+
+    it('should require a callback', function() {
+        var db = new sqlite3.Database(':memory:');
+        assert.throws(function() {
+            db.toBuffer();
+        }, /Argument 0 must be a function/);
+        db.close();
+    });
+});
@@ -0,0 +1,54 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('metrics', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.exec("CREATE TABLE foo (id INTEGER, data TEXT);" +
+            "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 1000) " +
+            "INSERT INTO foo SELECT x, hex(randomblob(100)) FROM c;", done);
+    });
+
+    it('should start without external memory', function() {
+        assert.equal(db.metrics().externalMemory, 0);
+    });
+
+    it('should report result rows while they are converted', function(done) {
+        var during = [];
+        db.each("SELECT * FROM foo", function(err, row) {
+            if (err) throw err;
+            during.push(db.metrics().externalMemory);
+        }, function(err, count) {
+            if (err) throw err;
+            assert.equal(count, 1000);
+            assert.ok(during.every(function(bytes) { return bytes > 0; }));
+            assert.equal(db.metrics().externalMemory, 0);
+            done();
+        });
+    });
+
+    it('should release the memory of all() results', function(done) {
+        db.all("SELECT * FROM foo", function(err, rows) {
+            if (err) throw err;
+            assert.equal(rows.length, 1000);
+            assert.ok(db.metrics().externalMemory >= 200 * 1000);
+            setImmediate(function() {
+                assert.equal(db.metrics().externalMemory, 0);
+                done();
+            });
+        });
+    });
+
+    it('should not report texts again that V8 holds as external strings', function(done) {
+        db.all("SELECT hex(randomblob(50000)) AS data UNION ALL SELECT hex(randomblob(50000))", function(err, rows) {
+            if (err) throw err;
+            assert.equal(rows[0].data.length, 100000);
+            // The strings report their 200000 bytes to V8 themselves.
+            assert.ok(db.metrics().externalMemory < 100000);
+            done();
+        });
+    });
+
+    after(function(done) { db.close(done); });
+});
@@ -0,0 +1,96 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var helper = require('./support/helper');
+
+describe('open options', function() {
+    before(function() {
+        helper.ensureExists('test/tmp');
+    });
+
+    function pragmas(db, names, callback) {
+        var result = {};
+        var remaining = names.length;
+        names.forEach(function(name) {
+            db.get('PRAGMA ' + name, function(err, row) {
+                if (err) throw err;
+                result[name] = row[Object.keys(row)[0]];
+                if (!--remaining) callback(result);
+            });
+        });
+    }
+
+    describe('with explicit settings', function() {
+        var filename = 'test/tmp/test_open_options.db';
+        var db;
+        before(function(done) {
+            helper.deleteFile(filename);
+            db = new sqlite3.Database(filename, {
+                journalMode: 'wal',
+                synchronous: 'NORMAL',
+                cacheSize: -4096,
+                mmapSize: 1048576,
+                tempStore: 'memory',
+                busyTimeout: 250
+            }, done);
+        });
+
+        it('should apply them before the database is open', function(done) {
+            pragmas(db, [ 'journal_mode', 'synchronous', 'cache_size', 'temp_store' ], function(result) {
+                assert.deepEqual(result, {
+                    journal_mode: 'wal',
+                    synchronous: 1,
+                    cache_size: -4096,
+                    temp_store: 2
+                });
+                done();
+            });
+        });
+
+        after(function(done) {
+            db.close(function() {
+                helper.deleteFile(filename);
+                helper.deleteFile(filename + '-wal');
+                helper.deleteFile(filename + '-shm');
+                done();
+            });
+        });
+    });
+
+    it('should accept a mode, options and callback', function(done) {
+        var db = new sqlite3.Database(':memory:', sqlite3.OPEN_READWRITE, { preset: 'throughput' }, function(err) {
+            if (err) throw err;
+            pragmas(db, [ 'synchronous', 'cache_size', 'temp_store' ], function(result) {
+                assert.deepEqual(result, { synchronous: 1, cache_size: -65536, temp_store: 2 });
+                db.close(done);
+            });
+        });
+    });
+
+    it('should let explicit settings override the preset', function(done) {
+        var db = new sqlite3.Database(':memory:', { preset: 'read-only-analytics', tempStore: 'FILE' }, function(err) {
+            if (err) throw err;
+            pragmas(db, [ 'query_only', 'temp_store' ], function(result) {
+                assert.deepEqual(result, { query_only: 1, temp_store: 1 });
+                db.run('CREATE TABLE foo (id INT)', function(err) {
+                    assert.equal(err.code, 'SQLITE_READONLY');
+                    db.close(done);
+                });
+            });
+        });
+    });
+
+    it('should reject invalid options', function() {
+        assert.throws(function() {
+            new sqlite3.Database(':memory:', { preset: 'fastest' });
+        }, /Unknown preset: fastest/);
+        assert.throws(function() {
+            new sqlite3.Database(':memory:', { journalMode: 'fast' });
+        }, /journalMode must be one of DELETE, TRUNCATE, PERSIST, MEMORY, WAL, OFF/);
+        assert.throws(function() {
+            new sqlite3.Database(':memory:', { mmapSize: -1 });
+        }, /mmapSize must be a non-negative integer/);
+        assert.throws(function() {
+            new sqlite3.Database(':memory:', { busyTimeout: 'long' });
+        }, /busyTimeout must be a non-negative integer/);
+    });
+});
@@ -0,0 +1,67 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var child_process = require('child_process');
+var path = require('path');
+
+describe('page cache arena', function() {
+    // SQLite only accepts a page cache before it is initialized, so the
+    // arena is configured in a fresh process.
+    function run(script, callback) {
+        script = "var sqlite3 = require(" + JSON.stringify(path.join(__dirname, '..')) + ");" + script;
+        child_process.execFile(process.execPath, [ '-e', script ], function(err, stdout) {
+            if (err) throw err;
+            callback(JSON.parse(stdout));
+        });
+    }
+
+    it('should validate options', function() {
+        assert.throws(function() {
+            sqlite3.configurePageCache();
+        }, /Options object expected/);
+        assert.throws(function() {
+            sqlite3.configurePageCache({ pages: -1 });
+        }, /non-negative integers/);
+        assert.throws(function() {
+            sqlite3.configurePageCache({ pageSize: 1000, pages: 10 });
+        }, /SQLITE_RANGE: pageSize must be a power of two/);
+    });
+
+    it('should serve pages and lookaside from the arena', function(done) {
+        run(
+            "sqlite3.configurePageCache({ pageSize: 4096, pages: 2000, lookasideSize: 512, lookasideSlots: 64, connections: 2, hugePages: true });" +
+            "var db = new sqlite3.Database(':memory:');" +
+            "db.exec('CREATE TABLE foo (id INT, data BLOB)');" +
+            "db.run('WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 10000) INSERT INTO foo SELECT x, randomblob(100) FROM c', function(err) {" +
+            "  if (err) throw err;" +
+            "  var open = sqlite3.memoryStats().pageCache;" +
+            "  db.close(function() {" +
+            "    console.log(JSON.stringify({ open: open, closed: sqlite3.memoryStats().pageCache }));" +
+            "  });" +
+            "});",
+            function(result) {
+                assert.ok(result.open.size >= 2000 * 4096);
+                assert.equal(result.open.size % (2 * 1024 * 1024), 0);
+                assert.ok(result.open.pagesUsed > 0);
+                assert.equal(result.open.overflow, 0);
+                assert.equal(result.open.lookasideUsed, 1);
+                assert.equal(result.open.lookasideFree, 1);
+                assert.equal(result.closed.lookasideUsed, 0);
+                assert.equal(result.closed.lookasideFree, 2);
+                done();
+            }
+        );
+    });
+
+    it('should refuse to configure after a database was opened', function(done) {
+        run(
+            "var db = new sqlite3.Database(':memory:', function() {" +
+            "  try { sqlite3.configurePageCache({ pages: 100 }); }" +
+            "  catch (err) { console.log(JSON.stringify({ code: err.code })); }" +
+            "});",
+            function(result) {
+                assert.equal(result.code, 'SQLITE_MISUSE');
+                done();
+            }
+        );
+    });
+});
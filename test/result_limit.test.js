@@ -0,0 +1,80 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('result limits', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.exec("CREATE TABLE foo (id INTEGER, name TEXT, data BLOB);" +
+            "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 5000) " +
+            "INSERT INTO foo SELECT x, 'name ' || x, zeroblob(x % 100) FROM c;", done);
+    });
+
+    function checkRows(rows) {
+        assert.equal(rows.length, 5000);
+        rows.forEach(function(row, i) {
+            assert.equal(row.id, i + 1);
+            assert.equal(row.name, 'name ' + (i + 1));
+            assert.equal(row.data.length, (i + 1) % 100);
+        });
+    }
+
+    it('should reject invalid values', function() {
+        assert.throws(function() {
+            db.configure('resultLimit', -1);
+        }, /non-negative number of bytes/);
+        assert.throws(function() {
+            db.configure('resultPolicy', 'drop');
+        }, /"error" or "spill"/);
+    });
+
+    it('should fail queries over the database limit', function(done) {
+        db.configure('resultLimit', 64 * 1024);
+        db.all("SELECT * FROM foo", function(err, rows) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_TOOBIG');
+            assert.ok(/Result exceeds the limit of 65536 bytes/.test(err.message));
+            assert.equal(rows, undefined);
+            done();
+        });
+    });
+
+    it('should allow queries under the limit', function(done) {
+        db.all("SELECT * FROM foo WHERE id <= 10", function(err, rows) {
+            if (err) throw err;
+            assert.equal(rows.length, 10);
+            done();
+        });
+    });
+
+    it('should spill rows to disk', function(done) {
+        db.configure('resultPolicy', 'spill');
+        db.all("SELECT * FROM foo ORDER BY id", function(err, rows) {
+            if (err) throw err;
+            checkRows(rows);
+            done();
+        });
+    });
+
+    it('should let statements override the limit', function(done) {
+        db.configure('resultPolicy', 'error');
+        var stmt = db.prepare("SELECT * FROM foo ORDER BY id");
+        stmt.configure('resultLimit', 0);
+        stmt.all(function(err, rows) {
+            if (err) throw err;
+            checkRows(rows);
+
+            stmt.configure('resultLimit', 1024).configure('resultPolicy', 'spill');
+            stmt.all(function(err, rows) {
+                if (err) throw err;
+                checkRows(rows);
+                stmt.finalize(done);
+            });
+        });
+    });
+
+    after(function(done) {
+        db.configure('resultLimit', 0);
+        db.close(done);
+    });
+});
@@ -0,0 +1,77 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('result slices', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.exec("CREATE TABLE foo (id INTEGER, name TEXT);" +
+            "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 10000) " +
+            "INSERT INTO foo SELECT x, 'name ' || x FROM c;", done);
+    });
+
+    function checkRows(rows) {
+        assert.equal(rows.length, 10000);
+        rows.forEach(function(row, i) {
+            assert.equal(row.id, i + 1);
+            assert.equal(row.name, 'name ' + (i + 1));
+        });
+    }
+
+    it('should reject invalid values', function() {
+        assert.throws(function() {
+            db.configure('resultSliceRows', -1);
+        }, /non-negative integer/);
+        assert.throws(function() {
+            db.configure('resultSliceTime', 'soon');
+        }, /non-negative integer/);
+    });
+
+    it('should convert rows in slices of rows', function(done) {
+        db.configure('resultSliceRows', 1000);
+        // The rows' memory is only reported while they are converted, so
+        // seeing it from another callback means that the conversion was
+        // spread over several turns of the event loop.
+        var finished = false;
+        var interleaved = false;
+        (function sample() {
+            if (db.metrics().externalMemory > 0) interleaved = true;
+            if (!finished) setImmediate(sample);
+        })();
+
+        db.all("SELECT * FROM foo ORDER BY id", function(err, rows) {
+            finished = true;
+            if (err) throw err;
+            checkRows(rows);
+            assert.ok(interleaved);
+            done();
+        });
+    });
+
+    it('should convert rows in slices of time', function(done) {
+        db.configure('resultSliceRows', 0);
+        db.configure('resultSliceTime', 1);
+        db.all("SELECT * FROM foo ORDER BY id", function(err, rows) {
+            if (err) throw err;
+            checkRows(rows);
+            done();
+        });
+    });
+
+    it('should combine slices with spilled rows', function(done) {
+        var stmt = db.prepare("SELECT * FROM foo ORDER BY id");
+        stmt.configure('resultLimit', 4096)
+            .configure('resultPolicy', 'spill')
+            .configure('resultSliceRows', 500);
+        stmt.all(function(err, rows) {
+            if (err) throw err;
+            checkRows(rows);
+            stmt.finalize(done);
+        });
+    });
+
+    after(function(done) {
+        db.configure('resultSliceTime', 0);
+        db.close(done);
+    });
+});
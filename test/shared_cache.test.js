@@ -0,0 +1,61 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('shared cache', function() {
+    var uri = 'file:shared_cache_test?mode=memory&cache=shared';
+    var mode = sqlite3.OPEN_READWRITE | sqlite3.OPEN_CREATE | sqlite3.OPEN_URI;
+    var writer, reader;
+
+    before(function(done) {
+        writer = new sqlite3.Database(uri, mode, function(err) {
+            if (err) throw err;
+            reader = new sqlite3.Database(uri, mode, done);
+        });
+    });
+
+    it('should share an in-memory database between instances', function(done) {
+        writer.exec("CREATE TABLE foo (id INT); INSERT INTO foo VALUES (1)", function(err) {
+            if (err) throw err;
+            reader.get("SELECT count(*) AS count FROM foo", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.count, 1);
+                done();
+            });
+        });
+    });
+
+    it('should wait for table locks held by other instances', function(done) {
+        var committed = false;
+        writer.serialize(function() {
+            writer.run("BEGIN");
+            writer.run("INSERT INTO foo VALUES (2)", function(err) {
+                if (err) throw err;
+                reader.all("SELECT id FROM foo ORDER BY id", function(err, rows) {
+                    if (err) throw err;
+                    assert.ok(committed);
+                    assert.deepEqual(rows, [ { id: 1 }, { id: 2 } ]);
+                    done();
+                });
+                setTimeout(function() {
+                    committed = true;
+                    writer.run("COMMIT");
+                }, 50);
+            });
+        });
+    });
+
+    it('should not see other databases without a shared cache', function(done) {
+        var other = new sqlite3.Database(':memory:');
+        other.get("SELECT count(*) AS count FROM sqlite_master", function(err, row) {
+            if (err) throw err;
+            assert.equal(row.count, 0);
+            other.close(done);
+        });
+    });
+
+    after(function(done) {
+        reader.close(function() {
+            writer.close(done);
+        });
+    });
+});
@@ -0,0 +1,85 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('sketch functions', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.exec("CREATE TABLE requests (minute INT, latency REAL, user TEXT);" +
+            "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 100000) " +
+            "INSERT INTO requests SELECT x % 60, x / 1000.0, 'user ' || (x % 12345) FROM c;", done);
+    });
+
+    function near(actual, expected, tolerance) {
+        assert.ok(Math.abs(actual - expected) <= tolerance * expected,
+            actual + ' is not within ' + (tolerance * 100) + '% of ' + expected);
+    }
+
+    it('should estimate percentiles', function(done) {
+        db.get("SELECT percentile_approx(latency, 0.5) AS p50, percentile_approx(latency, 0.95) AS p95, " +
+                "percentile_approx(latency, 0) AS min, percentile_approx(latency, 1) AS max " +
+                "FROM requests", function(err, row) {
+            if (err) throw err;
+            near(row.p50, 50, 0.01);
+            near(row.p95, 95, 0.01);
+            assert.equal(row.min, 0.001);
+            assert.equal(row.max, 100);
+            done();
+        });
+    });
+
+    it('should estimate distinct counts', function(done) {
+        db.get("SELECT count_distinct_approx(user) AS users, count_distinct_approx(minute) AS minutes " +
+                "FROM requests", function(err, row) {
+            if (err) throw err;
+            near(row.users, 12345, 0.03);
+            assert.equal(row.minutes, 60);
+            done();
+        });
+    });
+
+    it('should return NULL and 0 without values', function(done) {
+        db.get("SELECT percentile_approx(latency, 0.5) AS p50, count_distinct_approx(user) AS users, " +
+                "tdigest(latency) AS digest FROM requests WHERE latency < 0", function(err, row) {
+            if (err) throw err;
+            assert.equal(row.p50, null);
+            assert.equal(row.users, 0);
+            assert.equal(row.digest, null);
+            done();
+        });
+    });
+
+    it('should reject quantiles out of range', function(done) {
+        db.get("SELECT percentile_approx(latency, 1.5) FROM requests", function(err) {
+            assert.ok(err);
+            assert.ok(/q must be between 0 and 1/.test(err.message));
+            done();
+        });
+    });
+
+    it('should merge sketches', function(done) {
+        db.serialize(function() {
+            db.run("CREATE TABLE rollup AS SELECT minute, tdigest(latency) AS latency, hll(user) AS users " +
+                "FROM requests GROUP BY minute");
+            db.get("SELECT tdigest_percentile(tdigest_merge(latency), 0.95) AS p95, " +
+                    "hll_count(hll_merge(users)) AS users FROM rollup", function(err, row) {
+                if (err) throw err;
+                near(row.p95, 95, 0.01);
+                near(row.users, 12345, 0.03);
+                done();
+            });
+        });
+    });
+
+    it('should reject invalid sketches', function(done) {
+        db.get("SELECT hll_count(x'0102')", function(err) {
+            assert.ok(err);
+            assert.ok(/hll_count: invalid sketch/.test(err.message));
+            done();
+        });
+    });
+
+    after(function(done) {
+        db.close(done);
+    });
+});
@@ -0,0 +1,89 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('slow query log', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:', done);
+    });
+
+    it('should reject invalid thresholds', function() {
+        assert.throws(function() {
+            db.configure('slowQuery', 'fast');
+        }, /Value must be a non-negative integer/);
+    });
+
+    it('should not record anything while disabled', function(done) {
+        db.all("SELECT 1", function(err) {
+            if (err) throw err;
+            assert.deepEqual(db.slowQueries(), []);
+            done();
+        });
+    });
+
+    it('should record slow statements with parameters and plan', function(done) {
+        db.configure('slowQuery', 1);
+        db.all("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < ?) " +
+               "SELECT count(*) AS total FROM c", 1000000, function(err, rows) {
+            if (err) throw err;
+            assert.equal(rows[0].total, 1000000);
+
+            var entries = db.slowQueries();
+            assert.equal(entries.length, 1);
+            assert.ok(entries[0].sql.match(/^WITH RECURSIVE/));
+            assert.ok(typeof entries[0].time === "number");
+            assert.ok(entries[0].time >= 1);
+            assert.deepEqual(entries[0].params, { 1: 1000000 });
+            assert.ok(Array.isArray(entries[0].plan));
+            assert.ok(entries[0].plan.length > 0);
+
+            // The log is drained by reading it.
+            assert.deepEqual(db.slowQueries(), []);
+            done();
+        });
+    });
+
+    it('should ignore fast statements', function(done) {
+        db.run("CREATE TABLE foo (id INT)", function(err) {
+            if (err) throw err;
+            assert.deepEqual(db.slowQueries(), []);
+            done();
+        });
+    });
+
+    it('should record get() with the parameters it ran with', function(done) {
+        db.configure('slowQuery', 1);
+        var stmt = db.prepare("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < ?) " +
+                              "SELECT count(*) AS total FROM c");
+        stmt.get(1000000, function(err, row) {
+            if (err) throw err;
+            assert.equal(row.total, 1000000);
+
+            // The statement stopped at its row, so it's only recorded once
+            // the next call resets it.
+            stmt.get(10, function(err, row) {
+                if (err) throw err;
+                assert.equal(row.total, 10);
+
+                var entries = db.slowQueries();
+                assert.equal(entries.length, 1);
+                assert.deepEqual(entries[0].params, { 1: 1000000 });
+                stmt.finalize(done);
+            });
+        });
+    });
+
+    it('should stop recording when disabled', function(done) {
+        db.configure('slowQuery', 0);
+        db.all("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 1000000) " +
+               "SELECT count(*) AS total FROM c", function(err) {
+            if (err) throw err;
+            assert.deepEqual(db.slowQueries(), []);
+            done();
+        });
+    });
+
+    after(function(done) {
+        db.close(done);
+    });
+});
@@ -0,0 +1,62 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+var fs = require('fs');
+var helper = require('./support/helper');
+
+describe('timeline', function() {
+    var db;
+    before(function(done) {
+        helper.ensureExists('test/tmp');
+        helper.deleteFile('test/tmp/timeline.json');
+        sqlite3.timeline.start();
+        db = new sqlite3.Database(':memory:', done);
+    });
+
+    it('should record operations', function(done) {
+        db.serialize(function() {
+            db.run("CREATE TABLE foo (id INT)");
+            db.run("INSERT INTO foo VALUES (1)");
+            db.all("SELECT * FROM foo", done);
+        });
+    });
+
+    it('should write chrome trace events', function(done) {
+        sqlite3.timeline.stop('test/tmp/timeline.json', function(err, count) {
+            if (err) throw err;
+            assert.ok(count > 0);
+
+            var trace = JSON.parse(fs.readFileSync('test/tmp/timeline.json', 'utf8'));
+            var work = trace.traceEvents.filter(function(event) {
+                return event.cat === 'work';
+            });
+            var names = work.map(function(event) { return event.name; });
+            assert.ok(names.indexOf('Database.Open') >= 0);
+            assert.ok(names.indexOf('Statement.Prepare') >= 0);
+            assert.ok(names.indexOf('Statement.All') >= 0);
+
+            work.forEach(function(event) {
+                assert.ok(event.tid > 0);
+                assert.ok(event.dur >= 0);
+                assert.ok(event.args.queued_us >= 0);
+                assert.ok(event.args.threadpool_wait_us >= 0);
+            });
+
+            var all = work.filter(function(event) { return event.name === 'Statement.All'; })[0];
+            assert.equal(all.args.sql, "SELECT * FROM foo");
+            done();
+        });
+    });
+
+    it('should not record once stopped', function(done) {
+        db.all("SELECT * FROM foo", function(err) {
+            if (err) throw err;
+            assert.deepEqual(sqlite3.stopTimeline(), []);
+            done();
+        });
+    });
+
+    after(function(done) {
+        helper.deleteFile('test/tmp/timeline.json');
+        db.close(done);
+    });
+});
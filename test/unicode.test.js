@@ -57,3 +57,44 @@ describe('unicode', function() {
 
     after(function(done) { db.close(done); });
 });
+
+describe('one-byte text', function() {
+    var db;
+    before(function(done) { db = new sqlite3.Database(':memory:', done); });
+
+    var values = [
+        '',
+        'plain ascii identifier',
+        '{"json":"text","n":[1,2,3]}',
+        'café naïve © ÿ',
+        'mixed é and € euro',
+        'astral 😀',
+        new Array(100001).join('x'),
+        new Array(50001).join('éa'),
+        new Array(50001).join('€')
+    ];
+
+    it('should retrieve ASCII, Latin-1 and other text unchanged', function(done) {
+        db.all("SELECT ?1 AS a, ?2 AS b, ?3 AS c, ?4 AS d, ?5 AS e, ?6 AS f, ?7 AS g, ?8 AS h, ?9 AS i",
+                values, function(err, rows) {
+            if (err) throw err;
+            var row = rows[0];
+            [ 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i' ].forEach(function(column, i) {
+                assert.equal(row[column].length, values[i].length);
+                assert.ok(row[column] === values[i], 'column ' + column + ' differs');
+            });
+            done();
+        });
+    });
+
+    it('should pass one-byte text to functions', function(done) {
+        db.function('text_length', function(value) { return value.length; });
+        db.get("SELECT text_length(?) AS length", 'café', function(err, row) {
+            if (err) throw err;
+            assert.equal(row.length, 4);
+            done();
+        });
+    });
+
+    after(function(done) { db.close(done); });
+});
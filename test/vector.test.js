@@ -0,0 +1,125 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+function vector(values) {
+    var buffer = new Buffer(values.length * 4);
+    for (var i = 0; i < values.length; i++) buffer.writeFloatLE(values[i], i * 4);
+    return buffer;
+}
+
+describe('vector functions', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.serialize(function() {
+            db.run("CREATE TABLE items (id INTEGER PRIMARY KEY, embedding BLOB)");
+            var stmt = db.prepare("INSERT INTO items VALUES (?, ?)");
+            for (var i = 1; i <= 100; i++) {
+                // Long enough to go through the vector loops and the tail.
+                var values = [];
+                for (var j = 0; j < 19; j++) values.push(j === 0 ? i : (i + j) % 7);
+                stmt.run(i, vector(values));
+            }
+            stmt.finalize(done);
+        });
+    });
+
+    it('should report the kernels in use', function() {
+        assert.ok([ 'avx2', 'sse', 'scalar' ].indexOf(sqlite3.VECTOR_KERNEL) >= 0);
+    });
+
+    it('should compute dot products and distances', function(done) {
+        db.get("SELECT vec_dot(?1, ?2) AS dot, vec_l2(?1, ?2) AS l2, vec_cosine(?1, ?1) AS cosine",
+                vector([ 1, 2, 3 ]), vector([ 4, 6, 3 ]), function(err, row) {
+            if (err) throw err;
+            assert.equal(row.dot, 25);
+            assert.equal(row.l2, 5);
+            assert.ok(Math.abs(row.cosine - 1) < 1e-6);
+            done();
+        });
+    });
+
+    it('should match a JavaScript implementation', function(done) {
+        db.all("SELECT id, embedding, vec_dot(embedding, ?1) AS dot, vec_l2(embedding, ?1) AS l2 " +
+                "FROM items", vector([ 0.5, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18 ]),
+                function(err, rows) {
+            if (err) throw err;
+            assert.equal(rows.length, 100);
+            rows.forEach(function(row) {
+                var dot = 0, l2 = 0;
+                for (var i = 0; i < 19; i++) {
+                    var a = row.embedding.readFloatLE(i * 4), b = i === 0 ? 0.5 : i;
+                    dot += a * b;
+                    l2 += (a - b) * (a - b);
+                }
+                assert.ok(Math.abs(row.dot - dot) < 1e-3);
+                assert.ok(Math.abs(row.l2 - Math.sqrt(l2)) < 1e-3);
+            });
+            done();
+        });
+    });
+
+    it('should return NULL for NULL arguments and zero vectors', function(done) {
+        db.get("SELECT vec_dot(NULL, ?1) AS dot, vec_cosine(?1, ?2) AS cosine",
+                vector([ 1, 2 ]), vector([ 0, 0 ]), function(err, row) {
+            if (err) throw err;
+            assert.equal(row.dot, null);
+            assert.equal(row.cosine, null);
+            done();
+        });
+    });
+
+    it('should reject vectors of different sizes', function(done) {
+        db.get("SELECT vec_dot(?, ?)", vector([ 1, 2 ]), vector([ 1, 2, 3 ]), function(err) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_ERROR');
+            assert.ok(/same number of dimensions/.test(err.message));
+            done();
+        });
+    });
+
+    it('should reject arguments that are not BLOBs', function(done) {
+        db.get("SELECT vec_l2('text', ?)", vector([ 1 ]), function(err) {
+            assert.ok(err);
+            assert.ok(/must be BLOBs of float32 values/.test(err.message));
+            done();
+        });
+    });
+
+    it('should return the closest ids', function(done) {
+        var query = vector([ 42, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 ]);
+        db.all("SELECT vec_l2(embedding, ?1) AS score FROM items ORDER BY score LIMIT 5", query, function(err, rows) {
+            if (err) throw err;
+            db.get("SELECT vec_top_k(id, vec_l2(embedding, ?1), 5) AS top FROM items", query, function(err, row) {
+                if (err) throw err;
+                var top = JSON.parse(row.top);
+                assert.equal(top.length, 5);
+                // Ids of equal scores may come in any order, so compare
+                // the scores.
+                assert.deepEqual(top.map(function(entry) { return entry[1]; }),
+                    rows.map(function(row) { return row.score; }));
+                done();
+            });
+        });
+    });
+
+    it('should return an empty list without rows', function(done) {
+        db.get("SELECT vec_top_k(id, 1.0, 3) AS top FROM items WHERE id < 0", function(err, row) {
+            if (err) throw err;
+            assert.equal(row.top, '[]');
+            done();
+        });
+    });
+
+    it('should reject an invalid k', function(done) {
+        db.get("SELECT vec_top_k(id, 1.0, 0) FROM items", function(err) {
+            assert.ok(err);
+            assert.ok(/k must be a positive integer/.test(err.message));
+            done();
+        });
+    });
+
+    after(function(done) {
+        db.close(done);
+    });
+});
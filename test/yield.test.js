@@ -0,0 +1,97 @@
+var sqlite3 = require('..');
+var assert = require('assert');
+
+describe('cooperative yielding', function() {
+    var db;
+    before(function(done) {
+        db = new sqlite3.Database(':memory:');
+        db.exec("CREATE TABLE foo (id INTEGER, name TEXT);" +
+            "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 100000) " +
+            "INSERT INTO foo SELECT x, 'name ' || x FROM c;" +
+            "CREATE TABLE bar (id INTEGER)", done);
+    });
+
+    it('should reject invalid values', function() {
+        assert.throws(function() {
+            db.configure('yieldSteps', -1);
+        }, /non-negative integer/);
+    });
+
+    it('should run scripts one statement at a time', function(done) {
+        db.configure('execYield', true);
+        var script = '';
+        for (var i = 1; i <= 500; i++) script += 'INSERT INTO bar VALUES (' + i + '); -- ' + i + '\n';
+
+        var counted = false;
+        db.exec(script, function(err) {
+            if (err) throw err;
+            assert.ok(counted);
+            db.get("SELECT COUNT(*) AS count FROM bar", function(err, row) {
+                if (err) throw err;
+                assert.equal(row.count, 500);
+                done();
+            });
+        });
+        db.get("SELECT COUNT(*) AS count FROM bar", function(err, row) {
+            if (err) throw err;
+            assert.ok(row.count < 500);
+            counted = true;
+        });
+    });
+
+    it('should stop scripts at the first error', function(done) {
+        db.exec("DELETE FROM bar; INSERT INTO bar VALUES (1); INSERT INTO nonexistent VALUES (2); " +
+                "INSERT INTO bar VALUES (3)", function(err) {
+            assert.ok(err);
+            assert.equal(err.code, 'SQLITE_ERROR');
+            assert.ok(/no such table: nonexistent/.test(err.message));
+            db.all("SELECT id FROM bar", function(err, rows) {
+                if (err) throw err;
+                assert.deepEqual(rows, [ { id: 1 } ]);
+                db.configure('execYield', false);
+                done();
+            });
+        });
+    });
+
+    it('should finish scripts before closing', function(done) {
+        var other = new sqlite3.Database(':memory:');
+        other.configure('execYield', true);
+        var script = 'CREATE TABLE bar (id INTEGER);';
+        for (var i = 1; i <= 100; i++) script += 'INSERT INTO bar VALUES (' + i + ');';
+        script += 'SELECT 1;';
+
+        var executed = false;
+        other.exec(script, function(err) {
+            if (err) throw err;
+            executed = true;
+        });
+        other.close(function(err) {
+            if (err) throw err;
+            assert.ok(executed);
+            done();
+        });
+    });
+
+    it('should let queries run during long reads', function(done) {
+        db.configure('yieldSteps', 100);
+        var found = false;
+        db.all("SELECT * FROM foo", function(err, rows) {
+            if (err) throw err;
+            assert.ok(found);
+            assert.equal(rows.length, 100000);
+            assert.deepEqual(rows[99999], { id: 100000, name: 'name 100000' });
+            db.configure('yieldSteps', 0);
+            done();
+        });
+        db.get("SELECT name FROM foo WHERE id = 42", function(err, row) {
+            if (err) throw err;
+            assert.equal(row.name, 'name 42');
+            found = true;
+        });
+    });
+
+    after(function(done) {
+        db.close(done);
+    });
+});